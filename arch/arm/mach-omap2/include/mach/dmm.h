@@ -106,7 +106,9 @@ struct pat_ctrl {
 };
 
 /**
- * PAT descriptor.
+ * PAT descriptor.  Descriptors of a chain are read by the DMM: they must be
+ * in DMA coherent memory, and next holds the physical address of the next
+ * descriptor (or NULL for the last one).
  */
 struct pat {
 	struct pat *next;
@@ -138,6 +140,27 @@ struct dmm *dmm_pat_init(u32 id);
  */
 s32 dmm_pat_refill(struct dmm *dmm, struct pat *desc, enum pat_mode mode);
 
+/**
+ * Start programming the physical address translator with a chain of
+ * descriptors, without waiting for it to complete.  The DMM interrupt
+ * signals completion; only one chain is in flight at a time, so this waits
+ * for the previous one first.  Without the interrupt the descriptors are
+ * refilled one by one before returning, so they must follow each other in
+ * memory.
+ * @param dmm     Device data
+ * @param desc    first PAT descriptor of the chain
+ * @param desc_pa physical address of desc (16-byte aligned)
+ * @return an error status.
+ */
+s32 dmm_pat_refill_async(struct dmm *dmm, struct pat *desc, u32 desc_pa);
+
+/**
+ * Wait for the last chain started by dmm_pat_refill_async() to complete.
+ * @param dmm   Device data
+ * @return an error status of the chain.
+ */
+s32 dmm_pat_sync(struct dmm *dmm);
+
 /**
  * Clean up the physical address translator.
  * @param dmm    Device data
@@ -18,12 +18,14 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/anon_inodes.h>
+#include <linux/hash.h>
 #include <linux/ion.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/mm_types.h>
 #include <linux/rbtree.h>
+#include <linux/rculist.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/seq_file.h>
@@ -78,6 +80,10 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	kref_init(&buffer->ref);
 
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	if (ret && (heap->flags & ION_HEAP_FLAG_DEFER_FREE) &&
+	    ion_heap_freelist_drain(heap, 0))
+		/* memory we were about to give back may be enough to succeed */
+		ret = heap->ops->allocate(heap, buffer, len, align, flags);
 	if (ret) {
 		kfree(buffer);
 		return ERR_PTR(ret);
@@ -90,16 +96,30 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	return buffer;
 }
 
-static void ion_buffer_destroy(struct kref *kref)
+void ion_buffer_destroy(struct ion_buffer *buffer)
+{
+	buffer->heap->ops->free(buffer);
+	kfree_rcu(buffer, rcu);
+}
+
+static void _ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
+	struct ion_heap *heap = buffer->heap;
 	struct ion_device *dev = buffer->dev;
 
-	buffer->heap->ops->free(buffer);
+	/*
+	 * Unlink the buffer right away so the deferred free path, which may
+	 * run from a shrinker under ion_alloc(), never needs dev->lock.
+	 */
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
 	mutex_unlock(&dev->lock);
-	kfree(buffer);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_add(heap, buffer);
+	else
+		ion_buffer_destroy(buffer);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -109,7 +129,7 @@ static void ion_buffer_get(struct ion_buffer *buffer)
 
 static int ion_buffer_put(struct ion_buffer *buffer)
 {
-	return kref_put(&buffer->ref, ion_buffer_destroy);
+	return kref_put(&buffer->ref, _ion_buffer_destroy);
 }
 
 static struct ion_handle *ion_handle_create(struct ion_client *client,
@@ -121,7 +141,8 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 	if (!handle)
 		return ERR_PTR(-ENOMEM);
 	kref_init(&handle->ref);
-	rb_init_node(&handle->node);
+	INIT_HLIST_NODE(&handle->node);
+	INIT_HLIST_NODE(&handle->buffer_node);
 	handle->client = client;
 	ion_buffer_get(buffer);
 	handle->buffer = buffer;
@@ -132,15 +153,23 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 static void ion_handle_destroy(struct kref *kref)
 {
 	struct ion_handle *handle = container_of(kref, struct ion_handle, ref);
+	struct ion_client *client = handle->client;
+	struct ion_device *dev = client->dev;
+
 	/* XXX Can a handle be destroyed while it's map count is non-zero?:
 	   if (handle->map_cnt) unmap
 	 */
+	mutex_lock(&client->lock);
+	if (!hlist_unhashed(&handle->buffer_node)) {
+		hlist_del_rcu(&handle->buffer_node);
+		spin_lock(&dev->handle_lock);
+		hlist_del_rcu(&handle->node);
+		spin_unlock(&dev->handle_lock);
+	}
+	mutex_unlock(&client->lock);
+	/* both are freed after a grace period, rcu walkers may still look */
 	ion_buffer_put(handle->buffer);
-	mutex_lock(&handle->client->lock);
-	if (!RB_EMPTY_NODE(&handle->node))
-		rb_erase(&handle->node, &handle->client->handles);
-	mutex_unlock(&handle->client->lock);
-	kfree(handle);
+	kfree_rcu(handle, rcu);
 }
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
@@ -148,95 +177,114 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
 	return handle->buffer;
 }
 
-static void ion_handle_get(struct ion_handle *handle)
+static int ion_handle_put(struct ion_handle *handle)
 {
-	kref_get(&handle->ref);
+	return kref_put(&handle->ref, ion_handle_destroy);
 }
 
-static int ion_handle_put(struct ion_handle *handle)
+static struct hlist_head *ion_handle_bucket(struct ion_device *dev,
+					   struct ion_handle *handle)
 {
-	return kref_put(&handle->ref, ion_handle_destroy);
+	return &dev->handles[hash_ptr(handle, ION_HANDLE_HASH_BITS)];
+}
+
+static struct hlist_head *ion_buffer_bucket(struct ion_client *client,
+					   struct ion_buffer *buffer)
+{
+	return &client->handles[hash_ptr(buffer, ION_CLIENT_HASH_BITS)];
 }
 
+/* call under rcu_read_lock() or with client->lock held */
 static struct ion_handle *ion_handle_lookup(struct ion_client *client,
 					    struct ion_buffer *buffer)
 {
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
 
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
+	hlist_for_each_entry_rcu(handle, n, ion_buffer_bucket(client, buffer),
+				 buffer_node)
 		if (handle->buffer == buffer)
 			return handle;
-	}
 	return NULL;
 }
 
+/*
+ * Handles come in from userspace and other drivers, so they may not point
+ * at a handle at all: only compare the pointer until it is found.  Lookups
+ * are lock free; the result is only stable while the caller holds a
+ * reference to the handle or client->lock.
+ */
 static bool ion_handle_validate(struct ion_client *client, struct ion_handle *handle)
 {
-	struct rb_node *n = client->handles.rb_node;
+	struct ion_handle *entry;
+	struct hlist_node *n;
+	bool valid = false;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(entry, n, ion_handle_bucket(client->dev, handle),
+				 node) {
+		if (entry == handle) {
+			valid = entry->client == client;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return valid;
+}
 
-	while (n) {
-		struct ion_handle *handle_node = rb_entry(n, struct ion_handle,
-							  node);
-		if (handle < handle_node)
-			n = n->rb_left;
-		else if (handle > handle_node)
-			n = n->rb_right;
-		else
-			return true;
+/*
+ * Like ion_handle_validate(), but also takes a reference to the handle so
+ * the caller can use it without holding client->lock.
+ */
+static bool ion_handle_validate_get(struct ion_client *client,
+				    struct ion_handle *handle)
+{
+	struct ion_handle *entry;
+	struct hlist_node *n;
+	bool valid = false;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(entry, n, ion_handle_bucket(client->dev, handle),
+				 node) {
+		if (entry == handle) {
+			valid = entry->client == client &&
+				atomic_inc_not_zero(&entry->ref.refcount);
+			break;
+		}
 	}
-	return false;
+	rcu_read_unlock();
+	return valid;
 }
 
 static bool ion_handle_validate_frm_dev(struct ion_device *dev,
 					struct ion_handle *handle)
 {
-	struct rb_node **p;
-	struct rb_node *parent = NULL;
-	struct ion_client *client;
-	struct rb_node *n;
-
-	p = &dev->user_clients.rb_node;
-	while (*p) {
-		parent = *p;
-		client = rb_entry(parent, struct ion_client, node);
-
-		n = client->handles.rb_node;
-		while (n) {
-			struct ion_handle *handle_node =
-					rb_entry(n, struct ion_handle, node);
-			if (handle < handle_node)
-				n = n->rb_left;
-			else if (handle > handle_node)
-				n = n->rb_right;
-			else
-				return true;
+	struct ion_handle *entry;
+	struct hlist_node *n;
+	bool valid = false;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(entry, n, ion_handle_bucket(dev, handle),
+				 node) {
+		if (entry == handle) {
+			valid = true;
+			break;
 		}
 	}
-	return false;
+	rcu_read_unlock();
+	return valid;
 }
 
+/* call with client->lock held */
 static void ion_handle_add(struct ion_client *client, struct ion_handle *handle)
 {
-	struct rb_node **p = &client->handles.rb_node;
-	struct rb_node *parent = NULL;
-	struct ion_handle *entry;
-
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct ion_handle, node);
-
-		if (handle < entry)
-			p = &(*p)->rb_left;
-		else if (handle > entry)
-			p = &(*p)->rb_right;
-		else
-			WARN(1, "%s: buffer already found.", __func__);
-	}
+	struct ion_device *dev = client->dev;
 
-	rb_link_node(&handle->node, parent, p);
-	rb_insert_color(&handle->node, &client->handles);
+	hlist_add_head_rcu(&handle->buffer_node,
+			   ion_buffer_bucket(client, handle->buffer));
+	spin_lock(&dev->handle_lock);
+	hlist_add_head_rcu(&handle->node, ion_handle_bucket(dev, handle));
+	spin_unlock(&dev->handle_lock);
 }
 
 struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
@@ -301,9 +349,7 @@ void ion_free(struct ion_client *client, struct ion_handle *handle)
 		return;
 	BUG_ON(client != handle->client);
 
-	mutex_lock(&client->lock);
 	valid_handle = ion_handle_validate(client, handle);
-	mutex_unlock(&client->lock);
 
 	if (!valid_handle) {
 		WARN("%s: invalid handle passed to free.\n", __func__);
@@ -351,21 +397,16 @@ int ion_phys(struct ion_client *client, struct ion_handle *handle,
 	struct ion_buffer *buffer;
 	int ret;
 
-	mutex_lock(&client->lock);
-	if (!ion_handle_validate(client, handle)) {
-		mutex_unlock(&client->lock);
+	if (!ion_handle_validate(client, handle))
 		return -EINVAL;
-	}
 
 	buffer = handle->buffer;
 
 	if (!buffer->heap->ops->phys) {
 		pr_err("%s: ion_phys is not implemented by this heap.\n",
 		       __func__);
-		mutex_unlock(&client->lock);
 		return -ENODEV;
 	}
-	mutex_unlock(&client->lock);
 	ret = buffer->heap->ops->phys(buffer->heap, buffer, addr, len);
 	return ret;
 }
@@ -377,12 +418,8 @@ int ion_phys_frm_dev(struct ion_device *dev, struct ion_handle *handle,
 	struct ion_buffer *buffer;
 	int ret;
 
-	/* TBD: Investigate why this validate_frm_dev is taking very long
-	* Once root-caused and fixed, then enable this below logic.
-	*/
-	/* if (!ion_handle_validate_frm_dev(dev, handle))
+	if (!ion_handle_validate_frm_dev(dev, handle))
 		return -EINVAL;
-	*/
 
 	buffer = handle->buffer;
 
@@ -508,9 +545,7 @@ struct ion_buffer *ion_share(struct ion_client *client,
 {
 	bool valid_handle;
 
-	mutex_lock(&client->lock);
 	valid_handle = ion_handle_validate(client, handle);
-	mutex_unlock(&client->lock);
 	if (!valid_handle) {
 		WARN("%s: invalid handle passed to share.\n", __func__);
 		return ERR_PTR(-EINVAL);
@@ -530,13 +565,23 @@ struct ion_handle *ion_import(struct ion_client *client,
 {
 	struct ion_handle *handle = NULL;
 
+	/* fast path: a live handle for this buffer, without the lock */
+	rcu_read_lock();
+	handle = ion_handle_lookup(client, buffer);
+	if (handle && atomic_inc_not_zero(&handle->ref.refcount)) {
+		rcu_read_unlock();
+		return handle;
+	}
+	rcu_read_unlock();
+
 	mutex_lock(&client->lock);
-	/* if a handle exists for this buffer just take a reference to it */
+	/*
+	 * if a handle exists for this buffer just take a reference to it,
+	 * unless it is already on its way out and waiting for our lock
+	 */
 	handle = ion_handle_lookup(client, buffer);
-	if (!IS_ERR_OR_NULL(handle)) {
-		ion_handle_get(handle);
+	if (handle && atomic_inc_not_zero(&handle->ref.refcount))
 		goto end;
-	}
 	handle = ion_handle_create(client, buffer);
 	if (IS_ERR_OR_NULL(handle))
 		goto end;
@@ -574,22 +619,24 @@ EXPORT_SYMBOL(ion_import_fd);
 static int ion_debug_client_show(struct seq_file *s, void *unused)
 {
 	struct ion_client *client = s->private;
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
 	size_t sizes[ION_NUM_HEAPS] = {0};
 	const char *names[ION_NUM_HEAPS] = {0};
-	int i;
+	int i, b;
 
-	mutex_lock(&client->lock);
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
-		enum ion_heap_type type = handle->buffer->heap->type;
+	rcu_read_lock();
+	for (b = 0; b < ARRAY_SIZE(client->handles); b++) {
+		hlist_for_each_entry_rcu(handle, n, &client->handles[b],
+					 buffer_node) {
+			enum ion_heap_type type = handle->buffer->heap->type;
 
-		if (!names[type])
-			names[type] = handle->buffer->heap->name;
-		sizes[type] += handle->buffer->size;
+			if (!names[type])
+				names[type] = handle->buffer->heap->name;
+			sizes[type] += handle->buffer->size;
+		}
 	}
-	mutex_unlock(&client->lock);
+	rcu_read_unlock();
 
 	seq_printf(s, "%16.16s: %16.16s\n", "heap_name", "size_in_bytes");
 	for (i = 0; i < ION_NUM_HEAPS; i++) {
@@ -598,6 +645,27 @@ static int ion_debug_client_show(struct seq_file *s, void *unused)
 		seq_printf(s, "%16.16s: %16u %d\n", names[i], sizes[i],
 			   atomic_read(&client->ref.refcount));
 	}
+
+	seq_printf(s, "\n%10.10s %10.10s %10.10s %10.10s %12.12s %10.10s\n",
+		   "buffer", "size", "syncs", "skipped", "bytes", "time_us");
+	rcu_read_lock();
+	for (b = 0; b < ARRAY_SIZE(client->handles); b++) {
+		hlist_for_each_entry_rcu(handle, n, &client->handles[b],
+					 buffer_node) {
+			struct ion_buffer *buffer = handle->buffer;
+			struct ion_cache_stats *stats = &buffer->cache_stats;
+
+			if (!stats->ops)
+				continue;
+			seq_printf(s, "%10p %10zu %10lu %10lu %12llu %10llu\n",
+				   buffer, buffer->size, stats->ops,
+				   stats->skipped,
+				   (unsigned long long)stats->bytes,
+				   (unsigned long long)div_u64(stats->time_ns,
+							       NSEC_PER_USEC));
+		}
+	}
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -647,6 +715,7 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 	struct ion_client *entry;
 	char debug_name[64];
 	pid_t pid;
+	int i;
 
 	get_task_struct(current->group_leader);
 	task_lock(current->group_leader);
@@ -678,7 +747,8 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 	}
 
 	client->dev = dev;
-	client->handles = RB_ROOT;
+	for (i = 0; i < ARRAY_SIZE(client->handles); i++)
+		INIT_HLIST_HEAD(&client->handles[i]);
 	mutex_init(&client->lock);
 	client->name = name;
 	client->heap_mask = heap_mask;
@@ -729,13 +799,16 @@ static void _ion_client_destroy(struct kref *kref)
 {
 	struct ion_client *client = container_of(kref, struct ion_client, ref);
 	struct ion_device *dev = client->dev;
-	struct rb_node *n;
+	int i;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
-	while ((n = rb_first(&client->handles))) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
-		ion_handle_destroy(&handle->ref);
+	for (i = 0; i < ARRAY_SIZE(client->handles); i++) {
+		while (!hlist_empty(&client->handles[i])) {
+			struct ion_handle *handle = hlist_entry(
+						client->handles[i].first,
+						struct ion_handle, buffer_node);
+			ion_handle_destroy(&handle->ref);
+		}
 	}
 	mutex_lock(&dev->lock);
 	if (client->task) {
@@ -786,6 +859,7 @@ static void ion_vma_open(struct vm_area_struct *vma)
 	struct ion_client *client;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
+	atomic_inc(&buffer->umap_cnt);
 	/* check that the client still exists and take a reference so
 	   it can't go away until this vma is closed */
 	client = ion_client_lookup(buffer->dev, current->group_leader);
@@ -807,6 +881,7 @@ static void ion_vma_close(struct vm_area_struct *vma)
 	struct ion_client *client;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
+	atomic_dec(&buffer->umap_cnt);
 	/* this indicates the client is gone, nothing to do here */
 	if (!handle)
 		return;
@@ -830,6 +905,12 @@ static struct vm_operations_struct ion_vm_ops = {
 	.close = ion_vma_close,
 };
 
+bool ion_vma_maps_buffer(struct vm_area_struct *vma, struct ion_buffer *buffer)
+{
+	return vma->vm_ops == &ion_vm_ops && vma->vm_file &&
+	       vma->vm_file->private_data == buffer;
+}
+
 static int ion_share_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct ion_buffer *buffer = file->private_data;
@@ -882,6 +963,7 @@ static int ion_share_mmap(struct file *file, struct vm_area_struct *vma)
 	}
 
 	vma->vm_ops = &ion_vm_ops;
+	atomic_inc(&buffer->umap_cnt);
 	/* move the handle into the vm_private_data so we can access it from
 	   vma_open/close */
 	vma->vm_private_data = handle;
@@ -914,10 +996,13 @@ static int ion_flush_cached(struct ion_handle *handle, size_t size,
 		return -EINVAL;
 	}
 
+	/* mmap_sem nests outside buffer->lock, as in ion_share_mmap */
+	down_read(&current->mm->mmap_sem);
 	mutex_lock(&buffer->lock);
 	/* now flush buffer mapped to userspace */
 	ret = buffer->heap->ops->flush_user(buffer, size, vaddr);
 	mutex_unlock(&buffer->lock);
+	up_read(&current->mm->mmap_sem);
 	if (ret) {
 		pr_err("%s: failure flushing buffer\n",
 		       __func__);
@@ -940,10 +1025,13 @@ static int ion_inval_cached(struct ion_handle *handle, size_t size,
 		return -EINVAL;
 	}
 
+	/* mmap_sem nests outside buffer->lock, as in ion_share_mmap */
+	down_read(&current->mm->mmap_sem);
 	mutex_lock(&buffer->lock);
 	/* now flush buffer mapped to userspace */
 	ret = buffer->heap->ops->inval_user(buffer, size, vaddr);
 	mutex_unlock(&buffer->lock);
+	up_read(&current->mm->mmap_sem);
 	if (ret) {
 		pr_err("%s: failure invalidating buffer\n",
 		       __func__);
@@ -1020,9 +1108,7 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (copy_from_user(&data, (void __user *)arg,
 				   sizeof(struct ion_handle_data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
 		valid = ion_handle_validate(client, data.handle);
-		mutex_unlock(&client->lock);
 		if (!valid)
 			return -EINVAL;
 		ion_free(client, data.handle);
@@ -1035,18 +1121,16 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_validate_get(client, data.handle)) {
 			pr_err("%s: invalid handle passed to share ioctl.\n",
 			       __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		if (cmd == ION_IOC_MAP)
 			data.handle->buffer->map_cacheable = data.cacheable;
 		data.fd = ion_ioctl_share(filp, client, data.handle);
-		mutex_unlock(&client->lock);
+		ion_handle_put(data.handle);
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
 			return -EFAULT;
 		break;
@@ -1085,16 +1169,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		mutex_lock(&client->lock);
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_validate_get(client, data.handle)) {
 			pr_err("%s: invalid handle passed to share ioctl.\n",
 			       __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 		data.handle->buffer->map_cacheable = data.map_cacheable;
 		data.fd = ion_ioctl_share(filp, client, data.handle);
-		mutex_unlock(&client->lock);
+		ion_handle_put(data.handle);
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
 			return -EFAULT;
 		break;
@@ -1123,14 +1205,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_validate_get(client, data.handle)) {
 			pr_err("%s: invalid handle passed to cache flush "
 				"ioctl.\n", __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		ret = ion_flush_cached(data.handle, data.size, data.vaddr);
+		ion_handle_put(data.handle);
 		if (ret)
 			return ret;
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
@@ -1145,14 +1227,14 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
 			return -EFAULT;
-		if (!ion_handle_validate(client, data.handle)) {
+		if (!ion_handle_validate_get(client, data.handle)) {
 			pr_err("%s: invalid handle passed to cache inval"
 				" ioctl.\n", __func__);
-			mutex_unlock(&client->lock);
 			return -EINVAL;
 		}
 
 		ret = ion_inval_cached(data.handle, data.size, data.vaddr);
+		ion_handle_put(data.handle);
 		if (ret)
 			return ret;
 		if (copy_to_user((void __user *)arg, &data, sizeof(data)))
@@ -1201,17 +1283,17 @@ static size_t ion_debug_heap_total(struct ion_client *client,
 				   unsigned int id)
 {
 	size_t size = 0;
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
+	int i;
 
-	mutex_lock(&client->lock);
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n,
-						     struct ion_handle,
-						     node);
-		if (handle->buffer->heap->id == id)
-			size += handle->buffer->size;
-	}
-	mutex_unlock(&client->lock);
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(client->handles); i++)
+		hlist_for_each_entry_rcu(handle, n, &client->handles[i],
+					 buffer_node)
+			if (handle->buffer->heap->id == id)
+				size += handle->buffer->size;
+	rcu_read_unlock();
 	return size;
 }
 
@@ -1266,6 +1348,10 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 	struct ion_heap *entry;
 
 	heap->dev = dev;
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE &&
+	    ion_heap_init_deferred_free(heap))
+		heap->flags &= ~ION_HEAP_FLAG_DEFER_FREE;
+
 	mutex_lock(&dev->lock);
 	while (*p) {
 		parent = *p;
@@ -1296,7 +1382,7 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 				      unsigned long arg))
 {
 	struct ion_device *idev;
-	int ret;
+	int ret, i;
 
 	idev = kzalloc(sizeof(struct ion_device), GFP_KERNEL);
 	if (!idev)
@@ -1322,6 +1408,9 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 	idev->heaps = RB_ROOT;
 	idev->user_clients = RB_ROOT;
 	idev->kernel_clients = RB_ROOT;
+	for (i = 0; i < ARRAY_SIZE(idev->handles); i++)
+		INIT_HLIST_HEAD(&idev->handles[i]);
+	spin_lock_init(&idev->handle_lock);
 	return idev;
 }
 
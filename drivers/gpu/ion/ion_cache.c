@@ -0,0 +1,242 @@
+/*
+ * drivers/gpu/ion/ion_cache.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/ion.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <asm/cacheflush.h>
+#include <asm/outercache.h>
+#include <asm/tlbflush.h>
+#include "ion_priv.h"
+
+/*
+ * Cache maintenance for buffers mapped cacheable into userspace.
+ *
+ * Everything is done by range: the inner caches by virtual address through
+ * the caller's own mapping, which the hardware broadcasts to the other cores
+ * without an IPI, and the outer cache by physical address.  Nothing else in
+ * either cache is disturbed.
+ *
+ * Cleans also only touch the pages the CPU has actually written.  On ARM
+ * the software dirty bit of a user pte is what makes the hardware pte
+ * writable, so a clean pte faults on the first write and gets marked dirty
+ * again.  A sync therefore looks at the dirty bits of the range, cleans them
+ * (and the TLB) before doing any maintenance, and then maintains just the
+ * runs of dirty pages; a buffer the CPU has not written since the last sync
+ * costs a page table walk and nothing more.  A flush does the same for its
+ * clean half, and invalidates the pages that were not written.
+ *
+ * That only holds if the caller's mapping is the only way the CPU can have
+ * written the buffer, so with other user or kernel mappings around we
+ * maintain the whole requested range.  Invalidates are never skipped: the CPU may have
+ * speculatively filled lines without ever touching the page.
+ */
+
+/* maintains the outer cache for 'len' bytes at 'offset' into buffer */
+static void ion_cache_outer(struct ion_buffer *buffer, unsigned long offset,
+			    size_t len, enum cache_operation cacheop,
+			    ion_cache_phys_fn outer_phys)
+{
+	unsigned long off = offset;
+
+	while (off < offset + len) {
+		size_t contig;
+		ion_phys_addr_t paddr = outer_phys(buffer, off, &contig);
+		size_t seg = min_t(size_t, contig, offset + len - off);
+
+		/* merge physically contiguous segments into one operation */
+		while (off + seg < offset + len) {
+			size_t next_contig;
+			ion_phys_addr_t next = outer_phys(buffer, off + seg,
+							  &next_contig);
+
+			if (next != paddr + seg)
+				break;
+			seg += min_t(size_t, next_contig,
+				     offset + len - off - seg);
+		}
+
+		if (cacheop == CACHE_INVALIDATE)
+			outer_inv_range(paddr, paddr + seg);
+		else if (cacheop == CACHE_CLEAN)
+			outer_clean_range(paddr, paddr + seg);
+		else
+			outer_flush_range(paddr, paddr + seg);
+		off += seg;
+	}
+}
+
+/* maintains [vaddr, vaddr + len) of the mapping at 'offset' into buffer */
+static void ion_cache_maintain(struct ion_buffer *buffer, unsigned long vaddr,
+			       unsigned long offset, size_t len,
+			       enum cache_operation cacheop,
+			       ion_cache_phys_fn outer_phys)
+{
+	const void *start = (const void *)vaddr;
+
+	if (cacheop == CACHE_INVALIDATE)
+		dmac_unmap_area(start, len, DMA_FROM_DEVICE);
+	else if (cacheop == CACHE_CLEAN)
+		dmac_map_area(start, len, DMA_TO_DEVICE);
+	else
+		dmac_flush_range(start, start + len);
+
+	ion_cache_outer(buffer, offset, len, cacheop, outer_phys);
+
+	if (cacheop == CACHE_INVALIDATE)
+		/* drop anything speculatively fetched while the outer ran */
+		dmac_unmap_area(start, len, DMA_FROM_DEVICE);
+}
+
+/*
+ * Returns whether the page at addr was written through the mapping since
+ * the last call, and clears the mark.  The caller flushes the TLB.
+ */
+static bool ion_cache_test_and_clean(struct vm_area_struct *vma,
+				     unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *ptep, pte;
+	bool dirty = false;
+
+	pgd = pgd_offset(mm, addr);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return false;
+	pud = pud_offset(pgd, addr);
+	if (pud_none(*pud) || pud_bad(*pud))
+		return false;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return false;
+
+	ptep = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	pte = *ptep;
+	if (pte_present(pte) && pte_dirty(pte)) {
+		set_pte_at(mm, addr, ptep, pte_mkclean(pte));
+		dirty = true;
+	}
+	pte_unmap_unlock(ptep, ptl);
+
+	return dirty;
+}
+
+/* TLB and cache maintenance of the dirty run [start, end) */
+static size_t ion_cache_run(struct ion_buffer *buffer,
+			    struct vm_area_struct *vma, unsigned long vaddr,
+			    unsigned long offset, unsigned long start,
+			    unsigned long end, enum cache_operation cacheop,
+			    ion_cache_phys_fn outer_phys)
+{
+	/* the now clean ptes must be visible before we write back */
+	flush_tlb_range(vma, start, end);
+	ion_cache_maintain(buffer, start, offset + (start - vaddr),
+			   end - start, cacheop, outer_phys);
+	return end - start;
+}
+
+int ion_buffer_cache_op(struct ion_buffer *buffer, unsigned long vaddr,
+			size_t len, enum cache_operation cacheop,
+			ion_cache_phys_fn outer_phys)
+{
+	struct vm_area_struct *vma;
+	unsigned long offset = 0;
+	unsigned long addr, end, run_start;
+	bool mapped = false, track = false, dirty, run_dirty;
+	ktime_t start;
+	size_t done = 0;
+
+	if (!len)
+		return 0;
+
+	vma = find_vma(current->mm, vaddr);
+	if (vma && ion_vma_maps_buffer(vma, buffer) &&
+	    vaddr >= vma->vm_start && vaddr + len <= vma->vm_end) {
+		offset = vaddr - vma->vm_start +
+			 (vma->vm_pgoff << PAGE_SHIFT);
+		mapped = true;
+		track = cacheop != CACHE_INVALIDATE && !buffer->kmap_cnt &&
+			atomic_read(&buffer->umap_cnt) == 1;
+	}
+
+	if (offset + len > buffer->size) {
+		pr_err("%s(): range to maintain exceeds the buffer\n",
+		       __func__);
+		return -EINVAL;
+	}
+
+	start = ktime_get();
+	buffer->cache_stats.ops++;
+
+	if (!mapped) {
+		/*
+		 * Not an ion mapping of this buffer, so the range may not be
+		 * mapped at all: use the fault-safe user range operation and
+		 * keep the old assumption that vaddr is the buffer's start.
+		 */
+		flush_cache_user_range(vaddr, vaddr + len);
+		ion_cache_outer(buffer, 0, len, cacheop, outer_phys);
+		done = len;
+		goto out;
+	}
+
+	if (!track) {
+		ion_cache_maintain(buffer, vaddr, offset, len, cacheop,
+				   outer_phys);
+		done = len;
+		goto out;
+	}
+
+	end = PAGE_ALIGN(vaddr + len);
+	offset &= PAGE_MASK;
+	vaddr &= PAGE_MASK;
+	run_start = vaddr;
+	run_dirty = ion_cache_test_and_clean(vma, vaddr);
+	for (addr = vaddr + PAGE_SIZE; addr <= end; addr += PAGE_SIZE) {
+		dirty = addr < end && ion_cache_test_and_clean(vma, addr);
+		if (addr < end && dirty == run_dirty)
+			continue;
+
+		if (run_dirty) {
+			done += ion_cache_run(buffer, vma, vaddr, offset,
+					      run_start, addr, cacheop,
+					      outer_phys);
+		} else if (cacheop == CACHE_FLUSH) {
+			/* nothing to write back, but stale lines must go */
+			ion_cache_maintain(buffer, run_start,
+					   offset + (run_start - vaddr),
+					   addr - run_start, CACHE_INVALIDATE,
+					   outer_phys);
+			done += addr - run_start;
+		}
+		run_start = addr;
+		run_dirty = dirty;
+	}
+
+	if (!done)
+		buffer->cache_stats.skipped++;
+
+out:
+	buffer->cache_stats.bytes += done;
+	buffer->cache_stats.time_ns += ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+	return 0;
+}
@@ -122,9 +122,12 @@ int ion_carveout_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			       : pgprot_writecombine(vma->vm_page_prot)));
 }
 
-static void per_cpu_cache_flush_arm(void *arg)
+static ion_phys_addr_t ion_carveout_heap_outer_phys(struct ion_buffer *buffer,
+						    unsigned long offset,
+						    size_t *contig)
 {
-	flush_cache_all();
+	*contig = buffer->size - offset;
+	return buffer->priv_phys + offset;
 }
 
 int ion_carveout_heap_cache_operation(struct ion_buffer *buffer, size_t len,
@@ -136,20 +139,8 @@ int ion_carveout_heap_cache_operation(struct ion_buffer *buffer, size_t len,
 		return -EINVAL;
 	}
 
-	if (len > FULL_CACHE_FLUSH_THRESHOLD) {
-		on_each_cpu(per_cpu_cache_flush_arm, NULL, 1);
-		outer_flush_all();
-		return 0;
-	}
-
-	flush_cache_user_range(vaddr, (vaddr+len));
-	
-	if (cacheop == CACHE_FLUSH)
-		outer_flush_range(buffer->priv_phys, buffer->priv_phys+len);
-	else
-		outer_inv_range(buffer->priv_phys, buffer->priv_phys+len);
-	
-	return 0;
+	return ion_buffer_cache_op(buffer, vaddr, len, cacheop,
+				   ion_carveout_heap_outer_phys);
 }
 
 int ion_carveout_heap_flush_user(struct ion_buffer *buffer, size_t len,
@@ -15,7 +15,11 @@
  */
 
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
 #include "ion_priv.h"
 
 struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
@@ -55,6 +59,8 @@ void ion_heap_destroy(struct ion_heap *heap)
 	if (!heap)
 		return;
 
+	ion_heap_destroy_deferred_free(heap);
+
 	switch (heap->type) {
 	case ION_HEAP_TYPE_SYSTEM_CONTIG:
 		ion_system_contig_heap_destroy(heap);
@@ -70,3 +76,153 @@ void ion_heap_destroy(struct ion_heap *heap)
 		       heap->type);
 	}
 }
+
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	spin_lock(&heap->free_lock);
+	list_add_tail(&buffer->list, &heap->free_list);
+	heap->free_list_size += buffer->size;
+	spin_unlock(&heap->free_lock);
+	wake_up(&heap->waitqueue);
+}
+
+size_t ion_heap_freelist_size(struct ion_heap *heap)
+{
+	size_t size;
+
+	spin_lock(&heap->free_lock);
+	size = heap->free_list_size;
+	spin_unlock(&heap->free_lock);
+
+	return size;
+}
+
+static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
+				       bool skip_pools)
+{
+	struct ion_buffer *buffer;
+	size_t total_drained = 0;
+
+	spin_lock(&heap->free_lock);
+	if (size == 0)
+		size = heap->free_list_size;
+
+	while (total_drained < size && !list_empty(&heap->free_list)) {
+		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
+					  list);
+		list_del(&buffer->list);
+		heap->free_list_size -= buffer->size;
+		total_drained += buffer->size;
+		spin_unlock(&heap->free_lock);
+
+		if (skip_pools)
+			buffer->private_flags |= ION_PRIV_FLAG_SHRINKER_FREE;
+		ion_buffer_destroy(buffer);
+
+		spin_lock(&heap->free_lock);
+	}
+	spin_unlock(&heap->free_lock);
+
+	return total_drained;
+}
+
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size)
+{
+	return _ion_heap_freelist_drain(heap, size, false);
+}
+
+/*
+ * Once woken the thread frees everything queued until the list is empty,
+ * so a burst of frees costs one wakeup rather than one per buffer.  It
+ * takes the buffers off the list one at a time: the rest stay visible to
+ * ion_heap_freelist_drain() and the shrinker.  Nobody waits for the one in
+ * flight: this thread runs SCHED_IDLE, and an allocator blocking on it
+ * would inherit that priority.
+ */
+static int ion_heap_deferred_free(void *data)
+{
+	struct ion_heap *heap = data;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		struct ion_buffer *buffer;
+
+		wait_event_freezable(heap->waitqueue,
+				     ion_heap_freelist_size(heap) > 0 ||
+				     kthread_should_stop());
+
+		spin_lock(&heap->free_lock);
+		while (!list_empty(&heap->free_list)) {
+			buffer = list_first_entry(&heap->free_list,
+						  struct ion_buffer, list);
+			list_del(&buffer->list);
+			heap->free_list_size -= buffer->size;
+			spin_unlock(&heap->free_lock);
+
+			ion_buffer_destroy(buffer);
+
+			spin_lock(&heap->free_lock);
+		}
+		spin_unlock(&heap->free_lock);
+	}
+
+	return 0;
+}
+
+static int ion_heap_shrink(struct shrinker *shrinker,
+			   struct shrink_control *sc)
+{
+	struct ion_heap *heap = container_of(shrinker, struct ion_heap,
+					     shrinker);
+
+	/*
+	 * Memory handed back from here goes straight to the system rather
+	 * than into any page pool the heap keeps, or it would not relieve
+	 * the pressure that got us called.
+	 */
+	if (sc->nr_to_scan)
+		_ion_heap_freelist_drain(heap, sc->nr_to_scan * PAGE_SIZE,
+					 true);
+
+	return ion_heap_freelist_size(heap) / PAGE_SIZE;
+}
+
+int ion_heap_init_deferred_free(struct ion_heap *heap)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	int ret;
+
+	INIT_LIST_HEAD(&heap->free_list);
+	heap->free_list_size = 0;
+	spin_lock_init(&heap->free_lock);
+	init_waitqueue_head(&heap->waitqueue);
+	heap->task = kthread_run(ion_heap_deferred_free, heap,
+				 "ion_%s", heap->name);
+	if (IS_ERR(heap->task)) {
+		pr_err("%s: creating thread for deferred free failed\n",
+		       __func__);
+		ret = PTR_ERR(heap->task);
+		heap->task = NULL;
+		return ret;
+	}
+	/* freeing is never urgent; stay out of the way of rendering */
+	sched_setscheduler(heap->task, SCHED_IDLE, &param);
+
+	heap->shrinker.shrink = ion_heap_shrink;
+	heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&heap->shrinker);
+
+	return 0;
+}
+
+void ion_heap_destroy_deferred_free(struct ion_heap *heap)
+{
+	if (!heap->task)
+		return;
+
+	unregister_shrinker(&heap->shrinker);
+	kthread_stop(heap->task);
+	heap->task = NULL;
+	ion_heap_freelist_drain(heap, 0);
+}
@@ -0,0 +1,181 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/err.h>
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(page + i);
+}
+
+/* items of order > 0 are split, so their pages go back one by one */
+static void ion_page_pool_free_pages(struct ion_page_pool *pool,
+				     struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		__free_page(page + i);
+}
+
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+
+	spin_lock(&pool->lock);
+	while (!list_empty(&pool->dirty_items)) {
+		page = list_first_entry(&pool->dirty_items, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		ion_page_pool_zero(pool, page);
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->clean_items);
+		pool->clean_count++;
+	}
+	spin_unlock(&pool->lock);
+}
+
+/* takes one item off 'list', which the caller owns the lock for */
+static struct page *ion_page_pool_remove(struct list_head *list, int *count)
+{
+	struct page *page;
+
+	if (list_empty(list))
+		return NULL;
+
+	page = list_first_entry(list, struct page, lru);
+	list_del(&page->lru);
+	(*count)--;
+	return page;
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page;
+	bool dirty = false;
+
+	spin_lock(&pool->lock);
+	page = ion_page_pool_remove(&pool->clean_items, &pool->clean_count);
+	if (!page) {
+		page = ion_page_pool_remove(&pool->dirty_items,
+					    &pool->dirty_count);
+		dirty = page != NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	/* the background worker has not got to this one yet */
+	if (dirty)
+		ion_page_pool_zero(pool, page);
+
+	if (!page) {
+		page = alloc_pages(pool->gfp_mask | __GFP_ZERO, pool->order);
+		if (page && pool->order)
+			split_page(page, pool->order);
+	}
+
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	schedule_work(&pool->zero_work);
+}
+
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0;
+
+	if (!nr_to_scan) {
+		spin_lock(&pool->lock);
+		freed = (pool->clean_count + pool->dirty_count) << pool->order;
+		spin_unlock(&pool->lock);
+		return freed;
+	}
+
+	while (freed < nr_to_scan) {
+		/* give up dirty items first, they cost the most to reuse */
+		spin_lock(&pool->lock);
+		page = ion_page_pool_remove(&pool->dirty_items,
+					    &pool->dirty_count);
+		if (!page)
+			page = ion_page_pool_remove(&pool->clean_items,
+						    &pool->clean_count);
+		spin_unlock(&pool->lock);
+
+		if (!page)
+			break;
+
+		ion_page_pool_free_pages(pool, page);
+		freed += (1 << pool->order);
+	}
+
+	return freed;
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool;
+
+	pool = kzalloc(sizeof(struct ion_page_pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->clean_items);
+	INIT_LIST_HEAD(&pool->dirty_items);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	cancel_work_sync(&pool->zero_work);
+
+	while ((page = ion_page_pool_remove(&pool->dirty_items,
+					    &pool->dirty_count)))
+		ion_page_pool_free_pages(pool, page);
+	while ((page = ion_page_pool_remove(&pool->clean_items,
+					    &pool->clean_count)))
+		ion_page_pool_free_pages(pool, page);
+
+	kfree(pool);
+}
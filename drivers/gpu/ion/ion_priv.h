@@ -18,11 +18,16 @@
 #define _ION_PRIV_H
 
 #include <linux/kref.h>
+#include <linux/list.h>
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
 #include <linux/ion.h>
 #include <linux/miscdevice.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 struct ion_mapping;
 
@@ -36,6 +41,11 @@ struct ion_kernel_mapping {
 	void *vaddr;
 };
 
+/* buckets in the device wide table of handles, keyed by handle */
+#define ION_HANDLE_HASH_BITS	10
+/* buckets in each client's table of handles, keyed by buffer */
+#define ION_CLIENT_HASH_BITS	6
+
 /**
  * struct ion_device - the metadata of the ion device node
  * @dev:		the actual misc device
@@ -43,6 +53,9 @@ struct ion_kernel_mapping {
  * @lock:		lock protecting the buffers & heaps trees
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
+ * @handles:		every handle of every client, hashed by address, so
+ *			handles passed in from outside can be validated
+ * @handle_lock:	serializes updates of @handles; lookups use rcu
  */
 struct ion_device {
 	struct miscdevice dev;
@@ -54,6 +67,8 @@ struct ion_device {
 	struct rb_root user_clients;
 	struct rb_root kernel_clients;
 	struct dentry *debug_root;
+	struct hlist_head handles[1 << ION_HANDLE_HASH_BITS];
+	spinlock_t handle_lock;
 };
 
 /**
@@ -61,21 +76,22 @@ struct ion_device {
  * @ref:		for reference counting the client
  * @node:		node in the tree of all clients
  * @dev:		backpointer to ion device
- * @handles:		an rb tree of all the handles in this client
- * @lock:		lock protecting the tree of handles
+ * @handles:		all the handles in this client, hashed by buffer
+ * @lock:		lock protecting updates of the handles table
  * @heap_mask:		mask of all supported heaps
  * @name:		used for debugging
  * @task:		used for debugging
  *
  * A client represents a list of buffers this client may access.
- * The mutex stored here is used to protect both handles tree
+ * The mutex stored here is used to protect both handles table
  * as well as the handles themselves, and should be held while modifying either.
+ * The table may be walked under rcu_read_lock() alone.
  */
 struct ion_client {
 	struct kref ref;
 	struct rb_node node;
 	struct ion_device *dev;
-	struct rb_root handles;
+	struct hlist_head handles[1 << ION_CLIENT_HASH_BITS];
 	struct mutex lock;
 	unsigned int heap_mask;
 	const char *name;
@@ -89,7 +105,9 @@ struct ion_client {
  * @ref:		reference count
  * @client:		back pointer to the client the buffer resides in
  * @buffer:		pointer to the buffer
- * @node:		node in the client's handle rbtree
+ * @node:		node in the device's table of handles
+ * @buffer_node:	node in the client's table of handles
+ * @rcu:		handles are freed after a grace period
  * @kmap_cnt:		count of times this client has mapped to kernel
  * @dmap_cnt:		count of times this client has mapped for dma
  * @usermap_cnt:	count of times this client has mapped for userspace
@@ -101,7 +119,9 @@ struct ion_handle {
 	struct kref ref;
 	struct ion_client *client;
 	struct ion_buffer *buffer;
-	struct rb_node node;
+	struct hlist_node node;
+	struct hlist_node buffer_node;
+	struct rcu_head rcu;
 	unsigned int kmap_cnt;
 	unsigned int dmap_cnt;
 	unsigned int usermap_cnt;
@@ -109,6 +129,22 @@ struct ion_handle {
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 
+/**
+ * struct ion_cache_stats - cache maintenance accounting of a buffer
+ * @ops:		number of flush/invalidate requests
+ * @skipped:		requests that needed no maintenance at all
+ * @bytes:		bytes actually cleaned or invalidated
+ * @time_ns:		time spent servicing the requests
+ *
+ * Protected by the buffer's lock, like the map counts.
+ */
+struct ion_cache_stats {
+	unsigned long ops;
+	unsigned long skipped;
+	u64 bytes;
+	u64 time_ns;
+};
+
 /**
  * struct ion_buffer - metadata for a particular buffer
  * @ref:		refernce count
@@ -126,10 +162,17 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sglist:		the scatterlist for the buffer is dmap_cnt is not zero
+ * @list:		element in the heap's deferred free list
+ * @private_flags:	internal buffer specific flags (ION_PRIV_FLAG_*)
+ * @umap_cnt:		number of userspace vmas mapping the buffer
+ * @cache_stats:	cache maintenance done on the buffer
+ * @rcu:		buffers are freed after a grace period, so rcu walkers
+ *			of the handle tables may look at them
 */
 struct ion_buffer {
 	struct kref ref;
 	struct rb_node node;
+	struct list_head list;
 	struct ion_device *dev;
 	struct ion_heap *heap;
 	unsigned long flags;
@@ -144,8 +187,21 @@ struct ion_buffer {
 	int dmap_cnt;
 	struct scatterlist *sglist;
 	bool map_cacheable;
+	unsigned long private_flags;
+	atomic_t umap_cnt;
+	struct ion_cache_stats cache_stats;
+	struct rcu_head rcu;
 };
 
+/**
+ * ion_buffer_destroy - release a buffer's memory back to its heap
+ * @buffer:		the buffer, already unlinked from its device
+ *
+ * Called directly for heaps that free synchronously and from the deferred
+ * free thread or the freelist shrinker otherwise.
+ */
+void ion_buffer_destroy(struct ion_buffer *buffer);
+
 /**
  * struct ion_heap_ops - ops to operate on a given heap
  * @allocate:		allocate memory
@@ -191,6 +247,13 @@ struct ion_heap_ops {
  *			MUST be unique
  * @name:		used for debugging
  * @priv:		private heap data
+ * @flags:		flags describing the heap (ION_HEAP_FLAG_*)
+ * @free_list:		buffers waiting to be freed, if ION_HEAP_FLAG_DEFER_FREE
+ * @free_list_size:	total size in bytes of the buffers on @free_list
+ * @free_lock:		protects @free_list and @free_list_size
+ * @waitqueue:		@task sleeps here until @free_list is non-empty
+ * @task:		deferred free thread
+ * @shrinker:		drains @free_list under memory pressure
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -205,8 +268,72 @@ struct ion_heap {
 	int id;
 	const char *name;
 	void *priv;
+	unsigned long flags;
+	struct list_head free_list;
+	size_t free_list_size;
+	spinlock_t free_lock;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
+	struct shrinker shrinker;
 };
 
+/*
+ * Heaps with ION_HEAP_FLAG_DEFER_FREE set hand the last reference to a
+ * buffer to a per-heap thread instead of freeing it in the caller, so the
+ * page freeing lands off whichever (often latency critical) thread dropped
+ * the buffer.
+ */
+#define ION_HEAP_FLAG_DEFER_FREE	(1 << 0)
+
+/*
+ * Set on a buffer freed on behalf of the freelist shrinker: the heap should
+ * give its memory straight back to the system rather than pooling it.
+ */
+#define ION_PRIV_FLAG_SHRINKER_FREE	(1 << 0)
+
+/**
+ * ion_heap_init_deferred_free - start the deferred free thread of a heap
+ * @heap:		the heap, with ION_HEAP_FLAG_DEFER_FREE set
+ *
+ * Called by ion_device_add_heap(). Also registers a shrinker that drains
+ * the pending buffers before the system runs out of memory.
+ */
+int ion_heap_init_deferred_free(struct ion_heap *heap);
+
+/**
+ * ion_heap_destroy_deferred_free - stop the deferred free thread of a heap
+ * @heap:		the heap
+ *
+ * Unregisters the shrinker, stops the thread and frees whatever is still
+ * queued.  Called by ion_heap_destroy(); a no-op if the thread was never
+ * started.
+ */
+void ion_heap_destroy_deferred_free(struct ion_heap *heap);
+
+/**
+ * ion_heap_freelist_add - queue a buffer for deferred freeing
+ * @heap:		the heap
+ * @buffer:		the buffer, already unlinked from its device
+ */
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+
+/**
+ * ion_heap_freelist_drain - synchronously free buffers queued on a heap
+ * @heap:		the heap
+ * @size:		amount of memory to free in bytes, 0 to drain everything
+ *
+ * returns the number of bytes freed, which may exceed @size since whole
+ * buffers are freed.  The buffer the deferred free thread may be freeing
+ * at the time is not waited for.
+ */
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size);
+
+/**
+ * ion_heap_freelist_size - bytes waiting on a heap's deferred free list
+ * @heap:		the heap
+ */
+size_t ion_heap_freelist_size(struct ion_heap *heap);
+
 /**
  * ion_device_create - allocates and returns an ion device
  * @custom_ioctl:	arch specific ioctl function if applicable
@@ -263,11 +390,48 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
 /**
- * Flushing entire cache is more efficient than flushing virtual address
- * range of a buffer whose size is 200Kbytes or higher, since line by
- * line operations of huge buffers consume lot of cpu cycles
+ * struct ion_page_pool - pagepool struct
+ * @clean_count:	number of zeroed items ready to be handed out
+ * @dirty_count:	number of returned items still waiting to be zeroed
+ * @lock:		protects both item lists and their counts
+ * @clean_items:	list of zeroed items, linked through page->lru
+ * @dirty_items:	list of items waiting for @zero_work
+ * @zero_work:		zeroes @dirty_items in the background
+ * @gfp_mask:		gfp_mask to use when allocating fresh items
+ * @order:		order of pages in the pool
+ *
+ * Allows you to keep a pool of pre-zeroed pages around for quick
+ * allocation. Pages returned to the pool are zeroed off the allocation
+ * path by @zero_work, so ion_page_pool_alloc() normally just unlinks a
+ * clean item. Items are always handed out zeroed.  Items of order > 0 are
+ * split_page()d, so each of their pages carries its own reference count and
+ * can be mapped with vm_insert_page(); they must be freed page by page.
  */
-#define FULL_CACHE_FLUSH_THRESHOLD 200000
+struct ion_page_pool {
+	int clean_count;
+	int dirty_count;
+	spinlock_t lock;
+	struct list_head clean_items;
+	struct list_head dirty_items;
+	struct work_struct zero_work;
+	gfp_t gfp_mask;
+	unsigned int order;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+
+/**
+ * ion_page_pool_shrink - shrinks the size of the memory cached in the pool
+ * @pool:		the pool
+ * @nr_to_scan:		number of order-0 pages to free, or 0 to only count
+ *
+ * returns the number of order-0 pages freed, or the number of order-0
+ * pages cached in the pool if @nr_to_scan is 0
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
 
 enum cache_operation {
 	CACHE_CLEAN		= 0x0,
@@ -275,4 +439,36 @@ enum cache_operation {
 	CACHE_FLUSH		= 0x2,
 };
 
+/**
+ * ion_cache_phys_fn - translates an offset into a buffer into the physical
+ * address its outer cache lines are tagged with, and stores in @contig how
+ * many bytes from there are physically contiguous
+ */
+typedef ion_phys_addr_t (*ion_cache_phys_fn)(struct ion_buffer *buffer,
+					     unsigned long offset,
+					     size_t *contig);
+
+/**
+ * ion_buffer_cache_op - range based cache maintenance of a user mapping
+ * @buffer:		the buffer, with its lock held
+ * @vaddr:		start of the range in the caller's mapping of @buffer
+ * @len:		length of the range in bytes
+ * @cacheop:		the maintenance to perform
+ * @outer_phys:		the heap's offset to physical address translation
+ *
+ * Maintains just the requested range, without IPIs or whole cache
+ * operations, and for cleans and flushes only the pages the CPU has written
+ * since the last sync.  The caller must hold current->mm->mmap_sem.
+ */
+int ion_buffer_cache_op(struct ion_buffer *buffer, unsigned long vaddr,
+			size_t len, enum cache_operation cacheop,
+			ion_cache_phys_fn outer_phys);
+
+/**
+ * ion_vma_maps_buffer - whether a vma is an ion userspace mapping of a buffer
+ * @vma:		the vma
+ * @buffer:		the buffer
+ */
+bool ion_vma_maps_buffer(struct vm_area_struct *vma, struct ion_buffer *buffer);
+
 #endif /* _ION_PRIV_H */
@@ -22,33 +22,140 @@
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are built from the largest chunks we can get cheaply: order-8
+ * and order-4 allocations are attempted opportunistically (no reclaim, no
+ * retries) and we fall back to smaller orders as they fail.  Freed chunks
+ * go back to a per-order page pool and are zeroed there in the background.
+ *
+ * buffer->priv_virt holds one struct page pointer per PAGE_SIZE page so the
+ * kernel mapping can use vm_map_ram() directly; the head page of every chunk
+ * records the chunk's order in page_private() so the chunks can be walked
+ * for dma mappings, and returned to the right pool on free.  The pools hand
+ * out split chunks, so userspace gets the pages with vm_insert_page() and
+ * the mapping stays a normal one that get_user_pages() works on.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+static const gfp_t high_order_gfp_flags = (GFP_HIGHUSER | __GFP_NOWARN |
+					    __GFP_NORETRY | __GFP_NO_KSWAPD) &
+					   ~__GFP_WAIT;
+static const gfp_t low_order_gfp_flags = GFP_HIGHUSER | __GFP_NOWARN;
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[NUM_ORDERS];
+	struct shrinker shrinker;
+};
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct page *alloc_largest_available(struct ion_system_heap *heap,
+					    unsigned long size,
+					    unsigned int max_order)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (size < (PAGE_SIZE << orders[i]))
+			continue;
+		if (max_order < orders[i])
+			continue;
+
+		page = ion_page_pool_alloc(heap->pools[i]);
+		if (!page)
+			continue;
+
+		set_page_private(page, orders[i]);
+		return page;
+	}
+
+	return NULL;
+}
+
+/* returns whether someone besides the buffer still holds a page of a chunk */
+static bool chunk_in_use(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		if (page_count(page + i) != 1)
+			return true;
+	return false;
+}
+
+static void free_chunk(struct ion_system_heap *heap, struct ion_buffer *buffer,
+		       struct page *page)
+{
+	unsigned int order = page_private(page);
+	int i;
+
+	set_page_private(page, 0);
+	/*
+	 * the freelist shrinker wants the memory back, not pooled, and pages
+	 * still pinned (by get_user_pages() say) must not be reused: drop our
+	 * references and let the last holder free them
+	 */
+	if ((buffer && (buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE)) ||
+	    chunk_in_use(page, order)) {
+		for (i = 0; i < (1 << order); i++)
+			__free_page(page + i);
+	} else {
+		ion_page_pool_free(heap->pools[order_to_index(order)], page);
+	}
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    unsigned long size, unsigned long align,
 				    unsigned long flags)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
 	int n_pages = PAGE_ALIGN(size) / PAGE_SIZE;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
 	struct page **page_list;
-	const int gfp_mask = GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO;
-	int i = 0;
+	struct page *page;
+	int i = 0, j;
 
 	page_list = kmalloc(n_pages * sizeof(void *), GFP_KERNEL);
+	if (!page_list)
+		return -ENOMEM;
 
-	for (i = 0; i < n_pages; i++) {
-		page_list[i] = alloc_page(gfp_mask);
-		if (page_list[i] == NULL)
+	while (size_remaining > 0) {
+		page = alloc_largest_available(sys_heap, size_remaining,
+					       max_order);
+		if (!page)
 			goto out;
+
+		/* don't retry orders that have already failed us */
+		max_order = page_private(page);
+		for (j = 0; j < (1 << max_order); j++)
+			page_list[i++] = page + j;
+		size_remaining -= PAGE_SIZE << max_order;
 	}
 
 	buffer->priv_virt = page_list;
 	return 0;
 
 out:
-	/* failed on i, so go to i-1 */
-	i--;
-
-	for (; i >= 0; i--)
-		__free_page(page_list[i]);
+	for (j = 0; j < i; j += 1 << max_order) {
+		max_order = page_private(page_list[j]);
+		free_chunk(sys_heap, NULL, page_list[j]);
+	}
 
 	kfree(page_list);
 	return -ENOMEM;
@@ -56,30 +163,68 @@ out:
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
 	int i;
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 	struct page **page_list = (struct page **)buffer->priv_virt;
+	unsigned int order;
 
-	for (i = 0; i < n_pages; i++)
-		__free_page(page_list[i]);
+	for (i = 0; i < n_pages; i += 1 << order) {
+		order = page_private(page_list[i]);
+		free_chunk(sys_heap, buffer, page_list[i]);
+	}
 	kfree(page_list);
 }
 
+/*
+ * Walks the chunks of a buffer, merging physically adjacent ones, and
+ * either counts the resulting scatterlist entries (sglist == NULL) or
+ * fills them in.
+ */
+static int ion_system_heap_fill_sg(struct ion_buffer *buffer,
+				   struct scatterlist *sglist)
+{
+	struct page **page_list = (struct page **)buffer->priv_virt;
+	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	struct scatterlist *sg = NULL;
+	unsigned long next_pfn = 0;
+	unsigned long len;
+	int nents = 0;
+	int i;
+
+	for (i = 0; i < n_pages; i += len >> PAGE_SHIFT) {
+		struct page *page = page_list[i];
+
+		len = PAGE_SIZE << page_private(page);
+		if (nents && page_to_pfn(page) == next_pfn) {
+			if (sg)
+				sg->length += len;
+		} else {
+			sg = sglist ? (nents ? sg_next(sg) : sglist) : NULL;
+			if (sg)
+				sg_set_page(sg, page, len, 0);
+			nents++;
+		}
+		next_pfn = page_to_pfn(page) + (len >> PAGE_SHIFT);
+	}
+
+	return nents;
+}
+
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
 	struct scatterlist *sglist;
-	struct page **page_list = (struct page **)buffer->priv_virt;
-	int i;
-	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	int nents = ion_system_heap_fill_sg(buffer, NULL);
 
-	sglist = vmalloc(n_pages * sizeof(struct scatterlist));
+	sglist = vmalloc(nents * sizeof(struct scatterlist));
 	if (!sglist)
 		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, n_pages * sizeof(struct scatterlist));
-	sg_init_table(sglist, n_pages);
-	for (i = 0; i < n_pages; i++)
-		sg_set_page(&sglist[i], page_list[i], PAGE_SIZE, 0);
+	memset(sglist, 0, nents * sizeof(struct scatterlist));
+	sg_init_table(sglist, nents);
+	ion_system_heap_fill_sg(buffer, sglist);
 	/* XXX do cache maintenance for dma? */
 	return sglist;
 }
@@ -111,30 +256,43 @@ void ion_system_heap_unmap_kernel(struct ion_heap *heap,
 int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			     struct vm_area_struct *vma)
 {
-	unsigned long uaddr = vma->vm_start;
-	unsigned long usize = vma->vm_end - vma->vm_start;
+	unsigned long uaddr;
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 	struct page **page_list = (struct page **)buffer->priv_virt;
-	int i;
+	unsigned long i = vma->vm_pgoff;
+	int ret;
 
-	if (usize /* + pgoff << PAGE_SHIFT */  > (n_pages << PAGE_SHIFT))
+	if (vma->vm_pgoff + vma_pages(vma) > n_pages)
 		return -EINVAL;
 
-	i = 0;
-	do {
-		int ret;
-
-		ret = vm_insert_page(vma, uaddr, page_list[i]);
+	for (uaddr = vma->vm_start; uaddr < vma->vm_end; uaddr += PAGE_SIZE) {
+		ret = vm_insert_page(vma, uaddr, page_list[i++]);
 		if (ret)
 			return ret;
+	}
+
+	return 0;
+}
 
-		uaddr += PAGE_SIZE;
-		usize -= PAGE_SIZE;
-	} while (usize > 0);
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap = container_of(shrinker,
+							struct ion_system_heap,
+							shrinker);
+	int nr_to_scan = sc->nr_to_scan;
+	int nr_total = 0;
+	int i;
 
-	vma->vm_flags |= VM_RESERVED;
+	/* shrink the biggest chunks first, they are the cheapest to refill */
+	for (i = 0; i < NUM_ORDERS && nr_to_scan > 0; i++)
+		nr_to_scan -= ion_page_pool_shrink(sys_heap->pools[i],
+						   nr_to_scan);
 
-	return 0;
+	for (i = 0; i < NUM_ORDERS; i++)
+		nr_total += ion_page_pool_shrink(sys_heap->pools[i], 0);
+
+	return nr_total;
 }
 
 static struct ion_heap_ops vmalloc_ops = {
@@ -149,19 +307,50 @@ static struct ion_heap_ops vmalloc_ops = {
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
+	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	heap->heap.ops = &vmalloc_ops;
+	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_t gfp_flags = low_order_gfp_flags;
+
+		if (orders[i] > 0)
+			gfp_flags = high_order_gfp_flags;
+		heap->pools[i] = ion_page_pool_create(gfp_flags, orders[i]);
+		if (!heap->pools[i])
+			goto err_create_pool;
+	}
+
+	heap->shrinker.shrink = ion_system_heap_shrink;
+	heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&heap->shrinker);
+
+	return &heap->heap;
+
+err_create_pool:
+	while (--i >= 0)
+		ion_page_pool_destroy(heap->pools[i]);
+	kfree(heap);
+	return ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
+	unregister_shrinker(&sys_heap->shrinker);
+	for (i = 0; i < NUM_ORDERS; i++)
+		ion_page_pool_destroy(sys_heap->pools[i]);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -213,14 +402,25 @@ int ion_system_contig_heap_map_user(struct ion_heap *heap,
 
 }
 
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+					struct ion_buffer *buffer)
+{
+	return buffer->priv_virt;
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+					 struct ion_buffer *buffer)
+{
+}
+
 static struct ion_heap_ops kmalloc_ops = {
 	.allocate = ion_system_contig_heap_allocate,
 	.free = ion_system_contig_heap_free,
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
 	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
 };
 
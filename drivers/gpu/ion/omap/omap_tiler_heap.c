@@ -855,9 +855,16 @@ int omap_tiler_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	return ret;
 }
 
-static void per_cpu_cache_flush_arm(void *arg)
+/* 1D buffers are mapped page by page from tiler_addrs, see map_user */
+static ion_phys_addr_t omap_tiler_outer_phys(struct ion_buffer *buffer,
+					     unsigned long offset,
+					     size_t *contig)
 {
-	   flush_cache_all();
+	struct omap_tiler_info *info = buffer->priv_virt;
+
+	*contig = PAGE_SIZE - (offset & ~PAGE_MASK);
+	return info->tiler_addrs[offset >> PAGE_SHIFT] +
+	       (offset & ~PAGE_MASK);
 }
 
 int omap_tiler_cache_operation(struct ion_buffer *buffer, size_t len,
@@ -894,21 +901,8 @@ int omap_tiler_cache_operation(struct ion_buffer *buffer, size_t len,
 		return -EINVAL;
 	}
 
-	if (len > FULL_CACHE_FLUSH_THRESHOLD) {
-		on_each_cpu(per_cpu_cache_flush_arm, NULL, 1);
-		outer_flush_all();
-		return 0;
-	}
-
-	flush_cache_user_range(vaddr, vaddr + len);
-
-	if (cacheop == CACHE_FLUSH)
-		outer_flush_range(info->tiler_addrs[0],
-			info->tiler_addrs[0] + len);
-	else
-		outer_inv_range(info->tiler_addrs[0],
-			info->tiler_addrs[0] + len);
-	return 0;
+	return ion_buffer_cache_op(buffer, vaddr, len, cacheop,
+				   omap_tiler_outer_phys);
 }
 
 int omap_tiler_heap_flush_user(struct ion_buffer *buffer, size_t len,
@@ -158,6 +158,7 @@ typedef IMG_INT (*BridgeWrapperFunction)(IMG_UINT32 ui32BridgeID,
 typedef struct _PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY
 {
 	BridgeWrapperFunction pfFunction; 
+	IMG_BOOL bShared; 
 #if defined(DEBUG_BRIDGE_KM)
 	const IMG_CHAR *pszIOCName; 
 	const IMG_CHAR *pszFunctionName; 
@@ -198,6 +199,28 @@ _SetDispatchTableEntry(IMG_UINT32 ui32Index,
 #define SetDispatchTableEntry(ui32Index, pfFunction) \
 	_SetDispatchTableEntry(PVRSRV_GET_BRIDGE_ID(ui32Index), #ui32Index, (BridgeWrapperFunction)pfFunction, #pfFunction)
 
+/*
+ * Calls which only look up handles and read the objects behind them run with
+ * the bridge lock held shared, so they can proceed alongside each other.
+ * PDUMP output is global state, so with PDUMP everything stays exclusive.
+ */
+#if defined(PDUMP)
+#define SetSharedDispatchTableEntry(ui32Index, pfFunction) \
+	SetDispatchTableEntry(ui32Index, pfFunction)
+#else
+#define SetSharedDispatchTableEntry(ui32Index, pfFunction) \
+	do { \
+		SetDispatchTableEntry(ui32Index, pfFunction); \
+		g_BridgeDispatchTable[PVRSRV_GET_BRIDGE_ID(ui32Index)].bShared = IMG_TRUE; \
+	} while (0)
+#endif
+
+static INLINE IMG_BOOL BridgeIsShared(IMG_UINT32 ui32BridgeID)
+{
+	return (ui32BridgeID < BRIDGE_DISPATCH_TABLE_ENTRY_COUNT) ?
+		g_BridgeDispatchTable[ui32BridgeID].bShared : IMG_FALSE;
+}
+
 #define DISPATCH_TABLE_GAP_THRESHOLD 5
 
 #if defined(DEBUG)
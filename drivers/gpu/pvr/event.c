@@ -271,11 +271,11 @@ PVRSRV_ERROR LinuxEventObjectWait(IMG_HANDLE hOSEventObject, IMG_UINT32 ui32MSTi
 			break;
 		}
 
-		LinuxUnLockMutex(&gPVRSRVLock);		
+		LinuxUnLockRWSem(&gPVRSRVLock);		
 
 		ui32TimeOutJiffies = (IMG_UINT32)schedule_timeout((IMG_INT32)ui32TimeOutJiffies);
 		
-		LinuxLockMutex(&gPVRSRVLock);
+		LinuxLockRWSem(&gPVRSRVLock);
 #if defined(DEBUG)
 		psLinuxEventObject->ui32Stats++;
 #endif			
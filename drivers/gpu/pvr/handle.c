@@ -30,10 +30,14 @@
 #include "services_headers.h"
 #include "handle.h"
 
+#if defined(__linux__)
+#include "mm.h"
+#endif
+
 #ifdef	DEBUG
 #define	HANDLE_BLOCK_SHIFT	2
 #else
-#define	HANDLE_BLOCK_SHIFT	8
+#define	HANDLE_BLOCK_SHIFT	6
 #endif
 
 #define	DIVIDE_BY_BLOCK_SIZE(i)		(((IMG_UINT32)(i)) >> HANDLE_BLOCK_SHIFT)
@@ -178,6 +182,10 @@ struct _PVRSRV_HANDLE_BASE_
 	
 	struct sHandleIndex *psHandleArray;
 
+	/* number of entries allocated in psHandleArray, which may exceed the
+	   number of blocks in use so that growing by a block seldom copies */
+	IMG_UINT32 ui32HandleArraySize;
+
 	
 	HASH_TABLE *psHashTab;
 
@@ -221,6 +229,11 @@ enum eHandKey {
 
 PVRSRV_HANDLE_BASE *gpsKernelHandleBase = IMG_NULL;
 
+#if defined(__linux__)
+/* handle blocks come from a slab rather than vmalloc */
+static LinuxKMemCache *psHandleBlockCache = IMG_NULL;
+#endif
+
 typedef IMG_UINTPTR_T HAND_KEY[HAND_KEY_LEN];
 
 #ifdef INLINE_IS_PRAGMA
@@ -515,14 +528,86 @@ IMG_VOID InitKey(HAND_KEY aKey, PVRSRV_HANDLE_BASE *psBase, IMG_VOID *pvData, PV
 	aKey[HAND_KEY_PARENT] = (IMG_UINTPTR_T)hParent;
 }
 
+static
+PVRSRV_ERROR AllocHandleBlock(struct sHandleIndex *psIndex, IMG_UINT32 ui32Index)
+{
+	IMG_UINT32 ui32SubIndex;
+
+#if defined(__linux__)
+	psIndex->psHandle = KMemCacheAllocWrapper(psHandleBlockCache, GFP_KERNEL);
+	psIndex->hBlockAlloc = IMG_NULL;
+	if (psIndex->psHandle == IMG_NULL)
+	{
+		return PVRSRV_ERROR_OUT_OF_MEMORY;
+	}
+#else
+	PVRSRV_ERROR eError;
+
+	eError = OSAllocMem(PVRSRV_OS_NON_PAGEABLE_HEAP,
+			sizeof(struct sHandle) * HANDLE_BLOCK_SIZE,
+			(IMG_VOID **)&psIndex->psHandle,
+			&psIndex->hBlockAlloc,
+			"Memory Area");
+	if (eError != PVRSRV_OK)
+	{
+		psIndex->psHandle = IMG_NULL;
+		return eError;
+	}
+#endif
+
+	psIndex->ui32FreeHandBlockCount = HANDLE_BLOCK_SIZE;
+
+	for(ui32SubIndex = 0; ui32SubIndex < HANDLE_BLOCK_SIZE; ui32SubIndex++)
+	{
+		struct sHandle *psHandle = psIndex->psHandle + ui32SubIndex;
+
+
+		psHandle->ui32Index = ui32SubIndex + ui32Index;
+		psHandle->eType = PVRSRV_HANDLE_TYPE_NONE;
+		psHandle->eInternalFlag = INTERNAL_HANDLE_FLAG_NONE;
+		psHandle->ui32NextIndexPlusOne  = 0;
+	}
+
+	return PVRSRV_OK;
+}
+
+static
+IMG_VOID FreeHandleBlock(struct sHandleIndex *psIndex)
+{
+	if (psIndex->psHandle == IMG_NULL)
+	{
+		return;
+	}
+
+#if defined(__linux__)
+	KMemCacheFreeWrapper(psHandleBlockCache, psIndex->psHandle);
+#else
+	{
+		PVRSRV_ERROR eError;
+
+		eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
+				sizeof(struct sHandle) * HANDLE_BLOCK_SIZE,
+				psIndex->psHandle,
+				psIndex->hBlockAlloc);
+		if (eError != PVRSRV_OK)
+		{
+			PVR_DPF((PVR_DBG_ERROR, "FreeHandleBlock: Couldn't free handle structures (%d)", eError));
+		}
+	}
+#endif
+	psIndex->psHandle = IMG_NULL;
+}
+
 static
 PVRSRV_ERROR ReallocHandleArray(PVRSRV_HANDLE_BASE *psBase, IMG_UINT32 ui32NewCount)
 {
 	struct sHandleIndex *psOldArray = psBase->psHandleArray;
 	IMG_HANDLE hOldArrayBlockAlloc = psBase->hArrayBlockAlloc;
 	IMG_UINT32 ui32OldCount = psBase->ui32TotalHandCount;
-	struct sHandleIndex *psNewArray = IMG_NULL;
-	IMG_HANDLE hNewArrayBlockAlloc = IMG_NULL;
+	IMG_UINT32 ui32OldArraySize = psBase->ui32HandleArraySize;
+	struct sHandleIndex *psNewArray = psOldArray;
+	IMG_HANDLE hNewArrayBlockAlloc = hOldArrayBlockAlloc;
+	IMG_UINT32 ui32NewArraySize = ui32OldArraySize;
 	PVRSRV_ERROR eError;
 	PVRSRV_ERROR eReturn = PVRSRV_OK;
 	IMG_UINT32 ui32Index;
@@ -547,76 +632,77 @@ PVRSRV_ERROR ReallocHandleArray(PVRSRV_HANDLE_BASE *psBase, IMG_UINT32 ui32NewCo
 		return PVRSRV_ERROR_INVALID_PARAMS;
 	}
 
-	if (ui32NewCount != 0)
+	/*
+	 * The index array at least doubles when it has to grow, and only
+	 * shrinks once a purge leaves it three quarters empty, so adding
+	 * a block of handles normally just allocates the block.
+	 */
+	if (ui32NewCount == 0)
 	{
-		
-		eError = OSAllocMem(PVRSRV_OS_NON_PAGEABLE_HEAP,
-			HANDLE_ARRAY_SIZE(ui32NewCount) * sizeof(struct sHandleIndex),
-			(IMG_VOID **)&psNewArray,
-			&hNewArrayBlockAlloc,
-			"Memory Area");
-		if (eError != PVRSRV_OK)
+		ui32NewArraySize = 0;
+	}
+	else if (HANDLE_ARRAY_SIZE(ui32NewCount) > ui32OldArraySize)
+	{
+		ui32NewArraySize = ui32OldArraySize * 2;
+		if (ui32NewArraySize < HANDLE_ARRAY_SIZE(ui32NewCount))
 		{
-			PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't allocate new handle array (%d)", eError));
-			eReturn = eError;
-			goto error;
+			ui32NewArraySize = HANDLE_ARRAY_SIZE(ui32NewCount);
 		}
-
-		if (ui32OldCount != 0)
+		if (ui32NewArraySize > HANDLE_ARRAY_SIZE(psBase->ui32MaxIndexPlusOne))
 		{
-			OSMemCopy(psNewArray, psOldArray, HANDLE_ARRAY_SIZE(MIN(ui32NewCount, ui32OldCount)) * sizeof(struct sHandleIndex));
+			ui32NewArraySize = HANDLE_ARRAY_SIZE(psBase->ui32MaxIndexPlusOne);
 		}
 	}
+	else if (HANDLE_ARRAY_SIZE(ui32NewCount) <= ui32OldArraySize / 4)
+	{
+		ui32NewArraySize = HANDLE_ARRAY_SIZE(ui32NewCount) * 2;
+	}
 
-	
-	for(ui32Index = ui32NewCount; ui32Index < ui32OldCount; ui32Index += HANDLE_BLOCK_SIZE)
+	if (ui32NewArraySize != ui32OldArraySize)
 	{
-		struct sHandleIndex *psIndex = INDEX_TO_INDEX_STRUCT_PTR(psOldArray, ui32Index);
+		psNewArray = IMG_NULL;
+		hNewArrayBlockAlloc = IMG_NULL;
 
-		eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
-				sizeof(struct sHandle) * HANDLE_BLOCK_SIZE,
-				psIndex->psHandle,
-				psIndex->hBlockAlloc);
-		if (eError != PVRSRV_OK)
+		if (ui32NewArraySize != 0)
 		{
-			PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't free handle structures (%d)", eError));
+			
+			eError = OSAllocMem(PVRSRV_OS_NON_PAGEABLE_HEAP,
+				ui32NewArraySize * sizeof(struct sHandleIndex),
+				(IMG_VOID **)&psNewArray,
+				&hNewArrayBlockAlloc,
+				"Memory Area");
+			if (eError != PVRSRV_OK)
+			{
+				PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't allocate new handle array (%d)", eError));
+				eReturn = eError;
+				goto error;
+			}
+
+			if (ui32OldCount != 0)
+			{
+				OSMemCopy(psNewArray, psOldArray, HANDLE_ARRAY_SIZE(MIN(ui32NewCount, ui32OldCount)) * sizeof(struct sHandleIndex));
+			}
 		}
 	}
 
 	
+	for(ui32Index = ui32NewCount; ui32Index < ui32OldCount; ui32Index += HANDLE_BLOCK_SIZE)
+	{
+		FreeHandleBlock(INDEX_TO_INDEX_STRUCT_PTR(psOldArray, ui32Index));
+	}
+
+	
 	for(ui32Index = ui32OldCount; ui32Index < ui32NewCount; ui32Index += HANDLE_BLOCK_SIZE)
 	{
 		 
 		struct sHandleIndex *psIndex = INDEX_TO_INDEX_STRUCT_PTR(psNewArray, ui32Index);
 
-		eError = OSAllocMem(PVRSRV_OS_NON_PAGEABLE_HEAP,
-				sizeof(struct sHandle) * HANDLE_BLOCK_SIZE,
-				(IMG_VOID **)&psIndex->psHandle,
-				&psIndex->hBlockAlloc,
-				"Memory Area");
+		eError = AllocHandleBlock(psIndex, ui32Index);
 		if (eError != PVRSRV_OK)
 		{
-			psIndex->psHandle = IMG_NULL;
 			PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't allocate handle structures (%d)", eError));
 			eReturn = eError;
 		}
-		else
-		{
-			IMG_UINT32 ui32SubIndex;
-
-			psIndex->ui32FreeHandBlockCount = HANDLE_BLOCK_SIZE;
-
-			for(ui32SubIndex = 0; ui32SubIndex < HANDLE_BLOCK_SIZE; ui32SubIndex++)
-			{
-				struct sHandle *psHandle = psIndex->psHandle + ui32SubIndex;
-
-
-				psHandle->ui32Index = ui32SubIndex + ui32Index;
-				psHandle->eType = PVRSRV_HANDLE_TYPE_NONE;
-				psHandle->eInternalFlag = INTERNAL_HANDLE_FLAG_NONE;
-				psHandle->ui32NextIndexPlusOne  = 0;
-			}
-		}
 	}
 	if (eReturn != PVRSRV_OK)
 	{
@@ -633,11 +719,11 @@ PVRSRV_ERROR ReallocHandleArray(PVRSRV_HANDLE_BASE *psBase, IMG_UINT32 ui32NewCo
 	}
 #endif
 
-	if (psOldArray != IMG_NULL)
+	if (psOldArray != IMG_NULL && psOldArray != psNewArray)
 	{
 		
 		eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
-			HANDLE_ARRAY_SIZE(ui32OldCount) * sizeof(struct sHandleIndex),
+			ui32OldArraySize * sizeof(struct sHandleIndex),
 			psOldArray,
 			hOldArrayBlockAlloc);
 		if (eError != PVRSRV_OK)
@@ -648,6 +734,7 @@ PVRSRV_ERROR ReallocHandleArray(PVRSRV_HANDLE_BASE *psBase, IMG_UINT32 ui32NewCo
 
 	psBase->psHandleArray = psNewArray;
 	psBase->hArrayBlockAlloc = hNewArrayBlockAlloc;
+	psBase->ui32HandleArraySize = ui32NewArraySize;
 	psBase->ui32TotalHandCount = ui32NewCount;
 
 	if (ui32NewCount > ui32OldCount)
@@ -709,28 +796,20 @@ error:
 		
 		for(ui32Index = ui32OldCount; ui32Index < ui32NewCount; ui32Index += HANDLE_BLOCK_SIZE)
 		{
-			struct sHandleIndex *psIndex = INDEX_TO_INDEX_STRUCT_PTR(psNewArray, ui32Index);
-			if (psIndex->psHandle != IMG_NULL)
-			{
-				eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
-						sizeof(struct sHandle) * HANDLE_BLOCK_SIZE,
-						psIndex->psHandle,
-						psIndex->hBlockAlloc);
-				if (eError != PVRSRV_OK)
-				{
-					PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't free handle structures (%d)", eError));
-				}
-			}
+			FreeHandleBlock(INDEX_TO_INDEX_STRUCT_PTR(psNewArray, ui32Index));
 		}
 
-		
-		eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
-			HANDLE_ARRAY_SIZE(ui32NewCount) * sizeof(struct sHandleIndex),
-			psNewArray,
-			hNewArrayBlockAlloc);
-		if (eError != PVRSRV_OK)
+		if (psNewArray != psOldArray)
 		{
-			PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't free new handle array (%d)", eError));
+			
+			eError = OSFreeMem(PVRSRV_OS_PAGEABLE_HEAP,
+				ui32NewArraySize * sizeof(struct sHandleIndex),
+				psNewArray,
+				hNewArrayBlockAlloc);
+			if (eError != PVRSRV_OK)
+			{
+				PVR_DPF((PVR_DBG_ERROR, "ReallocHandleArray: Couldn't free new handle array (%d)", eError));
+			}
 		}
 	}
 
@@ -812,6 +891,10 @@ static PVRSRV_ERROR FreeHandle(PVRSRV_HANDLE_BASE *psBase, struct sHandle *psHan
 		
 		psBase->ui32LastFreeIndexPlusOne = ui32Index + 1;
 	}
+	else if (ui32Index < psBase->ui32FirstFreeIndex)
+	{
+		psBase->ui32FirstFreeIndex = ROUND_DOWN_TO_MULTIPLE_OF_BLOCK_SIZE(ui32Index);
+	}
 
 	psBase->ui32FreeHandCount++;
 	INDEX_TO_FREE_HAND_BLOCK_COUNT(psBase, ui32Index)++;
@@ -835,37 +918,57 @@ static PVRSRV_ERROR FreeHandle(PVRSRV_HANDLE_BASE *psBase, struct sHandle *psHan
 	return PVRSRV_OK;
 }
 
+/*
+ * Only used when the handle base is going away.  Blocks with no handles in
+ * use are skipped, and each block is returned as soon as the sweep has
+ * passed it.  The base is switched to purging first, so that FreeHandle
+ * no longer appends to the free list, whose tail may be in any block
+ * already returned.
+ */
 static PVRSRV_ERROR FreeAllHandles(PVRSRV_HANDLE_BASE *psBase)
 {
-	IMG_UINT32 i;
+	IMG_UINT32 ui32BlockedIndex;
 	PVRSRV_ERROR eError = PVRSRV_OK;
 
-	if (psBase->ui32FreeHandCount == psBase->ui32TotalHandCount)
+	PVR_ASSERT(!HANDLES_BATCHED(psBase))
+
+	if (!psBase->bPurgingEnabled)
 	{
-		return eError;
+		psBase->bPurgingEnabled = IMG_TRUE;
+		psBase->ui32FirstFreeIndex = 0;
+		psBase->ui32LastFreeIndexPlusOne = 0;
 	}
 
-	for (i = 0; i < psBase->ui32TotalHandCount; i++)
+	for (ui32BlockedIndex = 0; ui32BlockedIndex < psBase->ui32TotalHandCount; ui32BlockedIndex += HANDLE_BLOCK_SIZE)
 	{
-		struct sHandle *psHandle;
+		struct sHandleIndex *psIndex = BASE_AND_INDEX_TO_INDEX_STRUCT_PTR(psBase, ui32BlockedIndex);
+		IMG_UINT32 i;
 
-		psHandle = INDEX_TO_HANDLE_STRUCT_PTR(psBase, i);
+		if (psBase->ui32FreeHandCount == psBase->ui32TotalHandCount)
+		{
+			break;
+		}
 
-		if (psHandle->eType != PVRSRV_HANDLE_TYPE_NONE)
+		for (i = ui32BlockedIndex; i < ui32BlockedIndex + HANDLE_BLOCK_SIZE && psIndex->ui32FreeHandBlockCount != HANDLE_BLOCK_SIZE; i++)
 		{
-			eError = FreeHandle(psBase, psHandle);
-			if (eError != PVRSRV_OK)
-			{
-				PVR_DPF((PVR_DBG_ERROR, "FreeAllHandles: FreeHandle failed (%d)", eError));
-				break;
-			}
+			struct sHandle *psHandle;
 
-			
-			if (psBase->ui32FreeHandCount == psBase->ui32TotalHandCount)
+			psHandle = INDEX_TO_HANDLE_STRUCT_PTR(psBase, i);
+
+			if (psHandle->eType != PVRSRV_HANDLE_TYPE_NONE)
 			{
-				break;
+				eError = FreeHandle(psBase, psHandle);
+				if (eError != PVRSRV_OK)
+				{
+					PVR_DPF((PVR_DBG_ERROR, "FreeAllHandles: FreeHandle failed (%d)", eError));
+					return eError;
+				}
 			}
 		}
+
+		PVR_ASSERT(psIndex->ui32FreeHandBlockCount == HANDLE_BLOCK_SIZE)
+
+		FreeHandleBlock(psIndex);
 	}
 
 	return eError;
@@ -1045,32 +1148,42 @@ static PVRSRV_ERROR AllocHandle(PVRSRV_HANDLE_BASE *psBase, IMG_HANDLE *phHandle
 	}
 	else
 	{
-		IMG_UINT32 ui32BlockedIndex;
+		IMG_UINT32 ui32BlockedIndex = psBase->ui32FirstFreeIndex;
+		IMG_UINT32 ui32Blocks;
 
-		
-		
+		/*
+		 * With purging there is no free list.  ui32FirstFreeIndex
+		 * instead remembers the block the last handle came from, or
+		 * the lowest one a handle has since been freed in, and the
+		 * search for a block with free handles starts there.
+		 */
 		PVR_ASSERT((psBase->ui32FirstFreeIndex % HANDLE_BLOCK_SIZE) == 0)
 
-		for (ui32BlockedIndex = ROUND_DOWN_TO_MULTIPLE_OF_BLOCK_SIZE(psBase->ui32FirstFreeIndex); ui32BlockedIndex < psBase->ui32TotalHandCount; ui32BlockedIndex += HANDLE_BLOCK_SIZE)
+		for (ui32Blocks = INDEX_TO_BLOCK_INDEX(psBase->ui32TotalHandCount); ui32Blocks != 0; ui32Blocks--)
 		{
-			struct sHandleIndex *psIndex = BASE_AND_INDEX_TO_INDEX_STRUCT_PTR(psBase, ui32BlockedIndex);
+			if (ui32BlockedIndex >= psBase->ui32TotalHandCount)
+			{
+				ui32BlockedIndex = 0;
+			}
 
-			if (psIndex->ui32FreeHandBlockCount == 0)
+			if (INDEX_TO_FREE_HAND_BLOCK_COUNT(psBase, ui32BlockedIndex) != 0)
 			{
-				continue;
+				break;
 			}
+			ui32BlockedIndex += HANDLE_BLOCK_SIZE;
+		}
+		PVR_ASSERT(ui32Blocks != 0)
 
-			for (ui32NewIndex = ui32BlockedIndex; ui32NewIndex < ui32BlockedIndex + HANDLE_BLOCK_SIZE; ui32NewIndex++)
+		for (ui32NewIndex = ui32BlockedIndex; ui32NewIndex < ui32BlockedIndex + HANDLE_BLOCK_SIZE; ui32NewIndex++)
+		{
+			psNewHandle = INDEX_TO_HANDLE_STRUCT_PTR(psBase, ui32NewIndex);
+			if (HANDLE_STRUCT_IS_FREE(psNewHandle))
 			{
-				psNewHandle = INDEX_TO_HANDLE_STRUCT_PTR(psBase, ui32NewIndex);
-				if (HANDLE_STRUCT_IS_FREE(psNewHandle))
-				{
-					break;
-				}
+				break;
 			}
 		}
-		psBase->ui32FirstFreeIndex = 0;
-		PVR_ASSERT(ui32NewIndex < psBase->ui32TotalHandCount)
+		psBase->ui32FirstFreeIndex = ui32BlockedIndex;
+		PVR_ASSERT(ui32NewIndex < ui32BlockedIndex + HANDLE_BLOCK_SIZE)
 	}
 	PVR_ASSERT(psNewHandle != IMG_NULL)
 
@@ -1761,7 +1874,10 @@ PVRSRV_ERROR PVRSRVPurgeHandles(PVRSRV_HANDLE_BASE *psBase)
 	{
 		PVRSRV_ERROR eError;
 
-		
+		if (psBase->ui32FirstFreeIndex > ui32NewHandCount)
+		{
+			psBase->ui32FirstFreeIndex = 0;
+		}
 
 		eError = ReallocHandleArray(psBase, ui32NewHandCount);
 		if (eError != PVRSRV_OK)
@@ -1830,11 +1946,24 @@ PVRSRV_ERROR PVRSRVHandleInit(IMG_VOID)
 
 	PVR_ASSERT(gpsKernelHandleBase == IMG_NULL)
 
+#if defined(__linux__)
+	psHandleBlockCache = KMemCacheCreateWrapper("img-handle", sizeof(struct sHandle) * HANDLE_BLOCK_SIZE, 0, 0);
+	if (psHandleBlockCache == IMG_NULL)
+	{
+		PVR_DPF((PVR_DBG_ERROR, "PVRSRVHandleInit: Couldn't create handle block cache"));
+		return PVRSRV_ERROR_OUT_OF_MEMORY;
+	}
+#endif
+
 	eError = PVRSRVAllocHandleBase(&gpsKernelHandleBase);
 	if (eError != PVRSRV_OK)
 	{
 		PVR_DPF((PVR_DBG_ERROR, "PVRSRVHandleInit: PVRSRVAllocHandleBase failed (%d)", eError));
-		goto error;
+#if defined(__linux__)
+		KMemCacheDestroyWrapper(psHandleBlockCache);
+		psHandleBlockCache = IMG_NULL;
+#endif
+		return eError;
 	}
 
 	eError = PVRSRVEnableHandlePurging(gpsKernelHandleBase);
@@ -1867,6 +1996,14 @@ PVRSRV_ERROR PVRSRVHandleDeInit(IMG_VOID)
 		}
 	}
 
+#if defined(__linux__)
+	if (eError == PVRSRV_OK && psHandleBlockCache != IMG_NULL)
+	{
+		KMemCacheDestroyWrapper(psHandleBlockCache);
+		psHandleBlockCache = IMG_NULL;
+	}
+#endif
+
 	return eError;
 }
 #else
@@ -52,8 +52,9 @@ void PVRSRVExportFDToIONHandles(int fd, struct ion_client **client,
 	PVRSRV_ERROR eError;
 	struct file *psFile;
 
-	/* Take the bridge mutex so the handle won't be freed underneath us */
-	LinuxLockMutex(&gPVRSRVLock);
+	/* Handles are only freed with the bridge lock held exclusively, so
+	 * holding it shared keeps this one from going away underneath us */
+	LinuxLockRWSemShared(&gPVRSRVLock);
 
 	psFile = fget(fd);
 	if(!psFile)
@@ -97,7 +98,7 @@ err_fput:
 	fput(psFile);
 err_unlock:
 	/* Allow PVRSRV clients to communicate with srvkm again */
-	LinuxUnLockMutex(&gPVRSRVLock);
+	LinuxUnLockRWSemShared(&gPVRSRVLock);
 }
 
 struct ion_handle *
@@ -27,6 +27,6 @@
 #ifndef __LOCK_H__
 #define __LOCK_H__
 
-extern PVRSRV_LINUX_MUTEX gPVRSRVLock;
+extern PVRSRV_LINUX_RWSEM gPVRSRVLock;
 
 #endif 
@@ -193,7 +193,7 @@ static struct file_operations pvrsrv_fops =
 };
 #endif
 
-PVRSRV_LINUX_MUTEX gPVRSRVLock;
+PVRSRV_LINUX_RWSEM gPVRSRVLock;
 
 IMG_UINT32 gui32ReleasePID;
 
@@ -392,7 +392,7 @@ PVR_MOD_STATIC void PVRSRVDriverShutdown(LDM_DEV *pDevice)
 	if (atomic_dec_and_test(&sDriverIsShutdown))
 	{
 
-		LinuxLockMutex(&gPVRSRVLock);
+		LinuxLockRWSem(&gPVRSRVLock);
 
 		(void) PVRSRVSetPowerStateKM(PVRSRV_SYS_POWER_STATE_D3);
 	}
@@ -504,7 +504,7 @@ static int PVRSRVOpen(struct inode unref__ * pInode, struct file *pFile)
 	PVRSRV_ENV_PER_PROCESS_DATA *psEnvPerProc;
 #endif
 
-	LinuxLockMutex(&gPVRSRVLock);
+	LinuxLockRWSem(&gPVRSRVLock);
 
 	ui32PID = OSGetCurrentProcessIDKM();
 
@@ -544,7 +544,7 @@ static int PVRSRVOpen(struct inode unref__ * pInode, struct file *pFile)
 	PRIVATE_DATA(pFile) = psPrivateData;
 	iRet = 0;
 err_unlock:
-	LinuxUnLockMutex(&gPVRSRVLock);
+	LinuxUnLockRWSem(&gPVRSRVLock);
 	return iRet;
 }
 
@@ -558,7 +558,7 @@ static int PVRSRVRelease(struct inode unref__ * pInode, struct file *pFile)
 	PVRSRV_FILE_PRIVATE_DATA *psPrivateData;
 	int err = 0;
 
-	LinuxLockMutex(&gPVRSRVLock);
+	LinuxLockRWSem(&gPVRSRVLock);
 
 #if defined(SUPPORT_DRI_DRM)
 	psPrivateData = (PVRSRV_FILE_PRIVATE_DATA *)pvPrivData;
@@ -611,7 +611,7 @@ static int PVRSRVRelease(struct inode unref__ * pInode, struct file *pFile)
 	}
 
 err_unlock:
-	LinuxUnLockMutex(&gPVRSRVLock);
+	LinuxUnLockRWSem(&gPVRSRVLock);
 #if defined(SUPPORT_DRI_DRM)
 	return;
 #else
@@ -641,7 +641,7 @@ static int __init PVRCore_Init(void)
 #endif
 	PVR_TRACE(("PVRCore_Init"));
 
-	LinuxInitMutex(&gPVRSRVLock);
+	LinuxInitRWSem(&gPVRSRVLock);
 
 	if (CreateProcEntries ())
 	{
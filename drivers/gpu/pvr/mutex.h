@@ -34,6 +34,7 @@
 #else
 #include <asm/semaphore.h>
 #endif
+#include <linux/rwsem.h>
 
 
 
@@ -65,6 +66,22 @@ extern IMG_VOID LinuxUnLockMutex(PVRSRV_LINUX_MUTEX *psPVRSRVMutex);
 
 extern IMG_BOOL LinuxIsLockedMutex(PVRSRV_LINUX_MUTEX *psPVRSRVMutex);
 
+/*
+ * Reader/writer lock.  The exclusive side behaves like a PVRSRV_LINUX_MUTEX;
+ * the shared side is for callers that only read the state it protects.
+ */
+typedef struct rw_semaphore PVRSRV_LINUX_RWSEM;
+
+extern IMG_VOID LinuxInitRWSem(PVRSRV_LINUX_RWSEM *psPVRSRVRWSem);
+
+extern IMG_VOID LinuxLockRWSem(PVRSRV_LINUX_RWSEM *psPVRSRVRWSem);
+
+extern IMG_VOID LinuxUnLockRWSem(PVRSRV_LINUX_RWSEM *psPVRSRVRWSem);
+
+extern IMG_VOID LinuxLockRWSemShared(PVRSRV_LINUX_RWSEM *psPVRSRVRWSem);
+
+extern IMG_VOID LinuxUnLockRWSemShared(PVRSRV_LINUX_RWSEM *psPVRSRVRWSem);
+
 
 #endif 
 
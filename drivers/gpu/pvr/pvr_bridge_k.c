@@ -37,13 +37,11 @@
 #include "pvr_bridge_km.h"
 #include "pvr_uaccess.h"
 #include "refcount.h"
+#include "env_perproc.h"
 
 #if defined(SUPPORT_DRI_DRM)
 #include <drm/drmP.h>
 #include "pvr_drm.h"
-#if defined(PVR_SECURE_DRM_AUTH_EXPORT)
-#include "env_perproc.h"
-#endif
 #endif
 
 #if defined(SUPPORT_VGX)
@@ -64,6 +62,8 @@
 
 #if defined(DEBUG_BRIDGE_KM)
 
+#include <linux/hrtimer.h>
+
 static struct proc_dir_entry *g_ProcBridgeStats =0;
 static void* ProcSeqNextBridgeStats(struct seq_file *sfile,void* el,loff_t off);
 static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el);
@@ -72,7 +72,7 @@ static void ProcSeqStartstopBridgeStats(struct seq_file *sfile,IMG_BOOL start);
 
 #endif
 
-extern PVRSRV_LINUX_MUTEX gPVRSRVLock;
+extern PVRSRV_LINUX_RWSEM gPVRSRVLock;
 
 #if defined(SUPPORT_MEMINFO_IDS)
 static IMG_UINT64 ui64Stamp;
@@ -110,15 +110,46 @@ LinuxBridgeDeInit(IMG_VOID)
 
 #if defined(DEBUG_BRIDGE_KM)
 
+/*
+ * Per command histogram of the time spent in the ioctl, including waiting
+ * for the bridge lock.  Bucket n counts calls of [2^n, 2^(n+1)) microseconds;
+ * the first also counts anything shorter and the last anything longer.
+ */
+#define BRIDGE_LATENCY_BUCKETS	16
+
+static atomic_t g_aBridgeLatency[BRIDGE_DISPATCH_TABLE_ENTRY_COUNT][BRIDGE_LATENCY_BUCKETS];
+
+static IMG_VOID BridgeRecordLatency(IMG_UINT32 ui32BridgeID, ktime_t sStart)
+{
+	s64 i64Us = ktime_us_delta(ktime_get(), sStart);
+	IMG_UINT32 ui32Bucket = 0;
+
+	if(ui32BridgeID >= BRIDGE_DISPATCH_TABLE_ENTRY_COUNT)
+	{
+		return;
+	}
+
+	if(i64Us >= (1 << (BRIDGE_LATENCY_BUCKETS - 1)))
+	{
+		ui32Bucket = BRIDGE_LATENCY_BUCKETS - 1;
+	}
+	else if(i64Us > 0)
+	{
+		ui32Bucket = fls((IMG_INT)i64Us) - 1;
+	}
+
+	atomic_inc(&g_aBridgeLatency[ui32BridgeID][ui32Bucket]);
+}
+
 static void ProcSeqStartstopBridgeStats(struct seq_file *sfile,IMG_BOOL start)
 {
 	if(start)
 	{
-		LinuxLockMutex(&gPVRSRVLock);
+		LinuxLockRWSemShared(&gPVRSRVLock);
 	}
 	else
 	{
-		LinuxUnLockMutex(&gPVRSRVLock);
+		LinuxUnLockRWSemShared(&gPVRSRVLock);
 	}
 }
 
@@ -148,6 +179,7 @@ static void* ProcSeqNextBridgeStats(struct seq_file *sfile,void* el,loff_t off)
 static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 {
 	PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY *psEntry = (	PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY*)el;
+	IMG_UINT32 i;
 
 	if(el == PVR_PROC_SEQ_START_TOKEN)
 	{
@@ -156,7 +188,7 @@ static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 						  "Total number of bytes copied via copy_from_user = %u\n"
 						  "Total number of bytes copied via copy_to_user = %u\n"
 						  "Total number of bytes copied via copy_*_user = %u\n\n"
-						  "%-45s | %-40s | %10s | %20s | %10s\n",
+						  "%-45s | %-40s | %10s | %20s | %10s | %s\n",
 						  g_BridgeGlobalStats.ui32IOCTLCount,
 						  g_BridgeGlobalStats.ui32TotalCopyFromUserBytes,
 						  g_BridgeGlobalStats.ui32TotalCopyToUserBytes,
@@ -165,18 +197,26 @@ static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 						  "Wrapper Function",
 						  "Call Count",
 						  "copy_from_user Bytes",
-						  "copy_to_user Bytes"
+						  "copy_to_user Bytes",
+						  "Latency us: <2 <4 <8 ... <32768 >=32768"
 						 );
 		return;
 	}
 
 	seq_printf(sfile,
-				   "%-45s   %-40s   %-10u   %-20u   %-10u\n",
+				   "%-45s   %-40s   %-10u   %-20u   %-10u  ",
 				   psEntry->pszIOCName,
 				   psEntry->pszFunctionName,
 				   psEntry->ui32CallCount,
 				   psEntry->ui32CopyFromUserTotalBytes,
 				   psEntry->ui32CopyToUserTotalBytes);
+
+	for(i = 0; i < BRIDGE_LATENCY_BUCKETS; i++)
+	{
+		seq_printf(sfile, " %u",
+				   atomic_read(&g_aBridgeLatency[psEntry - g_BridgeDispatchTable][i]));
+	}
+	seq_printf(sfile, "\n");
 }
 
 #endif
@@ -198,9 +238,12 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 	PVRSRV_BRIDGE_PACKAGE *psBridgePackageKM;
 	IMG_UINT32 ui32PID = OSGetCurrentProcessIDKM();
 	PVRSRV_PER_PROCESS_DATA *psPerProc;
+	PVRSRV_ENV_PER_PROCESS_DATA *psEnvPerProc = IMG_NULL;
+	IMG_BOOL bShared;
 	IMG_INT err = -EFAULT;
-
-	LinuxLockMutex(&gPVRSRVLock);
+#if defined(DEBUG_BRIDGE_KM)
+	ktime_t sStart = ktime_get();
+#endif
 
 #if defined(SUPPORT_DRI_DRM)
 	psBridgePackageKM = (PVRSRV_BRIDGE_PACKAGE *)arg;
@@ -215,7 +258,7 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 		PVR_DPF((PVR_DBG_ERROR, "%s: Received invalid pointer to function arguments",
 				 __FUNCTION__));
 
-		goto unlock_and_return;
+		return err;
 	}
 
 
@@ -225,12 +268,26 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 					  sizeof(PVRSRV_BRIDGE_PACKAGE))
 	  != PVRSRV_OK)
 	{
-		goto unlock_and_return;
+		return err;
 	}
 #endif
 
 	cmd = psBridgePackageKM->ui32BridgeID;
 
+	/*
+	 * Read-only calls take the lock shared and serialise only against
+	 * other calls from the same process; everything else is exclusive.
+	 */
+	bShared = BridgeIsShared(PVRSRV_GET_BRIDGE_ID(cmd));
+	if(bShared)
+	{
+		LinuxLockRWSemShared(&gPVRSRVLock);
+	}
+	else
+	{
+		LinuxLockRWSem(&gPVRSRVLock);
+	}
+
 	if(cmd != PVRSRV_BRIDGE_CONNECT_SERVICES)
 	{
 		PVRSRV_ERROR eError;
@@ -266,6 +323,12 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 		}
 	}
 
+	if(bShared)
+	{
+		psEnvPerProc = (PVRSRV_ENV_PER_PROCESS_DATA *)PVRSRVProcessPrivateData(psPerProc);
+		LinuxLockMutex(&psEnvPerProc->sBridgeLock);
+	}
+
 	psBridgePackageKM->ui32BridgeID = PVRSRV_GET_BRIDGE_ID(psBridgePackageKM->ui32BridgeID);
 
 	switch(cmd)
@@ -452,6 +515,20 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 	}
 
 unlock_and_return:
-	LinuxUnLockMutex(&gPVRSRVLock);
+	if(bShared)
+	{
+		if(psEnvPerProc)
+		{
+			LinuxUnLockMutex(&psEnvPerProc->sBridgeLock);
+		}
+		LinuxUnLockRWSemShared(&gPVRSRVLock);
+	}
+	else
+	{
+		LinuxUnLockRWSem(&gPVRSRVLock);
+	}
+#if defined(DEBUG_BRIDGE_KM)
+	BridgeRecordLatency(PVRSRV_GET_BRIDGE_ID(cmd), sStart);
+#endif
 	return err;
 }
@@ -102,6 +102,7 @@ struct mem_info {
 	struct tcm_area area;
 	int refs;			/* number of times referenced */
 	bool alloced;			/* still alloced */
+	u32 pat_gen;			/* PAT generation pre-pinned in */
 
 	struct list_head by_area;	/* blocks in the same area / 1D */
 	void *parent;			/* area info for 2D, else group info */
@@ -154,6 +155,7 @@ struct tiler_ops {
 	/* group access operations */
 	void (*add_reserved) (struct list_head *reserved, struct gid_info *gi);
 	void (*release) (struct list_head *reserved);
+	void (*prepin) (struct list_head *reserved);
 
 	/* area operations */
 	s32 (*analize) (enum tiler_fmt fmt, u32 width, u32 height,
@@ -24,6 +24,8 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
 
 #include <mach/dmm.h>
 
@@ -40,10 +42,36 @@
 #define DEBUG(x, y)
 #endif
 
+/* PAT engine 0 interrupts: last descriptor done and descriptor errors */
+#define DMM_IRQ_LST	0x02
+#define DMM_IRQ_ERR	0x7C
+
 static struct mutex dmm_mtx;
 
 static struct omap_dmm_platform_data *device_data;
 
+/* descriptor chain refills, all under dmm_mtx */
+static bool refill_irq;			/* DMM interrupt is available */
+static bool refill_busy;		/* a chain is being refilled */
+static s32 refill_status;		/* status of the last chain */
+static DECLARE_COMPLETION(refill_done);
+
+static irqreturn_t dmm_irq_handler(int irq, void *data)
+{
+	void __iomem *base = device_data->base;
+	u32 status;
+
+	status = __raw_readl(base + DMM_PAT_IRQSTATUS);
+	__raw_writel(status, base + DMM_PAT_IRQSTATUS);
+
+	if (!(status & (DMM_IRQ_LST | DMM_IRQ_ERR)))
+		return status ? IRQ_HANDLED : IRQ_NONE;
+
+	refill_status = status & DMM_IRQ_ERR ? -EIO : 0;
+	complete(&refill_done);
+	return IRQ_HANDLED;
+}
+
 static int dmm_probe(struct platform_device *pdev)
 {
 	if (!pdev || !pdev->dev.platform_data) {
@@ -58,6 +86,19 @@ static int dmm_probe(struct platform_device *pdev)
 	writel(0x88888888, device_data->base + DMM_TILER_OR__0);
 	writel(0x88888888, device_data->base + DMM_TILER_OR__1);
 
+	if (device_data->irq > 0 &&
+	    !request_irq(device_data->irq, dmm_irq_handler, 0, "dmm",
+			 device_data)) {
+		__raw_writel(0xFFFFFFFF, device_data->base + DMM_PAT_IRQSTATUS);
+		__raw_writel(DMM_IRQ_LST | DMM_IRQ_ERR,
+			     device_data->base + DMM_PAT_IRQENABLE_SET);
+		mutex_lock(&dmm_mtx);
+		refill_irq = true;
+		mutex_unlock(&dmm_mtx);
+	} else {
+		printk(KERN_WARNING "dmm: no irq, PAT refills are polled\n");
+	}
+
 	return 0;
 }
 
@@ -69,17 +110,39 @@ static struct platform_driver dmm_driver_ldm = {
 	},
 };
 
-s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
+/* (must have mutex) wait for a chain started by dmm_pat_refill_async */
+static s32 __dmm_pat_sync(struct dmm *dmm)
+{
+	if (!refill_busy)
+		return 0;
+
+	refill_busy = false;
+	if (!wait_for_completion_timeout(&refill_done,
+					 msecs_to_jiffies(100))) {
+		printk(KERN_ERR "dmm: timed out waiting for PAT refill\n");
+		/* stop the engine */
+		__raw_writel(0, dmm->base + DMM_PAT_DESCR__0);
+		return -ETIMEDOUT;
+	}
+	return refill_status;
+}
+
+/* (must have mutex) */
+static s32 __dmm_pat_refill(struct dmm *dmm, struct pat *pd)
 {
-	s32 ret = -EFAULT;
+	s32 ret;
 	void __iomem *r;
 	u32 v, i;
 
-	/* Only manual refill supported */
-	if (mode != MANUAL)
+	/* a manual refill must not overtake a chain */
+	ret = __dmm_pat_sync(dmm);
+	if (ret)
 		return ret;
+	ret = -EFAULT;
 
-	mutex_lock(&dmm_mtx);
+	/* the status registers are polled below, keep the handler off them */
+	if (refill_irq)
+		disable_irq(device_data->irq);
 
 	/* Check that the DMM_PAT_STATUS register has not reported an error */
 	r = dmm->base + DMM_PAT_STATUS__0;
@@ -204,12 +267,96 @@ s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
 	ret = 0;
 
 refill_error:
+	if (refill_irq)
+		enable_irq(device_data->irq);
+	return ret;
+}
+
+s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
+{
+	s32 ret;
+
+	/* Only manual refill supported */
+	if (mode != MANUAL)
+		return -EFAULT;
+
+	mutex_lock(&dmm_mtx);
+	ret = __dmm_pat_refill(dmm, pd);
 	mutex_unlock(&dmm_mtx);
 
 	return ret;
 }
 EXPORT_SYMBOL(dmm_pat_refill);
 
+s32 dmm_pat_refill_async(struct dmm *dmm, struct pat *desc, u32 desc_pa)
+{
+	s32 ret;
+	void __iomem *r;
+	u32 i;
+
+	/* chain must be 16-byte aligned */
+	BUG_ON(desc_pa & 15);
+
+	mutex_lock(&dmm_mtx);
+
+	/* only one chain is in flight */
+	ret = __dmm_pat_sync(dmm);
+	if (ret)
+		goto done;
+
+	/* without the interrupt, refill the descriptors one by one */
+	if (!refill_irq) {
+		/* NOTE: this relies on the chain being laid out in order */
+		do {
+			ret = __dmm_pat_refill(dmm, desc);
+		} while (!ret && (desc++)->next);
+		goto done;
+	}
+
+	/* Check that the DMM_PAT_STATUS register has not reported an error */
+	r = dmm->base + DMM_PAT_STATUS__0;
+	if (WARN(__raw_readl(r) & 0xFC00,
+		 KERN_ERR "Abort dmm refill, bad status\n")) {
+		ret = -EIO;
+		goto done;
+	}
+
+	/* clear out any pending descriptor, and wait for the engine */
+	__raw_writel(0, dmm->base + DMM_PAT_DESCR__0);
+	i = 1000;
+	while (!(__raw_readl(r) & 1)) {
+		if (--i == 0) {
+			printk(KERN_ERR "dmm: PAT engine not ready\n");
+			ret = -EIO;
+			goto done;
+		}
+		udelay(1);
+	}
+
+	INIT_COMPLETION(refill_done);
+	refill_busy = true;
+
+	/* the descriptors must reach memory before the engine fetches them */
+	wmb();
+	__raw_writel(desc_pa, dmm->base + DMM_PAT_DESCR__0);
+done:
+	mutex_unlock(&dmm_mtx);
+	return ret;
+}
+EXPORT_SYMBOL(dmm_pat_refill_async);
+
+s32 dmm_pat_sync(struct dmm *dmm)
+{
+	s32 ret;
+
+	mutex_lock(&dmm_mtx);
+	ret = __dmm_pat_sync(dmm);
+	mutex_unlock(&dmm_mtx);
+
+	return ret;
+}
+EXPORT_SYMBOL(dmm_pat_sync);
+
 struct dmm *dmm_pat_init(u32 id)
 {
 	u32 base;
@@ -269,6 +416,8 @@ static s32 __init dmm_init(void)
 
 static void __exit dmm_exit(void)
 {
+	if (refill_irq)
+		free_irq(device_data->irq, device_data);
 	mutex_destroy(&dmm_mtx);
 	platform_driver_unregister(&dmm_driver_ldm);
 }
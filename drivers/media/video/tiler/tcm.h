@@ -55,6 +55,20 @@ struct tcm_area {
 	struct tcm_pt  p1;
 };
 
+/* allocator statistics, see tcm_get_stats() */
+struct tcm_stats {
+	u32 slots;		/* container size */
+	u32 free;		/* number of free slots */
+	u32 max_1d;		/* largest 1D area that could be reserved */
+	u16 max_w, max_h;	/* largest free 2D area (by slots) */
+	u16 frag;		/* free slots outside of the largest free 2D
+				   area, in 1/1000 of all free slots */
+	u32 reserved_2d;	/* successful reservations */
+	u32 reserved_1d;
+	u32 failed;		/* failed reservations */
+	u32 rows_skipped;	/* rows rejected without scanning */
+};
+
 struct tcm {
 	u16 width, height;	/* container dimensions */
 
@@ -70,6 +84,7 @@ struct tcm {
 	s32 (*reserve_1d)(struct tcm *tcm, u32 slots, struct tcm_area *area);
 	s32 (*free)      (struct tcm *tcm, struct tcm_area *area);
 	void (*deinit)   (struct tcm *tcm);
+	s32 (*stats)     (struct tcm *tcm, struct tcm_stats *stats); /* opt. */
 };
 
 /*=============================================================================
@@ -216,6 +231,26 @@ static inline s32 tcm_free(struct tcm_area *area)
 	return res;
 }
 
+/**
+ * Get allocation and fragmentation statistics of a container.
+ *
+ * @param tcm	Pointer to container manager.
+ * @param stats	Pointer to where the statistics should be stored.
+ *
+ * @return 0 on success.  Non-0 error code on failure.  Some error
+ *	   codes: -ENODEV: invalid manager or statistics are not
+ *	   supported by the manager, -ENOMEM: not enough memory to
+ *	   compute the statistics.
+ */
+static inline s32 tcm_get_stats(struct tcm *tcm, struct tcm_stats *stats)
+{
+	if (!tcm || !tcm->stats)
+		return -ENODEV;
+
+	memset(stats, 0, sizeof(*stats));
+	return tcm->stats(tcm, stats);
+}
+
 /*=============================================================================
     HELPER FUNCTION FOR ANY TILER CONTAINER MANAGER
 =============================================================================*/
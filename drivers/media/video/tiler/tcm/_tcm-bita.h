@@ -0,0 +1,79 @@
+/*
+ * _tcm_bita.h
+ *
+ * BItmap Tiler Allocator (BiTA) private structures.
+ *
+ * Copyright (C) 2009-2011 Texas Instruments, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Texas Instruments Incorporated nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TCM_BITA_H
+#define _TCM_BITA_H
+
+#include <linux/mutex.h>
+
+#include "../tcm.h"
+
+struct bita_pvt {
+	struct mutex mtx;
+	struct tcm_pt div_pt;	/* divider point splitting container */
+
+	/*
+	 * One bit per slot, set if the slot is reserved.  Each row starts
+	 * on a new word, so a row can be handled as a bitmap on its own.
+	 */
+	unsigned long *map;
+	u16 stride;		/* words per row */
+
+	/*
+	 * Skyline index: for each slot, the number of free slots from it
+	 * down in its column, 0 if the slot is reserved.  Row y of this map
+	 * is the skyline of the free space below row y, so an area of
+	 * height h fits at (x, y) exactly if w consecutive entries of row y
+	 * starting at x are at least h.
+	 */
+	u16 *depth;
+
+	/*
+	 * Per row index: number of free slots and the length of the longest
+	 * run of free slots.  A 2D scan skips any window of rows in which
+	 * one row cannot hold the width, without looking at the bitmap.
+	 */
+	u16 *row_free;
+	u16 *row_run;
+
+	/* counters for tcm_get_stats() */
+	u32 reserved_2d;
+	u32 reserved_1d;
+	u32 failed;
+	u32 rows_skipped;
+};
+
+#endif
@@ -0,0 +1,538 @@
+/*
+ * tcm-bita.c
+ *
+ * BItmap Tiler Allocator (BiTA): 2D and 1D allocation(reservation) algorithm
+ *
+ * Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+
+/*
+ * BiTA places areas the same way SiTA does: aligned 2D areas from the top
+ * left, unaligned 2D areas from the top right, and 1D areas from the bottom
+ * right, each first in the preferred part of the container and then in the
+ * whole container.  It differs in how it looks for space.
+ *
+ * SiTA walks a map of area pointers slot by slot and checks every candidate
+ * slot by slot again, so a reservation costs up to width * height * w * h
+ * steps on a busy container.  BiTA keeps a skyline index instead: for every
+ * row, how far free space reaches down from it in each column.  Whether an
+ * area of height h fits below a row is then a search for w consecutive
+ * columns that reach at least h deep, done on that single row, and a column
+ * that does not reach lets the search jump past it.  Rows whose longest
+ * free run is shorter than the width are skipped without looking at them.
+ * Reserving or freeing an area only updates the skyline of its columns, from
+ * its bottom edge up to the first reserved slot above it.
+ *
+ * 1D areas use a bitmap of reserved slots and the number of free slots in
+ * each row, so full and empty rows are passed over whole.
+ *
+ * SiTA also scores unaligned candidates by their neighbors.  BiTA takes the
+ * first fit in scan order, which packs areas towards the scan origin.
+ */
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "_tcm-bita.h"
+#include "tcm-bita.h"
+
+#define TCM_ALG_NAME "tcm_bita"
+#include "tcm-utils.h"
+
+#define ALIGN_DOWN(value, align) ((value) & ~((align) - 1))
+
+static inline unsigned long *row(struct bita_pvt *pvt, u16 y)
+{
+	return pvt->map + y * pvt->stride;
+}
+
+static inline u16 *skyline(struct tcm *tcm, u16 y)
+{
+	return ((struct bita_pvt *)tcm->pvt)->depth + y * tcm->width;
+}
+
+/*
+ * recalculate the skyline of column x after slots y0..y1 in it changed:
+ * walk up from y1, counting the free slots below, until a reserved slot
+ * above y0 cuts the column off
+ */
+static void update_column(struct tcm *tcm, u16 x, u16 y0, u16 y1)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	u16 d = y1 + 1 < tcm->height ? skyline(tcm, y1 + 1)[x] : 0;
+	s32 y;
+
+	for (y = y1; y >= 0; y--) {
+		if (test_bit(x, row(pvt, y))) {
+			if (y < y0)
+				break;
+			d = 0;
+		} else {
+			d++;
+		}
+		skyline(tcm, y)[x] = d;
+	}
+}
+
+/* recalculate the index of a row */
+static void update_row(struct tcm *tcm, u16 y)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	unsigned long *r = row(pvt, y);
+	unsigned long x = 0, end;
+	u16 free = 0, run = 0;
+
+	while (x < tcm->width) {
+		x = find_next_zero_bit(r, tcm->width, x);
+		if (x >= tcm->width)
+			break;
+		end = find_next_bit(r, tcm->width, x);
+		free += end - x;
+		if (end - x > run)
+			run = end - x;
+		x = end;
+	}
+
+	pvt->row_free[y] = free;
+	pvt->row_run[y] = run;
+}
+
+/* marks an area busy or free */
+static void fill_area(struct tcm *tcm, struct tcm_area *area, bool busy)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	struct tcm_area a, a_;
+	u16 x, y;
+
+	/* set area's tcm; otherwise, enumerator considers it invalid */
+	area->tcm = tcm;
+
+	tcm_for_each_slice(a, *area, a_) {
+		PA(2, "fill 2d area", &a);
+		for (y = a.p0.y; y <= a.p1.y; y++) {
+			if (busy)
+				bitmap_set(row(pvt, y), a.p0.x,
+					   tcm_awidth(a));
+			else
+				bitmap_clear(row(pvt, y), a.p0.x,
+					     tcm_awidth(a));
+			update_row(tcm, y);
+		}
+		for (x = a.p0.x; x <= a.p1.x; x++)
+			update_column(tcm, x, a.p0.y, a.p1.y);
+	}
+}
+
+/*
+ * find the leftmost aligned run of w columns in [x0, x1] of a skyline that
+ * all reach at least h deep
+ */
+static s32 find_l2r(u16 *sky, u16 w, u16 h, u16 align, u16 x0, u16 x1)
+{
+	s32 x = ALIGN(x0, align), i;
+
+	while (x + w - 1 <= x1) {
+		/* check right to left, so a short column skips the most */
+		for (i = x + w - 1; i >= x; i--)
+			if (sky[i] < h)
+				break;
+		if (i < x)
+			return x;
+		/* move right of the rightmost short column */
+		x = ALIGN(i + 1, align);
+	}
+	return -1;
+}
+
+/*
+ * find the rightmost aligned run of w columns in [x0, x1] of a skyline that
+ * all reach at least h deep
+ */
+static s32 find_r2l(u16 *sky, u16 w, u16 h, u16 align, u16 x0, u16 x1)
+{
+	s32 x = ALIGN_DOWN(x1 - w + 1, align), i;
+
+	while (x >= x0) {
+		for (i = x; i < x + w; i++)
+			if (sky[i] < h)
+				break;
+		if (i == x + w)
+			return x;
+		/* move left of the leftmost short column */
+		x = ALIGN_DOWN(i - w, align);
+	}
+	return -1;
+}
+
+/**
+ * Scan a field top to bottom for a place for a 2D area of given size.
+ *
+ * @param w	width of desired area
+ * @param h	height of desired area
+ * @param align	desired area alignment
+ * @param r2l	scan each row right to left, instead of left to right
+ * @param field	area to scan (inclusive, p0 is top-left)
+ * @param area	pointer to the area that will be set to the position found
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_2d(struct tcm *tcm, u16 w, u16 h, u16 align, bool r2l,
+		   struct tcm_area *field, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 x, y, i;
+
+	PA(2, "scan_2d:", field);
+
+	/* check if allocation would fit in scan area */
+	if (w > __tcm_area_width(field) || h > __tcm_area_height(field))
+		return -ENOSPC;
+
+	for (y = field->p0.y; y + h - 1 <= field->p1.y; y++) {
+		/* skip past the lowest row that is too full for the width */
+		for (i = y + h - 1; i >= y; i--)
+			if (pvt->row_run[i] < w)
+				break;
+		if (i >= y) {
+			pvt->rows_skipped += i - y + 1;
+			y = i;
+			continue;
+		}
+
+		if (r2l)
+			x = find_r2l(skyline(tcm, y), w, h, align,
+				     field->p0.x, field->p1.x);
+		else
+			x = find_l2r(skyline(tcm, y), w, h, align,
+				     field->p0.x, field->p1.x);
+		if (x >= 0) {
+			P3("found: %d,%d", x, y);
+			assign(area, x, y, x + w - 1, y + h - 1);
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+/**
+ * Scan the container right to left from bottom to top for a place for a 1D
+ * area of given size.
+ *
+ * @param num_slots	size of desired area
+ * @param area		pointer to the area that will be set to the position
+ *			found
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_1d(struct tcm *tcm, u32 num_slots, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	u32 found = 0;
+	s32 x, y;
+
+	for (y = tcm->height - 1; y >= 0; y--) {
+		/* whole rows are either skipped or taken without scanning */
+		if (!pvt->row_free[y]) {
+			found = 0;
+			continue;
+		}
+		if (pvt->row_free[y] == tcm->width) {
+			if (!found)
+				assign(area, 0, 0, tcm->width - 1, y);
+			if (found + tcm->width >= num_slots) {
+				x = tcm->width - (num_slots - found);
+				goto done;
+			}
+			found += tcm->width;
+			continue;
+		}
+
+		for (x = tcm->width - 1; x >= 0; x--) {
+			if (test_bit(x, row(pvt, y))) {
+				found = 0;
+				continue;
+			}
+			/* remember bottom-right corner */
+			if (!found)
+				assign(area, 0, 0, x, y);
+			if (++found == num_slots)
+				goto done;
+		}
+	}
+
+	return -ENOSPC;
+
+done:
+	/* set top-left corner */
+	area->p0.x = x;
+	area->p0.y = y;
+	return 0;
+}
+
+/**
+ * Reserve a 2D area in the container
+ *
+ * @param w	width
+ * @param h	height
+ * @param area	pointer to the area that will be populated with the reserved
+ *		area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			   struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	struct tcm_area field = {0};
+	u16 boundary_x, boundary_y;
+	bool r2l;
+	s32 ret;
+
+	/* not supporting more than 64 as alignment */
+	if (align > 64)
+		return -EINVAL;
+
+	/* we prefer 1, 32 and 64 as alignment */
+	align = align <= 1 ? 1 : align <= 32 ? 32 : 64;
+	r2l = align == 1;
+
+	mutex_lock(&(pvt->mtx));
+
+	boundary_y = h > pvt->div_pt.y ? tcm->height - 1 : pvt->div_pt.y - 1;
+	if (!r2l) {
+		/* prefer top-left corner */
+		boundary_x = w > pvt->div_pt.x ? tcm->width - 1 :
+						 pvt->div_pt.x - 1;
+		assign(&field, 0, 0, boundary_x, boundary_y);
+	} else {
+		/* prefer top-right corner */
+		boundary_x = w > tcm->width - pvt->div_pt.x ? 0 :
+							      pvt->div_pt.x;
+		assign(&field, boundary_x, 0, tcm->width - 1, boundary_y);
+	}
+	ret = scan_2d(tcm, w, h, align, r2l, &field, area);
+
+	/* scan the entire container if nothing found, but do not scan 2x */
+	if (ret && (__tcm_area_width(&field) != tcm->width ||
+		    __tcm_area_height(&field) != tcm->height)) {
+		assign(&field, 0, 0, tcm->width - 1, tcm->height - 1);
+		ret = scan_2d(tcm, w, h, align, r2l, &field, area);
+	}
+
+	if (!ret) {
+		fill_area(tcm, area, true);
+		pvt->reserved_2d++;
+	} else {
+		pvt->failed++;
+	}
+
+	mutex_unlock(&(pvt->mtx));
+	return ret;
+}
+
+/**
+ * Reserve a 1D area in the container
+ *
+ * @param num_slots	size of 1D area
+ * @param area		pointer to the area that will be populated with the
+ *			reserved area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_1d(struct tcm *tcm, u32 num_slots,
+			   struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 ret;
+
+	mutex_lock(&(pvt->mtx));
+	ret = scan_1d(tcm, num_slots, area);
+	if (!ret) {
+		fill_area(tcm, area, true);
+		pvt->reserved_1d++;
+	} else {
+		pvt->failed++;
+	}
+	mutex_unlock(&(pvt->mtx));
+	return ret;
+}
+
+/**
+ * Unreserve a previously allocated 2D or 1D area
+ * @param area	area to be freed
+ * @return 0 - success
+ */
+static s32 bita_free(struct tcm *tcm, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_lock(&(pvt->mtx));
+
+	/* check that this is in fact a reserved area */
+	WARN_ON(!test_bit(area->p0.x, row(pvt, area->p0.y)) ||
+		!test_bit(area->p1.x, row(pvt, area->p1.y)));
+
+	fill_area(tcm, area, false);
+
+	mutex_unlock(&(pvt->mtx));
+
+	return 0;
+}
+
+/*
+ * Largest free rectangle, by the largest rectangle under the skyline of
+ * each row.
+ */
+static void max_free_2d(struct tcm *tcm, u16 *stack, struct tcm_stats *stats)
+{
+	u32 best = 0;
+	u16 x, y, top, hx, hh, ww;
+	u16 *heights;
+
+	for (y = 0; y < tcm->height; y++) {
+		heights = skyline(tcm, y);
+
+		for (x = 0, top = 0; x <= tcm->width; x++) {
+			hx = x < tcm->width ? heights[x] : 0;
+			while (top && heights[stack[top - 1]] >= hx) {
+				hh = heights[stack[--top]];
+				ww = top ? x - stack[top - 1] - 1 : x;
+				if ((u32) hh * ww > best) {
+					best = (u32) hh * ww;
+					stats->max_w = ww;
+					stats->max_h = hh;
+				}
+			}
+			stack[top++] = x;
+		}
+	}
+}
+
+static s32 bita_stats(struct tcm *tcm, struct tcm_stats *stats)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	u16 *stack;
+	u32 run = 0;
+	u16 x, y;
+
+	stack = kmalloc((tcm->width + 1) * sizeof(*stack), GFP_KERNEL);
+	if (!stack)
+		return -ENOMEM;
+
+	mutex_lock(&(pvt->mtx));
+
+	stats->slots = tcm->width * tcm->height;
+	for (y = 0; y < tcm->height; y++) {
+		stats->free += pvt->row_free[y];
+
+		/* 1D areas continue from the end of one row to the next */
+		for (x = 0; x < tcm->width; x++) {
+			run = test_bit(x, row(pvt, y)) ? 0 : run + 1;
+			if (run > stats->max_1d)
+				stats->max_1d = run;
+		}
+	}
+
+	max_free_2d(tcm, stack, stats);
+	if (stats->free)
+		stats->frag = 1000 - stats->max_w * stats->max_h * 1000 /
+								stats->free;
+
+	stats->reserved_2d = pvt->reserved_2d;
+	stats->reserved_1d = pvt->reserved_1d;
+	stats->failed = pvt->failed;
+	stats->rows_skipped = pvt->rows_skipped;
+
+	mutex_unlock(&(pvt->mtx));
+
+	kfree(stack);
+	return 0;
+}
+
+static void bita_deinit(struct tcm *tcm)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_destroy(&(pvt->mtx));
+
+	kfree(pvt->map);
+	vfree(pvt->depth);
+	kfree(pvt->row_free);
+	kfree(pvt->row_run);
+	kfree(pvt);
+	kfree(tcm);
+}
+
+struct tcm *bita_init(u16 width, u16 height, struct tcm_pt *attr)
+{
+	struct tcm *tcm;
+	struct bita_pvt *pvt;
+	u16 x, y;
+
+	if (width == 0 || height == 0)
+		return NULL;
+
+	tcm = kzalloc(sizeof(*tcm), GFP_KERNEL);
+	pvt = kzalloc(sizeof(*pvt), GFP_KERNEL);
+	if (!tcm || !pvt)
+		goto error;
+
+	/* Updating the pointers to BiTA implementation APIs */
+	tcm->height = height;
+	tcm->width = width;
+	tcm->reserve_2d = bita_reserve_2d;
+	tcm->reserve_1d = bita_reserve_1d;
+	tcm->free = bita_free;
+	tcm->deinit = bita_deinit;
+	tcm->stats = bita_stats;
+	tcm->pvt = (void *)pvt;
+
+	mutex_init(&(pvt->mtx));
+
+	pvt->stride = BITS_TO_LONGS(width);
+	pvt->map = kzalloc(pvt->stride * height * sizeof(*pvt->map),
+			   GFP_KERNEL);
+	pvt->depth = vmalloc(width * height * sizeof(*pvt->depth));
+	pvt->row_free = kmalloc(height * sizeof(*pvt->row_free), GFP_KERNEL);
+	pvt->row_run = kmalloc(height * sizeof(*pvt->row_run), GFP_KERNEL);
+	if (!pvt->map || !pvt->depth || !pvt->row_free || !pvt->row_run)
+		goto error;
+
+	for (y = 0; y < height; y++)
+		update_row(tcm, y);
+	for (x = 0; x < width; x++)
+		update_column(tcm, x, 0, height - 1);
+
+	if (attr && attr->x <= tcm->width && attr->y <= tcm->height) {
+		pvt->div_pt.x = attr->x;
+		pvt->div_pt.y = attr->y;
+	} else {
+		/* Defaulting to 3:1 ratio on width for 2D area split */
+		/* Defaulting to 3:1 ratio on height for 2D and 1D split */
+		pvt->div_pt.x = (tcm->width * 3) / 4;
+		pvt->div_pt.y = (tcm->height * 3) / 4;
+	}
+
+	return tcm;
+
+error:
+	if (pvt) {
+		kfree(pvt->map);
+		vfree(pvt->depth);
+		kfree(pvt->row_free);
+		kfree(pvt->row_run);
+	}
+	kfree(tcm);
+	kfree(pvt);
+	return NULL;
+}
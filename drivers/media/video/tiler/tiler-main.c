@@ -37,11 +37,14 @@
 #include <mach/dmm.h>
 #include "tmm.h"
 #include "_tiler.h"
-#include "tcm/tcm-sita.h"		/* TCM algorithm */
+#include "tcm/tcm-sita.h"		/* TCM algorithms */
+#include "tcm/tcm-bita.h"
 
 static bool ssptr_id = CONFIG_TILER_SSPTR_ID;
 static uint granularity = CONFIG_TILER_GRANULARITY;
 static uint tiler_alloc_debug;
+static char *tcm_alg = "bita";
+static bool reserve_pin;
 
 /*
  * We can only change ssptr_id if there are no blocks allocated, so that
@@ -54,6 +57,10 @@ module_param_named(grain, granularity, uint, 0644);
 MODULE_PARM_DESC(grain, "Granularity (bytes)");
 module_param_named(alloc_debug, tiler_alloc_debug, uint, 0644);
 MODULE_PARM_DESC(alloc_debug, "Allocation debug flag");
+module_param_named(tcm, tcm_alg, charp, 0444);
+MODULE_PARM_DESC(tcm, "Container manager algorithm (bita or sita)");
+module_param(reserve_pin, bool, 0644);
+MODULE_PARM_DESC(reserve_pin, "Allocate and pin pages for reserved blocks");
 
 static struct dentry *dbgfs;
 static struct dentry *dbg_map;
@@ -78,39 +85,82 @@ static struct tcm *tcm[TILER_FORMATS];
 static struct tmm *tmm[TILER_FORMATS];
 static u32 *dmac_va;
 static dma_addr_t dmac_pa;
+static u32 dmac_size;			/* entries in dmac_va */
 static DEFINE_MUTEX(dmac_mtx);
+static u32 pat_gen;			/* incremented when PAT is lost */
 static dev_t dev;
 
 /*
  *  TMM connectors
  *  ==========================================================================
  */
-/* wrapper around tmm_pin */
-static s32 pin_mem_to_area(struct tmm *tmm, struct tcm_area *area, u32 *ptr)
+
+/* areas to pin with a single PAT refill (must have dmac_mtx) */
+struct pin_batch {
+	struct tmm *tmm;
+	struct pat_area areas[TMM_MAX_AREAS];
+	u32 n;		/* number of areas */
+	u32 used;	/* entries used in dmac_va */
+};
+
+/* pin the areas collected so far */
+static s32 pin_batch_flush(struct pin_batch *b)
 {
 	s32 res = 0;
+
+	if (b->n) {
+		/* Ensure the data reaches to main memory before PAT refill */
+		wmb();
+
+		/* pin memory into DMM */
+		if (tmm_pin_areas(b->tmm, b->areas, b->n, dmac_pa))
+			res = -EFAULT;
+	}
+	b->n = b->used = 0;
+	return res;
+}
+
+/* add an area to a batch, pinning the batch first if it is full */
+static s32 pin_batch_add(struct pin_batch *b, struct tmm *tmm,
+			 struct tcm_area *area, u32 *ptr)
+{
+	s32 res = 0;
+	u32 n;
 	struct pat_area p_area = {0};
 	struct tcm_area slice, area_s;
 
-	/* Ensure the data reaches to main memory before PAT refill */
-	wmb();
-
-	mutex_lock(&dmac_mtx);
 	tcm_for_each_slice(slice, *area, area_s) {
 		p_area.x0 = slice.p0.x;
 		p_area.y0 = slice.p0.y;
 		p_area.x1 = slice.p1.x;
 		p_area.y1 = slice.p1.y;
+		n = tmm_area_entries(&p_area);
 
-		memcpy(dmac_va, ptr, sizeof(*ptr) * tcm_sizeof(slice));
-		ptr += tcm_sizeof(slice);
+		if (b->n == TMM_MAX_AREAS || b->used + n > dmac_size ||
+		    (b->n && b->tmm != tmm))
+			if (pin_batch_flush(b))
+				res = -EFAULT;
 
-		/* pin memory into DMM */
-		if (tmm_pin(tmm, p_area, dmac_pa)) {
-			res = -EFAULT;
-			break;
-		}
+		b->tmm = tmm;
+		b->areas[b->n++] = p_area;
+		memcpy(dmac_va + b->used, ptr, sizeof(*ptr) * tcm_sizeof(slice));
+		ptr += tcm_sizeof(slice);
+		b->used += n;
 	}
+
+	return res;
+}
+
+/* wrapper around tmm_pin */
+static s32 pin_mem_to_area(struct tmm *tmm, struct tcm_area *area, u32 *ptr)
+{
+	s32 res;
+	struct pin_batch b = { .n = 0 };
+
+	mutex_lock(&dmac_mtx);
+	res = pin_batch_add(&b, tmm, area, ptr);
+	if (pin_batch_flush(&b))
+		res = -EFAULT;
 	mutex_unlock(&dmac_mtx);
 
 	return res;
@@ -318,6 +368,43 @@ const struct tiler_debugfs_data debugfs_maps[] = {
 	{ "4x4", debug_allocation_map, 0x0404 },
 };
 
+static void debug_tcm_stats(struct seq_file *s, u32 arg)
+{
+	struct tcm_stats st;
+	int i, j;
+
+	for (i = 0; i < TILER_FORMATS; i++) {
+		/* containers may be shared between formats */
+		for (j = 0; j < i && tcm[j] != tcm[i]; j++)
+			;
+		if (j < i || !tcm[i])
+			continue;
+
+		seq_printf(s, "container %d (%d*%d): ", i, tcm[i]->width,
+							tcm[i]->height);
+		if (tcm_get_stats(tcm[i], &st)) {
+			seq_printf(s, "no statistics\n");
+			continue;
+		}
+		seq_printf(s, "%s\n", tcm_alg);
+		seq_printf(s, "  free slots:       %u of %u\n", st.free,
+								st.slots);
+		seq_printf(s, "  largest free 2D:  (%d*%d)\n", st.max_w,
+								st.max_h);
+		seq_printf(s, "  largest free 1D:  %u\n", st.max_1d);
+		seq_printf(s, "  fragmentation:    %d.%d%%\n", st.frag / 10,
+								st.frag % 10);
+		seq_printf(s, "  reserved 2D/1D:   %u/%u\n", st.reserved_2d,
+								st.reserved_1d);
+		seq_printf(s, "  failed:           %u\n", st.failed);
+		seq_printf(s, "  rows skipped:     %u\n", st.rows_skipped);
+	}
+}
+
+static const struct tiler_debugfs_data debugfs_stats = {
+	"stats", debug_tcm_stats, 0
+};
+
 static int tiler_debug_show(struct seq_file *s, void *unused)
 {
 	struct tiler_debugfs_data *fn = s->private;
@@ -844,9 +931,9 @@ static s32 lay_nv12(int n, u16 w, u16 w1, u16 h, struct gid_info *gi, u8 *p)
 }
 #endif
 
-static void _m_unpin(struct mem_info *mi)
+/* release the pages of a block without unpinning them */
+static void _m_release_pa(struct mem_info *mi)
 {
-	/* release memory */
 	if (mi->pa.memtype == TILER_MEM_GOT_PAGES) {
 		int i;
 		for (i = 0; i < mi->pa.num_pg; i++) {
@@ -868,6 +955,12 @@ static void _m_unpin(struct mem_info *mi)
 	kfree(mi->pa.mem);
 	mi->pa.mem = NULL;
 	mi->pa.num_pg = 0;
+}
+
+static void _m_unpin(struct mem_info *mi)
+{
+	/* release memory */
+	_m_release_pa(mi);
 	unpin_mem_from_area(tmm[tiler_fmt(mi->blk.phys)], &mi->area);
 }
 
@@ -1107,6 +1200,63 @@ static void add_reserved_blocks(struct list_head *reserved, struct gid_info *gi)
 	mutex_unlock(&mtx);
 }
 
+/* (must have mutex) find the memory manager of a container */
+static struct tmm *_m_tmm(struct tcm *container)
+{
+	enum tiler_fmt fmt;
+
+	for (fmt = TILFMT_MIN; fmt <= TILFMT_MAX; fmt++)
+		if (tcm[fmt] == container)
+			return tmm[fmt];
+	return NULL;
+}
+
+static struct tiler_pa_info *get_new_pa(struct tmm *tmm, u32 num_pg);
+
+/*
+ * Allocate and pin pages for reserved blocks, so that allocating them
+ * later does not need to program the PAT.
+ */
+static void prepin_blocks(struct list_head *reserved)
+{
+	struct mem_info *mi;
+	struct tiler_pa_info *pa;
+	struct tmm *t;
+	struct pin_batch b = { .n = 0 };
+	s32 res = 0;
+
+	if (!reserve_pin)
+		return;
+
+	mutex_lock(&mtx);
+	mutex_lock(&dmac_mtx);
+	list_for_each_entry(mi, reserved, global) {
+		t = _m_tmm(mi->area.tcm);
+		if (mi->pa.mem || !tmm_can_pin(t))
+			continue;
+
+		/* blocks without pages are pinned on allocation */
+		pa = get_new_pa(t, tcm_sizeof(mi->area));
+		if (!pa)
+			break;
+		mi->pa = *pa;
+		kfree(pa);	/* transferred array */
+		mi->pat_gen = pat_gen;
+
+		if (pin_batch_add(&b, t, &mi->area, mi->pa.mem))
+			res = -EFAULT;
+	}
+	if (pin_batch_flush(&b))
+		res = -EFAULT;
+
+	/* we do not know which blocks failed: pin them all again on use */
+	if (res)
+		list_for_each_entry(mi, reserved, global)
+			mi->pat_gen = pat_gen - 1;
+	mutex_unlock(&dmac_mtx);
+	mutex_unlock(&mtx);
+}
+
 /* find a block by ssptr */
 static struct mem_info *find_block_by_ssptr(u32 sys_addr)
 {
@@ -1284,6 +1434,9 @@ static s32 pin_memory(struct mem_info *mi, struct tiler_pa_info *pa)
 	    pa->num_pg != tcm_sizeof(mi->area))
 		return -EINVAL;
 
+	/* release any pages of a pre-pinned block */
+	_m_release_pa(mi);
+
 	/* save pages used */
 	mi->pa = *pa;
 	pa->mem = NULL;	/* transfered array */
@@ -1338,6 +1491,18 @@ static s32 alloc_block(enum tiler_fmt fmt, u32 width, u32 height,
 	if (IS_ERR_OR_NULL(mi))
 		return mi ? -ENOMEM : PTR_ERR(mi);
 
+	/* reserved blocks may already have pinned pages */
+	if (mi->pa.mem) {
+		res = 0;
+		if (mi->pat_gen != pat_gen)
+			res = pin_mem_to_area(tmm[fmt], &mi->area, mi->pa.mem);
+		if (res)
+			goto cleanup;
+
+		*info = mi;
+		return 0;
+	}
+
 	/* allocate memory */
 	pa = get_new_pa(tmm[fmt], tcm_sizeof(mi->area));
 	if (IS_ERR_OR_NULL(pa)) {
@@ -1554,22 +1719,38 @@ static int tiler_resume(struct device *pdev)
 {
 	struct mem_info *mi;
 	struct pat_area area = {0};
+	struct tcm_area pin_area;
+	struct pin_batch b = { .n = 0 };
+	s32 res = 0;
+
+	/* pre-pinned reserved blocks are pinned again on use */
+	pat_gen++;
 
 	/* clear out PAT entries and set dummy page */
 	area.x1 = tiler.width - 1;
 	area.y1 = tiler.height - 1;
 	mutex_lock(&dmac_mtx);
 	tmm_unpin(tmm[TILFMT_8BIT], area);
-	mutex_unlock(&dmac_mtx);
 
 	/* iterate over all the blocks and refresh the PAT entries */
 	list_for_each_entry(mi, &blocks, global) {
-		if (mi->pa.mem)
-			if (pin_mem_to_area(tmm[tiler_fmt(mi->blk.phys)],
-						&mi->area, mi->pa.mem))
-				printk(KERN_ERR "Failed PAT restore - %08x\n",
-					mi->blk.phys);
+		if (!mi->pa.mem || !mi->pa.num_pg)
+			continue;
+
+		/* only available pages were pinned for 1D */
+		pin_area = mi->area;
+		if (tiler_fmt(mi->blk.phys) == TILFMT_PAGE)
+			tcm_1d_limit(&pin_area, mi->pa.num_pg);
+		if (pin_batch_add(&b, tmm[tiler_fmt(mi->blk.phys)], &pin_area,
+				  mi->pa.mem))
+			res = -EFAULT;
 	}
+	if (pin_batch_flush(&b))
+		res = -EFAULT;
+	mutex_unlock(&dmac_mtx);
+
+	if (res)
+		printk(KERN_ERR "Failed PAT restore\n");
 
 	return 0;
 }
@@ -1594,7 +1775,7 @@ static s32 __init tiler_init(void)
 	s32 r = -1;
 	struct device *device = NULL;
 	struct tcm_pt div_pt;
-	struct tcm *sita = NULL;
+	struct tcm *container = NULL;
 	struct tmm *tmm_pat = NULL;
 	struct pat_area area = {0};
 
@@ -1613,6 +1794,7 @@ static s32 __init tiler_init(void)
 	tiler.release_gi = release_gi;
 	tiler.release = release_blocks;
 	tiler.add_reserved = add_reserved_blocks;
+	tiler.prepin = prepin_blocks;
 	tiler.analize = __analize_area;
 	tiler_geom_init(&tiler);
 	tiler_reserve_init(&tiler);
@@ -1633,25 +1815,32 @@ static s32 __init tiler_init(void)
 
 	/*
 	 * Array of physical pages for PAT programming, which must be a 16-byte
-	 * aligned physical address.
+	 * aligned physical address.  Leave room for aligning each area of a
+	 * batched refill.
 	 */
-	dmac_va = dma_alloc_coherent(NULL, tiler.width * tiler.height *
-					sizeof(*dmac_va), &dmac_pa, GFP_ATOMIC);
+	dmac_size = tiler.width * tiler.height + 4 * TMM_MAX_AREAS;
+	dmac_va = dma_alloc_coherent(NULL, dmac_size * sizeof(*dmac_va),
+					&dmac_pa, GFP_ATOMIC);
 	if (!dmac_va)
 		return -ENOMEM;
 
 	/* Allocate tiler container manager (we share 1 on OMAP4) */
 	div_pt.x = tiler.width;   /* hardcoded default */
 	div_pt.y = (3 * tiler.height) / 4;
-	sita = sita_init(tiler.width, tiler.height, (void *)&div_pt);
+	if (!strcmp(tcm_alg, "sita")) {
+		container = sita_init(tiler.width, tiler.height, &div_pt);
+	} else {
+		tcm_alg = "bita";
+		container = bita_init(tiler.width, tiler.height, &div_pt);
+	}
 
-	tcm[TILFMT_8BIT]  = sita;
-	tcm[TILFMT_16BIT] = sita;
-	tcm[TILFMT_32BIT] = sita;
-	tcm[TILFMT_PAGE]  = sita;
+	tcm[TILFMT_8BIT]  = container;
+	tcm[TILFMT_16BIT] = container;
+	tcm[TILFMT_32BIT] = container;
+	tcm[TILFMT_PAGE]  = container;
 
 	/* Allocate tiler memory manager (must have 1 unique TMM per TCM ) */
-	tmm_pat = tmm_pat_init(0, dmac_va, dmac_pa);
+	tmm_pat = tmm_pat_init(0, tiler.width * tiler.height);
 	tmm[TILFMT_8BIT]  = tmm_pat;
 	tmm[TILFMT_16BIT] = tmm_pat;
 	tmm[TILFMT_32BIT] = tmm_pat;
@@ -1666,7 +1855,7 @@ static s32 __init tiler_init(void)
 	tiler.nv12_packed = tcm[TILFMT_8BIT] == tcm[TILFMT_16BIT];
 #endif
 
-	if (!sita || !tmm_pat) {
+	if (!container || !tmm_pat) {
 		r = -ENOMEM;
 		goto error;
 	}
@@ -1725,6 +1914,9 @@ static s32 __init tiler_init(void)
 				dbg_map, (void *) (debugfs_maps + i),
 				&tiler_debug_fops);
 	}
+	if (!IS_ERR_OR_NULL(dbgfs))
+		debugfs_create_file(debugfs_stats.name, S_IRUGO, dbgfs,
+				(void *) &debugfs_stats, &tiler_debug_fops);
 
 error:
 	/* TODO: error handling for device registration */
@@ -1732,10 +1924,10 @@ error:
 #ifdef CONFIG_TILER_ENABLE_USERSPACE
 		kfree(tiler_device);
 #endif
-		tcm_deinit(sita);
+		tcm_deinit(container);
 		tmm_deinit(tmm_pat);
-		dma_free_coherent(NULL, tiler.width * tiler.height *
-					sizeof(*dmac_va), dmac_va, dmac_pa);
+		dma_free_coherent(NULL, dmac_size * sizeof(*dmac_va),
+					dmac_va, dmac_pa);
 	}
 
 	return r;
@@ -1759,8 +1951,8 @@ static void __exit tiler_exit(void)
 
 	mutex_unlock(&mtx);
 
-	dma_free_coherent(NULL, tiler.width * tiler.height * sizeof(*dmac_va),
-							dmac_va, dmac_pa);
+	dma_free_coherent(NULL, dmac_size * sizeof(*dmac_va), dmac_va,
+								dmac_pa);
 
 	/* close containers only once */
 	for (i = TILFMT_MIN; i <= TILFMT_MAX; i++) {
@@ -400,6 +400,7 @@ static void reserve_nv12(u32 n, u32 width, u32 height,
 		}
 	}
 
+	ops->prepin(&gi->reserved);
 	ops->release_gi(gi);
 }
 
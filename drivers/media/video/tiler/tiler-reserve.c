@@ -127,6 +127,7 @@ static void reserve_blocks(u32 n, enum tiler_fmt fmt, u32 width, u32 height,
 		}
 	}
 	/* keep reserved blocks even if failed to reserve all */
+	ops->prepin(&gi->reserved);
 
 	ops->release_gi(gi);
 }
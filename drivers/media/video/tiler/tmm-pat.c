@@ -23,6 +23,7 @@
 #include <linux/mutex.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/dma-mapping.h>
 
 #include "tmm.h"
 
@@ -61,10 +62,21 @@ struct fast {
 struct dmm_mem {
 	struct list_head fast_list;
 	struct dmm *dmm;
-	u32 *dmac_va;		/* coherent memory */
-	u32 dmac_pa;		/* phys.addr of coherent memory */
 	struct page *dummy_pg;	/* dummy page */
 	u32 dummy_pa;		/* phys.addr of dummy page */
+
+	/*
+	 * Coherent memory: PAT descriptors, followed by a page list with
+	 * only the dummy page, so that unpinning needs no page list of its
+	 * own and can finish in the background.
+	 */
+	struct mutex refill_mtx;	/* descriptors */
+	struct pat *desc;
+	u32 desc_pa;
+	u32 *dummy_list;
+	u32 dummy_list_pa;
+	u32 num_slots;		/* entries in dummy_list */
+	size_t size;		/* size of coherent memory */
 };
 
 /* read mem values for a param */
@@ -167,9 +179,12 @@ static void tmm_pat_deinit(struct tmm *tmm)
 	if (--refs == 0)
 		free_page_cache();
 
-	__free_page(pvt->dummy_pg);
-
 	mutex_unlock(&mtx);
+
+	/* an unpin may still be using the descriptors */
+	dmm_pat_sync(pvt->dmm);
+	dma_free_coherent(NULL, pvt->size, pvt->desc, pvt->desc_pa);
+	__free_page(pvt->dummy_pg);
 }
 
 static u32 *tmm_pat_get_pages(struct tmm *tmm, u32 n)
@@ -249,39 +264,102 @@ static void tmm_pat_free_pages(struct tmm *tmm, u32 *page_list)
 	mutex_unlock(&mtx);
 }
 
-static s32 tmm_pat_pin(struct tmm *tmm, struct pat_area area, u32 page_pa)
+/* (must have refill_mtx) set up descriptor i of a chain of n */
+static void set_desc(struct dmm_mem *pvt, u32 i, u32 n, struct pat_area area,
+		     u32 page_pa)
+{
+	struct pat *desc = pvt->desc + i;
+
+	memset(desc, 0, sizeof(*desc));
+	desc->area = area;
+	desc->ctrl.start = 1;
+	/* must be a 16-byte aligned physical address */
+	desc->data = page_pa;
+	/* the DMM follows physical addresses */
+	if (i + 1 < n)
+		desc->next = (struct pat *) (pvt->desc_pa +
+					     (i + 1) * sizeof(*desc));
+}
+
+/* (must have refill_mtx) descriptors are free once the last chain is done */
+static void sync_desc(struct dmm_mem *pvt)
+{
+	if (dmm_pat_sync(pvt->dmm))
+		printk(KERN_ERR "tmm_pat: PAT unpin failed\n");
+}
+
+static s32 tmm_pat_pin_areas(struct tmm *tmm, struct pat_area *areas, u32 n,
+			     u32 page_pa)
 {
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
-	struct pat pat_desc = {0};
+	s32 res;
+	u32 i;
 
-	/* send pat descriptor to dmm driver */
-	pat_desc.ctrl.dir = 0;
-	pat_desc.ctrl.ini = 0;
-	pat_desc.ctrl.lut_id = 0;
-	pat_desc.ctrl.start = 1;
-	pat_desc.ctrl.sync = 0;
-	pat_desc.area = area;
-	pat_desc.next = NULL;
+	if (WARN_ON(!n || n > TMM_MAX_AREAS))
+		return -EINVAL;
 
-	/* must be a 16-byte aligned physical address */
-	pat_desc.data = page_pa;
-	return dmm_pat_refill(pvt->dmm, &pat_desc, MANUAL);
+	mutex_lock(&pvt->refill_mtx);
+	sync_desc(pvt);
+
+	/* chain all areas, and wait for the chain once */
+	for (i = 0; i < n; i++) {
+		set_desc(pvt, i, n, areas[i], page_pa);
+		page_pa += tmm_area_entries(areas + i) * sizeof(u32);
+	}
+	res = dmm_pat_refill_async(pvt->dmm, pvt->desc, pvt->desc_pa);
+	if (!res)
+		res = dmm_pat_sync(pvt->dmm);
+
+	mutex_unlock(&pvt->refill_mtx);
+	return res;
+}
+
+static s32 tmm_pat_pin(struct tmm *tmm, struct pat_area area, u32 page_pa)
+{
+	return tmm_pat_pin_areas(tmm, &area, 1, page_pa);
 }
 
 static void tmm_pat_unpin(struct tmm *tmm, struct pat_area area)
 {
-	u16 w = (u8) area.x1 - (u8) area.x0;
-	u16 h = (u8) area.y1 - (u8) area.y0;
-	u16 i = (w + 1) * (h + 1);
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
 
-	while (i--)
-		pvt->dmac_va[i] = pvt->dummy_pa;
+	if (WARN_ON(tmm_area_entries(&area) > pvt->num_slots))
+		return;
+
+	/*
+	 * Nothing can use the area until it is pinned again, and the next
+	 * pin waits for this one.  So do not wait here.
+	 */
+	mutex_lock(&pvt->refill_mtx);
+	sync_desc(pvt);
+	set_desc(pvt, 0, 1, area, pvt->dummy_list_pa);
+	if (dmm_pat_refill_async(pvt->dmm, pvt->desc, pvt->desc_pa))
+		printk(KERN_ERR "tmm_pat: failed to start PAT unpin\n");
+	mutex_unlock(&pvt->refill_mtx);
+}
 
-	tmm_pat_pin(tmm, area, pvt->dmac_pa);
+/* allocate descriptors and the dummy page list */
+static s32 alloc_desc(struct dmm_mem *pvt, u32 num_slots)
+{
+	size_t desc_size = ALIGN(TMM_MAX_AREAS * sizeof(*pvt->desc), 16);
+	dma_addr_t pa;
+	u32 i;
+
+	pvt->num_slots = num_slots;
+	pvt->size = desc_size + num_slots * sizeof(*pvt->dummy_list);
+	pvt->desc = dma_alloc_coherent(NULL, pvt->size, &pa, GFP_KERNEL);
+	if (!pvt->desc)
+		return -ENOMEM;
+
+	pvt->desc_pa = pa;
+	pvt->dummy_list = (u32 *) ((u8 *) pvt->desc + desc_size);
+	pvt->dummy_list_pa = pvt->desc_pa + desc_size;
+	for (i = 0; i < num_slots; i++)
+		pvt->dummy_list[i] = pvt->dummy_pa;
+	return 0;
 }
 
-struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa)
+struct tmm *tmm_pat_init(u32 pat_id, u32 num_slots)
 {
 	struct tmm *tmm = NULL;
 	struct dmm_mem *pvt = NULL;
@@ -293,12 +371,15 @@ struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa)
 		pvt = kmalloc(sizeof(*pvt), GFP_KERNEL);
 	if (pvt)
 		pvt->dummy_pg = alloc_page(GFP_KERNEL | GFP_DMA);
-	if (pvt->dummy_pg) {
+	if (pvt && pvt->dummy_pg) {
 		/* private data */
 		pvt->dmm = dmm;
-		pvt->dmac_pa = dmac_pa;
-		pvt->dmac_va = dmac_va;
 		pvt->dummy_pa = page_to_phys(pvt->dummy_pg);
+		if (alloc_desc(pvt, num_slots)) {
+			__free_page(pvt->dummy_pg);
+			goto error;
+		}
+		mutex_init(&pvt->refill_mtx);
 
 		INIT_LIST_HEAD(&pvt->fast_list);
 
@@ -313,11 +394,13 @@ struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa)
 		tmm->get = tmm_pat_get_pages;
 		tmm->free = tmm_pat_free_pages;
 		tmm->pin = tmm_pat_pin;
+		tmm->pin_areas = tmm_pat_pin_areas;
 		tmm->unpin = tmm_pat_unpin;
 
 		return tmm;
 	}
 
+error:
 	kfree(pvt);
 	kfree(tmm);
 	dmm_pat_release(dmm);
@@ -40,6 +40,10 @@
 #define TMM_H
 
 #include <mach/dmm.h>
+
+/* maximum number of areas pinned with one tmm_pin_areas call */
+#define TMM_MAX_AREAS	32
+
 /**
  * TMM interface
  */
@@ -50,10 +54,23 @@ struct tmm {
 	u32 *(*get)	(struct tmm *tmm, u32 num_pages);
 	void (*free)	(struct tmm *tmm, u32 *pages);
 	s32  (*pin)	(struct tmm *tmm, struct pat_area area, u32 page_pa);
+	s32  (*pin_areas) (struct tmm *tmm, struct pat_area *areas, u32 n,
+			   u32 page_pa);
 	void (*unpin)	(struct tmm *tmm, struct pat_area area);
 	void (*deinit)	(struct tmm *tmm);
 };
 
+/**
+ * Number of page address entries an area uses in a list passed to
+ * tmm_pin_areas.  Each area's entries start 16-byte aligned.
+ */
+static inline
+u32 tmm_area_entries(struct pat_area *area)
+{
+	return ALIGN(((u8) area->x1 - (u8) area->x0 + 1) *
+		     ((u8) area->y1 - (u8) area->y0 + 1), 4);
+}
+
 /**
  * Request a set of pages from the DMM free page stack.
  * @return a pointer to a list of physical page addresses.
@@ -91,7 +108,30 @@ s32 tmm_pin(struct tmm *tmm, struct pat_area area, u32 page_pa)
 }
 
 /**
- * Clears the physical address translator.
+ * Program the physical address translator for several areas at once.
+ * @param areas PAT areas
+ * @param n number of areas (at most TMM_MAX_AREAS)
+ * @param page_pa list of pages for all areas, see tmm_area_entries
+ */
+static inline
+s32 tmm_pin_areas(struct tmm *tmm, struct pat_area *areas, u32 n,
+		  u32 page_pa)
+{
+	s32 res = 0;
+
+	if (tmm && tmm->pin_areas && tmm->pvt)
+		return tmm->pin_areas(tmm, areas, n, page_pa);
+
+	while (n-- && !res) {
+		res = tmm_pin(tmm, *areas, page_pa);
+		page_pa += tmm_area_entries(areas++) * sizeof(u32);
+	}
+	return res;
+}
+
+/**
+ * Clears the physical address translator.  This may complete
+ * asynchronously, but before any later pin of the same tmm.
  * @param area PAT area
  */
 static inline
@@ -125,6 +165,6 @@ void tmm_deinit(struct tmm *tmm)
  *
  * Initialize TMM for PAT with given id.
  */
-struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa);
+struct tmm *tmm_pat_init(u32 pat_id, u32 num_slots);
 
 #endif
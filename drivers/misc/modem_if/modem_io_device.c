@@ -26,6 +26,7 @@
 #include <linux/etherdevice.h>
 #include <linux/ratelimit.h>
 #include <linux/device.h>
+#include <net/checksum.h>
 
 #include <linux/platform_data/modem.h>
 #include "modem_prj.h"
@@ -37,6 +38,7 @@
 #define SIZE_OF_HDLC_END	1
 #define MAX_RXDATA_SIZE		(4096 - 512)
 #define MAX_MTU_TX_DATA_SIZE	1550
+#define VNET_NAPI_WEIGHT	64
 
 static const char hdlc_start[1] = { HDLC_START };
 static const char hdlc_end[1] = { HDLC_END };
@@ -106,6 +108,24 @@ static ssize_t store_waketime(struct device *dev,
 static struct device_attribute attr_waketime =
 	__ATTR(waketime, S_IRUGO | S_IWUSR, show_waketime, store_waketime);
 
+static ssize_t show_napi_stats(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct vnet *vnet = netdev_priv(to_net_dev(dev));
+	unsigned long per_poll = 0;
+
+	if (vnet->polls)
+		per_poll = vnet->poll_packets * 100 / vnet->polls;
+
+	return sprintf(buf, "polls : %lu, packets : %lu, packets/poll : "
+			"%lu.%02lu, full polls : %lu\n", vnet->polls,
+			vnet->poll_packets, per_poll / 100, per_poll % 100,
+			vnet->poll_full);
+}
+
+static struct device_attribute attr_napi_stats =
+	__ATTR(napi_stats, S_IRUGO, show_napi_stats, NULL);
+
 static int get_header_size(struct io_device *iod)
 {
 	switch (iod->format) {
@@ -307,7 +327,15 @@ static int rx_hdlc_data_check(struct io_device *iod, char *buf, unsigned rest)
 	while (rest > 0) {
 		len = min(rest,  alloc_size - skb->len);
 		len = min(len, rest_len);
-		memcpy(skb_put(skb, len), buf, len);
+		if (iod->format == IPC_MULTI_RAW) {
+			/* checksum packet data on the way in, for GRO */
+			skb->csum = csum_block_add(skb->csum,
+				csum_partial_copy_nocheck(buf,
+					skb_put(skb, len), len, 0),
+				skb->len - len);
+		} else {
+			memcpy(skb_put(skb, len), buf, len);
+		}
 		buf += len;
 		done_len += len;
 		hdr->flag_len += len;
@@ -332,7 +360,6 @@ static int rx_hdlc_data_check(struct io_device *iod, char *buf, unsigned rest)
 
 static int rx_iodev_skb_raw(struct io_device *iod)
 {
-	int err;
 	struct sk_buff *skb = iod->skb_recv;
 	struct net_device *ndev;
 	struct iphdr *ip_header;
@@ -350,9 +377,16 @@ static int rx_iodev_skb_raw(struct io_device *iod)
 		if (!ndev)
 			return NET_RX_DROP;
 
+		if (!netif_running(ndev)) {
+			ndev->stats.rx_dropped++;
+			return -ENETDOWN;
+		}
+
+		/* the poll routine is behind, retry later */
+		if (skb_queue_len(&iod->sk_rx_q) >= netdev_max_backlog)
+			return NET_RX_DROP;
+
 		skb->dev = ndev;
-		ndev->stats.rx_packets++;
-		ndev->stats.rx_bytes += skb->len;
 
 		/* check the version of IP */
 		ip_header = (struct iphdr *)skb->data;
@@ -368,16 +402,25 @@ static int rx_iodev_skb_raw(struct io_device *iod)
 			memcpy(ehdr->h_dest, ndev->dev_addr, ETH_ALEN);
 			memcpy(ehdr->h_source, source, ETH_ALEN);
 			ehdr->h_proto = skb->protocol;
-			skb->ip_summed = CHECKSUM_NONE;
 			skb_reset_mac_header(skb);
 
 			skb_pull(skb, sizeof(struct ethhdr));
 		}
 
-		err = netif_rx_ni(skb);
-		if (err != NET_RX_SUCCESS)
-			dev_err(&ndev->dev, "rx error: %d\n", err);
-		return err;
+		/*
+		 * skb->csum covers the whole IP packet. A valid IPv4 header
+		 * sums to zero, so that is also the transport checksum the
+		 * stack and GRO expect; IPv6 has no such luck.
+		 */
+		if (skb->protocol == htons(ETH_P_IP))
+			skb->ip_summed = CHECKSUM_COMPLETE;
+		else
+			skb->ip_summed = CHECKSUM_NONE;
+
+		/* hand it to the poll routine, which runs when bh is enabled */
+		skb_queue_tail(&iod->sk_rx_q, skb);
+		napi_schedule(&((struct vnet *)netdev_priv(ndev))->napi);
+		return NET_RX_SUCCESS;
 
 	default:
 		pr_err("[MODEM_IF] wrong io_type : %d\n", iod->io_typ);
@@ -387,30 +430,37 @@ static int rx_iodev_skb_raw(struct io_device *iod)
 
 static void rx_iodev_work(struct work_struct *work)
 {
-	int ret;
+	int ret, budget;
 	struct sk_buff *skb;
 	struct io_device *real_iod;
 	struct io_device *iod = container_of(work, struct io_device,
 				rx_work.work);
 
-	skb = skb_dequeue(&iod->sk_rx_q);
-	while (skb) {
-		real_iod = *((struct io_device **)skb->cb);
-		real_iod->skb_recv = skb;
-
-		ret = rx_iodev_skb_raw(real_iod);
-		if (ret == NET_RX_DROP) {
-			pr_err("[MODEM_IF] %s: queue delayed work!\n",
-								__func__);
-			skb_queue_head(&iod->sk_rx_q, skb);
-			schedule_delayed_work(&iod->rx_work,
+	/*
+	 * Let net devices collect a NAPI weight worth of packets before they
+	 * are polled, then open bh so the poll can drain them.
+	 */
+	do {
+		budget = VNET_NAPI_WEIGHT;
+		local_bh_disable();
+
+		while (budget-- && (skb = skb_dequeue(&iod->sk_rx_q))) {
+			real_iod = *((struct io_device **)skb->cb);
+			real_iod->skb_recv = skb;
+
+			ret = rx_iodev_skb_raw(real_iod);
+			if (ret == NET_RX_DROP) {
+				skb_queue_head(&iod->sk_rx_q, skb);
+				local_bh_enable();
+				schedule_delayed_work(&iod->rx_work,
 						msecs_to_jiffies(20));
-			break;
-		} else if (ret < 0 && skb)
-			dev_kfree_skb_any(skb);
+				return;
+			} else if (ret < 0 && skb)
+				dev_kfree_skb_any(skb);
+		}
 
-		skb = skb_dequeue(&iod->sk_rx_q);
-	}
+		local_bh_enable();
+	} while (budget < 0);
 }
 
 /* hadling modem initiated loopback packet
@@ -945,6 +995,7 @@ static const struct file_operations misc_io_fops = {
 static int vnet_open(struct net_device *ndev)
 {
 	struct vnet *vnet = netdev_priv(ndev);
+	napi_enable(&vnet->napi);
 	netif_start_queue(ndev);
 	atomic_inc(&vnet->iod->opened);
 	return 0;
@@ -955,9 +1006,45 @@ static int vnet_stop(struct net_device *ndev)
 	struct vnet *vnet = netdev_priv(ndev);
 	atomic_dec(&vnet->iod->opened);
 	netif_stop_queue(ndev);
+	napi_disable(&vnet->napi);
+	skb_queue_purge(&vnet->iod->sk_rx_q);
 	return 0;
 }
 
+/* feeds the packets rx_iodev_skb_raw() queued up to GRO */
+static int vnet_poll(struct napi_struct *napi, int budget)
+{
+	struct vnet *vnet = container_of(napi, struct vnet, napi);
+	struct net_device *ndev = napi->dev;
+	struct sk_buff *skb;
+	int done = 0;
+
+	while (done < budget) {
+		skb = skb_dequeue(&vnet->iod->sk_rx_q);
+		if (!skb)
+			break;
+
+		ndev->stats.rx_packets++;
+		ndev->stats.rx_bytes += skb->len;
+		napi_gro_receive(napi, skb);
+		done++;
+	}
+
+	vnet->polls++;
+	vnet->poll_packets += done;
+
+	if (done < budget) {
+		napi_complete(napi);
+		/* catch what was queued after the last dequeue */
+		if (!skb_queue_empty(&vnet->iod->sk_rx_q))
+			napi_schedule(napi);
+	} else {
+		vnet->poll_full++;
+	}
+
+	return done;
+}
+
 static int vnet_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
 	int ret;
@@ -1067,18 +1154,28 @@ int init_io_device(struct io_device *iod)
 
 	case IODEV_NET:
 		if (iod->net_typ == UMTS_NETWORK)
-			iod->ndev = alloc_netdev(0, iod->name, vnet_setup);
+			iod->ndev = alloc_netdev(sizeof(struct vnet), iod->name,
+						vnet_setup);
 		else
-			iod->ndev = alloc_netdev(0, iod->name,
+			iod->ndev = alloc_netdev(sizeof(struct vnet), iod->name,
 						vnet_setup_ether);
 		if (!iod->ndev) {
 			pr_err("failed to alloc netdev\n");
 			return -ENOMEM;
 		}
 
+		skb_queue_head_init(&iod->sk_rx_q);
+		vnet = netdev_priv(iod->ndev);
+		netif_napi_add(iod->ndev, &vnet->napi, vnet_poll,
+							VNET_NAPI_WEIGHT);
+
 		ret = register_netdev(iod->ndev);
 		if (ret)
 			free_netdev(iod->ndev);
+		else if (device_create_file(&iod->ndev->dev,
+					&attr_napi_stats))
+			pr_err("failed to create sysfs file : %s\n",
+							iod->name);
 
 		pr_debug("%s: %d(iod:0x%p)\n", __func__, __LINE__, iod);
 		vnet = netdev_priv(iod->ndev);
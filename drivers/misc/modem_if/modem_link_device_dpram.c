@@ -131,6 +131,10 @@ static inline void dpram_writeb(u8 value,  void __iomem *p_dest)
 static void dpram_write_command(struct dpram_link_device *dpld, u16 cmd)
 {
 	dpram_writeh(cmd, &dpld->dpram->mbx_ap2cp);
+#ifdef CONFIG_CDMA_LINK_DPRAM_LOOPBACK
+	if (INT_VALID(cmd) && !INT_CMD_VALID(cmd))
+		schedule_work(&dpld->loopback_work);
+#endif
 }
 
 static void dpram_clear_interrupt(struct dpram_link_device *dpld)
@@ -574,16 +578,38 @@ static int dpram_attach_io_dev(struct link_device *ld, struct io_device *iod)
 	return 0;
 }
 
-static int dpram_write(struct dpram_link_device *dpld,
-			struct dpram_device *device,
-			const unsigned char *buf,
-			int len)
+/* copies len bytes into the out queue of device at head, wrapping around */
+static void dpram_copy_to_circ(struct dpram_device *device, u16 head,
+			       const unsigned char *buf, int len)
 {
-	u16 head;
+	int last_size = device->out_buff_size - head;
+
+	if (len <= last_size) {
+		/* +++++++++ head ---------- tail ++++++++++ */
+		memcpy((device->out_buff_addr + head), buf, len);
+	} else {
+		/* ------ tail +++++++++++ head ------------ */
+		memcpy((device->out_buff_addr + head), buf, last_size);
+		memcpy(device->out_buff_addr, (buf + last_size),
+			(len - last_size));
+	}
+}
+
+/*
+ * Moves as many frames of txq as fit into the out queue of device, and
+ * publishes them with a single head update. The CP is not told here: the
+ * send bit of the device is added to irq_mask for the caller to raise one
+ * interrupt for everything it wrote.
+ */
+static int dpram_write_batch(struct dpram_link_device *dpld,
+			     struct dpram_device *device,
+			     struct sk_buff_head *txq, u16 *irq_mask)
+{
+	struct sk_buff *skb;
+	u16 head, start;
 	u16 tail;
-	u16 irq_mask;
 	int free_space;
-	int last_size;
+	int ret = 0;
 
 	head = dpram_readh(&device->out->head);
 	tail = dpram_readh(&device->out->tail);
@@ -596,42 +622,36 @@ static int dpram_write(struct dpram_link_device *dpld,
 
 	free_space = (head < tail) ? tail - head - 1 :
 			device->out_buff_size + tail - head - 1;
-	if (len > free_space) {
-		pr_debug("WRITE: No space in Q\n"
-			 "len[%d] free_space[%d] head[%u] tail[%u] out_buff_size =%d\n",
-			 len, free_space, head, tail, device->out_buff_size);
-		return -EINVAL;
-	}
-
-	pr_debug("WRITE: len[%d] free_space[%d] head[%u] tail[%u] out_buff_size =%d\n",
-			len, free_space, head, tail, device->out_buff_size);
-
-	if (head < tail) {
-		/* +++++++++ head ---------- tail ++++++++++ */
-		memcpy((device->out_buff_addr + head), buf, len);
-	} else {
-		/* ------ tail +++++++++++ head ------------ */
-		last_size = device->out_buff_size - head;
-		memcpy((device->out_buff_addr + head), buf,
-			len > last_size ? last_size : len);
-		if (len > last_size) {
-			memcpy(device->out_buff_addr, (buf + last_size),
-				(len - last_size));
+	start = head;
+
+	while ((skb = skb_dequeue(txq))) {
+		if (skb->len > free_space) {
+			pr_debug("WRITE: No space in Q\n"
+				 "len[%d] free_space[%d] head[%u] tail[%u] out_buff_size =%d\n",
+				 skb->len, free_space, head, tail,
+				 device->out_buff_size);
+			skb_queue_head(txq, skb);
+			ret = -ENOSPC;
+			break;
 		}
-	}
 
-	/* Update new head */
-	head = (u16)((head + len) % device->out_buff_size);
-	dpram_writeh(head, &device->out->head);
+		pr_debug("WRITE: len[%d] free_space[%d] head[%u] tail[%u] out_buff_size =%d\n",
+			 skb->len, free_space, head, tail,
+			 device->out_buff_size);
 
-	irq_mask = INT_MASK_VALID;
-
-	if (len > 0)
-		irq_mask |= device->mask_send;
+		dpram_copy_to_circ(device, head, skb->data, skb->len);
+		head = (u16)((head + skb->len) % device->out_buff_size);
+		free_space -= skb->len;
+		dev_kfree_skb_any(skb);
+	}
 
-	dpram_write_command(dpld, irq_mask);
+	if (head != start) {
+		/* Update new head */
+		dpram_writeh(head, &device->out->head);
+		*irq_mask |= device->mask_send;
+	}
 
-	return len;
+	return ret;
 }
 
 static void dpram_write_work(struct work_struct *work)
@@ -639,32 +659,20 @@ static void dpram_write_work(struct work_struct *work)
 	struct link_device *ld =
 		container_of(work, struct link_device, tx_delayed_work.work);
 	struct dpram_link_device *dpld = to_dpram_link_device(ld);
-	struct dpram_device *device;
-	struct sk_buff *skb;
 	bool reschedule = false;
-	int ret;
+	u16 irq_mask = 0;
 
-	device = &dpld->dev_map[FMT_IDX];
-	while ((skb = skb_dequeue(&ld->sk_fmt_tx_q))) {
-		ret = dpram_write(dpld, device, skb->data, skb->len);
-		if (ret < 0) {
-			skb_queue_head(&ld->sk_fmt_tx_q, skb);
-			reschedule = true;
-			break;
-		}
-		dev_kfree_skb_any(skb);
-	}
+	if (dpram_write_batch(dpld, &dpld->dev_map[FMT_IDX],
+			      &ld->sk_fmt_tx_q, &irq_mask) < 0)
+		reschedule = true;
 
-	device = &dpld->dev_map[RAW_IDX];
-	while ((skb = skb_dequeue(&ld->sk_raw_tx_q))) {
-		ret = dpram_write(dpld, device, skb->data, skb->len);
-		if (ret < 0) {
-			skb_queue_head(&ld->sk_raw_tx_q, skb);
-			reschedule = true;
-			break;
-		}
-		dev_kfree_skb_any(skb);
-	}
+	if (dpram_write_batch(dpld, &dpld->dev_map[RAW_IDX],
+			      &ld->sk_raw_tx_q, &irq_mask) < 0)
+		reschedule = true;
+
+	/* one interrupt for all the frames of both queues */
+	if (irq_mask)
+		dpram_write_command(dpld, INT_NON_CMD(irq_mask));
 
 	if (reschedule)
 		schedule_delayed_work(&ld->tx_delayed_work,
@@ -929,6 +937,98 @@ err_out:
 	return -EIO;
 }
 
+#ifdef CONFIG_CDMA_LINK_DPRAM_LOOPBACK
+/*
+ * Stand-in for the CP, to exercise the link without a modem: the DPRAM is
+ * plain memory, and whatever the AP puts in an out queue comes straight
+ * back on the matching in queue, along with the interrupt the CP would send.
+ */
+static int dpram_loopback_circ(struct dpram_device *device)
+{
+	u16 out_head = dpram_readh(&device->out->head);
+	u16 out_tail = dpram_readh(&device->out->tail);
+	u16 in_head = dpram_readh(&device->in->head);
+	u16 in_tail = dpram_readh(&device->in->tail);
+	int used, room, len, moved = 0;
+
+	used = (out_head >= out_tail) ? out_head - out_tail :
+			device->out_buff_size - out_tail + out_head;
+	room = (in_head < in_tail) ? in_tail - in_head - 1 :
+			device->in_buff_size + in_tail - in_head - 1;
+
+	while (used && room) {
+		len = min3(used, room,
+			   min(device->out_buff_size - out_tail,
+			       device->in_buff_size - in_head));
+		memcpy(device->in_buff_addr + in_head,
+		       device->out_buff_addr + out_tail, len);
+
+		out_tail = (u16)((out_tail + len) % device->out_buff_size);
+		in_head = (u16)((in_head + len) % device->in_buff_size);
+		used -= len;
+		room -= len;
+		moved += len;
+	}
+
+	if (moved) {
+		dpram_writeh(out_tail, &device->out->tail);
+		dpram_writeh(in_head, &device->in->head);
+	}
+
+	return moved;
+}
+
+static void dpram_loopback_work(struct work_struct *work)
+{
+	struct dpram_link_device *dpld =
+		container_of(work, struct dpram_link_device, loopback_work);
+	struct dpram_device *device;
+	u16 irq_mask;
+	int i;
+
+	do {
+		irq_mask = 0;
+		for (i = 0; i < MAX_IDX; i++) {
+			device = &dpld->dev_map[i];
+			if (dpram_loopback_circ(device))
+				irq_mask |= device->mask_send;
+		}
+
+		if (irq_mask) {
+			dpram_writeh(INT_NON_CMD(irq_mask),
+						&dpld->dpram->mbx_cp2ap);
+
+			/* received packets are handed to the stack from bh */
+			local_bh_disable();
+			dpram_irq_handler(dpld->irq, &dpld->ld);
+			local_bh_enable();
+		}
+	} while (irq_mask);
+}
+
+static int dpram_loopback_init(struct dpram_link_device *dpld)
+{
+	dpld->dpram = (struct dpram_map __force __iomem *)
+			kzalloc(sizeof(struct dpram_map), GFP_KERNEL);
+	if (!dpld->dpram)
+		return -ENOMEM;
+
+	INIT_WORK(&dpld->loopback_work, dpram_loopback_work);
+
+	dpram_table_init(dpld);
+
+	atomic_set(&dpld->raw_txq_req_ack_rcvd, 0);
+	atomic_set(&dpld->fmt_txq_req_ack_rcvd, 0);
+
+	dpram_writeh(DP_MAGIC_CODE, &dpld->dpram->magic);
+	dpram_writeh(1, &dpld->dpram->enable);
+
+	pr_info("[DPRAM] loopback device, no modem attached\n");
+
+	return 0;
+}
+#endif
+
 struct link_device *dpram_create_link_device(struct platform_device *pdev)
 {
 	int ret;
@@ -968,6 +1068,14 @@ struct link_device *dpram_create_link_device(struct platform_device *pdev)
 
 	dpld->clear_interrupt = dpram_clear_interrupt;
 
+#ifdef CONFIG_CDMA_LINK_DPRAM_LOOPBACK
+	if (dpram_loopback_init(dpld)) {
+		kfree(dpld);
+		return NULL;
+	}
+	return ld;
+#endif
+
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res) {
 		pr_err("[DPRAM] Failed to get mem region\n");
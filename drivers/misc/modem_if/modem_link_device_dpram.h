@@ -106,6 +106,11 @@ struct dpram_link_device {
 
 	int irq;
 	void (*clear_interrupt)(struct dpram_link_device *);
+
+#ifdef CONFIG_CDMA_LINK_DPRAM_LOOPBACK
+	/* runs the CP stand-in after each AP to CP interrupt */
+	struct work_struct loopback_work;
+#endif
 };
 
 /* converts from struct link_device* to struct xxx_link_device* */
@@ -19,6 +19,7 @@
 #include <linux/wait.h>
 #include <linux/miscdevice.h>
 #include <linux/skbuff.h>
+#include <linux/netdevice.h>
 #include <linux/wakelock.h>
 
 
@@ -104,6 +105,12 @@ struct dpram_firmware {
 
 struct vnet {
 	struct io_device *iod;
+	struct napi_struct napi;
+
+	/* rx poll counters */
+	unsigned long polls;
+	unsigned long poll_packets;
+	unsigned long poll_full;
 };
 
 struct io_device {
@@ -41,6 +41,8 @@
 #include <linux/mmc/mmc.h>
 #include <linux/mmc/sd.h>
 
+#include <trace/events/mmc.h>
+
 #include <asm/system.h>
 #include <asm/uaccess.h>
 
@@ -959,6 +961,9 @@ static int mmc_blk_err_check(struct mmc_card *card,
 		 * max timeout is up to 300ms
 		 */
 		u32 timeout = 0x30000;
+		unsigned int polls = 0;
+		ktime_t start = ktime_get();
+
 		do {
 			int err = get_card_status(card, &status, 5);
 			if (err) {
@@ -974,9 +979,12 @@ static int mmc_blk_err_check(struct mmc_card *card,
 			/* Just SDcard case, decrease timeout */
 			if (mmc_card_sd(card))
 				timeout--;
+			polls++;
 		} while ((!(status & R1_READY_FOR_DATA) ||
 			 (R1_CURRENT_STATE(status) == R1_STATE_PRG)) &&
 			 timeout);
+		trace_mmc_blk_status_poll(req, polls,
+					  ktime_us_delta(ktime_get(), start));
 
 		/* If SDcard stays busy status, timeout is to be zero */
 		if (!timeout) {
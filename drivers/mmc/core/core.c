@@ -30,6 +30,9 @@
 #include <linux/mmc/mmc.h>
 #include <linux/mmc/sd.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/mmc.h>
+
 #include "core.h"
 #include "bus.h"
 #include "host.h"
@@ -39,6 +42,10 @@
 #include "sd_ops.h"
 #include "sdio_ops.h"
 
+/* fired by the block driver, which lives in its own module */
+EXPORT_TRACEPOINT_SYMBOL_GPL(mmc_blk_queue);
+EXPORT_TRACEPOINT_SYMBOL_GPL(mmc_blk_status_poll);
+
 static struct workqueue_struct *workqueue;
 
 /*
@@ -110,6 +117,7 @@ void mmc_request_done(struct mmc_host *host, struct mmc_request *mrq)
 		host->ops->request(host, mrq);
 	} else {
 		led_trigger_event(host->led, LED_OFF);
+		trace_mmc_request_complete(host, mrq);
 
 		pr_debug("%s: req done (CMD%u): %d: %08x %08x %08x %08x\n",
 			mmc_hostname(host), cmd->opcode, err,
@@ -194,6 +202,7 @@ mmc_start_request(struct mmc_host *host, struct mmc_request *mrq)
 	}
 	mmc_host_clk_hold(host);
 	led_trigger_event(host->led, LED_FULL);
+	trace_mmc_request_issue(host, mrq);
 	host->ops->request(host, mrq);
 }
 
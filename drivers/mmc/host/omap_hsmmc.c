@@ -130,6 +130,8 @@
 #define DMA_TABLE_NUM_ENTRIES	2048
 #define ADMA_TABLE_SZ	\
 	(DMA_TABLE_NUM_ENTRIES * sizeof(struct adma_desc_table))
+/* one table for the request in flight, one for the next */
+#define ADMA_TABLES	2
 
 #define SDMA_XFER	1
 #define ADMA_XFER	2
@@ -188,6 +190,16 @@ struct adma_desc_table {
 	dma_addr_t addr;
 };
 
+/*
+ * The sg mapping and ADMA table pre_req prepared for the request after the
+ * one in flight.
+ */
+struct omap_hsmmc_next {
+	unsigned int		dma_len;
+	s32			cookie;
+	int			table;
+};
+
 struct omap_hsmmc_host {
 	struct	device		*dev;
 	struct	mmc_host	*mmc;
@@ -223,6 +235,9 @@ struct omap_hsmmc_host {
 	int			dma_type, dma_ch;
 	struct adma_desc_table	*adma_table;
 	dma_addr_t		phy_adma_table;
+	int			adma_idx;	/* table of the current request */
+	s32			cur_cookie;
+	struct omap_hsmmc_next	next_data;
 	int			dma_line_tx, dma_line_rx;
 	int			slot_id;
 	int			got_dbclk;
@@ -1057,7 +1072,7 @@ omap_hsmmc_xfer_done(struct omap_hsmmc_host *host, struct mmc_data *data)
 
 	host->data = NULL;
 
-	if (host->dma_type == ADMA_XFER)
+	if (host->dma_type == ADMA_XFER && !data->host_cookie)
 		dma_unmap_sg(mmc_dev(host->mmc), data->sg, host->dma_len,
 					omap_hsmmc_get_dma_dir(host, data));
 
@@ -1160,9 +1175,10 @@ static void omap_hsmmc_dma_cleanup(struct omap_hsmmc_host *host, int errno)
 	spin_unlock(&host->irq_lock);
 
 	if ((host->dma_type == SDMA_XFER) && (dma_ch != -1)) {
-		dma_unmap_sg(mmc_dev(host->mmc), host->data->sg,
-			host->data->sg_len,
-			omap_hsmmc_get_dma_dir(host, host->data));
+		if (!host->data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), host->data->sg,
+				host->data->sg_len,
+				omap_hsmmc_get_dma_dir(host, host->data));
 		omap_free_dma(dma_ch);
 	}
 	host->data = NULL;
@@ -1627,8 +1643,9 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 		return;
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-		omap_hsmmc_get_dma_dir(host, data));
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			omap_hsmmc_get_dma_dir(host, data));
 
 	req_in_progress = host->req_in_progress;
 	dma_ch = host->dma_ch;
@@ -1646,62 +1663,16 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 	}
 }
 
-/*
- * Routine to configure and start DMA for the MMC card
- */
-static int omap_hsmmc_start_sdma_transfer(struct omap_hsmmc_host *host,
-					struct mmc_request *req)
-{
-	int dma_ch = 0, ret = 0, i;
-	struct mmc_data *data = req->data;
-
-	/* Sanity check: all the SG entries must be aligned by block size. */
-	for (i = 0; i < data->sg_len; i++) {
-		struct scatterlist *sgl;
-
-		sgl = data->sg + i;
-		if (sgl->length % data->blksz)
-			return -EINVAL;
-	}
-	if ((data->blksz % 4) != 0)
-		/* REVISIT: The MMC buffer increments only when MSB is written.
-		 * Return error for blksz which is non multiple of four.
-		 */
-		return -EINVAL;
-
-	BUG_ON(host->dma_ch != -1);
-
-	ret = omap_request_dma(omap_hsmmc_get_dma_sync_dev(host, data),
-			       "MMC/SD", omap_hsmmc_dma_cb, host, &dma_ch);
-	if (ret != 0) {
-		dev_err(mmc_dev(host->mmc),
-			"%s: omap_request_dma() failed with %d\n",
-			mmc_hostname(host->mmc), ret);
-		return ret;
-	}
-
-	host->dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
-			data->sg_len, omap_hsmmc_get_dma_dir(host, data));
-	host->dma_ch = dma_ch;
-	host->dma_sg_idx = 0;
-
-	omap_hsmmc_config_dma_params(host, data, data->sg);
-
-	return 0;
-}
-
 static int mmc_populate_adma_desc_table(struct omap_hsmmc_host *host,
-		struct mmc_request *req, struct adma_desc_table *pdesc)
+		struct mmc_data *data, unsigned int dma_len,
+		struct adma_desc_table *pdesc)
 {
 	int i, j, dmalen;
 	int splitseg, xferaddr;
 	int numblocks = 0;
 	dma_addr_t dmaaddr;
-	struct mmc_data *data = req->data;
 
-	host->dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
-			data->sg_len, omap_hsmmc_get_dma_dir(host, data));
-	for (i = 0, j = 0; i < host->dma_len; i++) {
+	for (i = 0, j = 0; i < dma_len; i++) {
 		dmaaddr = sg_dma_address(data->sg + i);
 		dmalen = sg_dma_len(data->sg + i);
 		numblocks += dmalen / data->blksz;
@@ -1739,14 +1710,117 @@ static int mmc_populate_adma_desc_table(struct omap_hsmmc_host *host,
 	WARN_ON((i + j - 1) > DMA_TABLE_NUM_ENTRIES);
 	dev_dbg(mmc_dev(host->mmc),
 		"ADMA table has %d entries from %d sglist\n",
-		i + j, host->dma_len);
+		i + j, dma_len);
 	return numblocks;
 }
 
+/*
+ * Maps the data of a request and, for ADMA, builds its descriptor table.
+ * With 'next' this is pre_req preparing the request after the one in
+ * flight, which goes in the table the controller is not using; otherwise
+ * it is the request being started, which uses whatever pre_req prepared.
+ */
+static int omap_hsmmc_pre_dma_transfer(struct omap_hsmmc_host *host,
+				       struct mmc_data *data,
+				       struct omap_hsmmc_next *next)
+{
+	unsigned int dma_len;
+	int numblks, table;
+
+	if (!next && data->host_cookie) {
+		/* restarted by the core, mapping and table are still good */
+		if (data->host_cookie == host->cur_cookie)
+			return 0;
+
+		if (data->host_cookie == host->next_data.cookie) {
+			host->dma_len = host->next_data.dma_len;
+			host->adma_idx = host->next_data.table;
+			host->cur_cookie = data->host_cookie;
+			host->next_data.dma_len = 0;
+			return 0;
+		}
+
+		dev_warn(mmc_dev(host->mmc), "invalid cookie %d, expected %d\n",
+			 data->host_cookie, host->next_data.cookie);
+		data->host_cookie = 0;
+	}
+
+	dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     omap_hsmmc_get_dma_dir(host, data));
+	if (!dma_len)
+		return -EINVAL;
+
+	table = next ? !host->adma_idx : host->adma_idx;
+	if (host->dma_type == ADMA_XFER) {
+		numblks = mmc_populate_adma_desc_table(host, data, dma_len,
+				host->adma_table + table * DMA_TABLE_NUM_ENTRIES);
+		WARN_ON(numblks != data->blocks);
+	}
+
+	if (next) {
+		next->dma_len = dma_len;
+		next->table = table;
+		if (++next->cookie < 0)
+			next->cookie = 1;
+		data->host_cookie = next->cookie;
+	} else
+		host->dma_len = dma_len;
+
+	return 0;
+}
+
+/*
+ * Routine to configure and start DMA for the MMC card
+ */
+static int omap_hsmmc_start_sdma_transfer(struct omap_hsmmc_host *host,
+					struct mmc_request *req)
+{
+	int dma_ch = 0, ret = 0, i;
+	struct mmc_data *data = req->data;
+
+	/* Sanity check: all the SG entries must be aligned by block size. */
+	for (i = 0; i < data->sg_len; i++) {
+		struct scatterlist *sgl;
+
+		sgl = data->sg + i;
+		if (sgl->length % data->blksz)
+			return -EINVAL;
+	}
+	if ((data->blksz % 4) != 0)
+		/* REVISIT: The MMC buffer increments only when MSB is written.
+		 * Return error for blksz which is non multiple of four.
+		 */
+		return -EINVAL;
+
+	BUG_ON(host->dma_ch != -1);
+
+	ret = omap_request_dma(omap_hsmmc_get_dma_sync_dev(host, data),
+			       "MMC/SD", omap_hsmmc_dma_cb, host, &dma_ch);
+	if (ret != 0) {
+		dev_err(mmc_dev(host->mmc),
+			"%s: omap_request_dma() failed with %d\n",
+			mmc_hostname(host->mmc), ret);
+		return ret;
+	}
+
+	ret = omap_hsmmc_pre_dma_transfer(host, data, NULL);
+	if (ret) {
+		omap_free_dma(dma_ch);
+		return ret;
+	}
+	host->dma_ch = dma_ch;
+	host->dma_sg_idx = 0;
+
+	omap_hsmmc_config_dma_params(host, data, data->sg);
+
+	return 0;
+}
+
 static void omap_hsmmc_start_adma_transfer(struct omap_hsmmc_host *host)
 {
 	wmb();
-	OMAP_HSMMC_WRITE(host->base, ADMA_SAL, host->phy_adma_table);
+	OMAP_HSMMC_WRITE(host->base, ADMA_SAL,
+			 host->phy_adma_table + host->adma_idx * ADMA_TABLE_SZ);
 }
 
 static void set_data_timeout(struct omap_hsmmc_host *host,
@@ -1793,7 +1867,6 @@ static int
 omap_hsmmc_prepare_data(struct omap_hsmmc_host *host, struct mmc_request *req)
 {
 	int ret;
-	int numblks;
 	host->data = req->data;
 
 	if (req->data == NULL) {
@@ -1818,9 +1891,9 @@ omap_hsmmc_prepare_data(struct omap_hsmmc_host *host, struct mmc_request *req)
 			return ret;
 		}
 	} else if (host->dma_type == ADMA_XFER) {
-		numblks = mmc_populate_adma_desc_table(host,
-				req, host->adma_table);
-		WARN_ON(numblks != req->data->blocks);
+		ret = omap_hsmmc_pre_dma_transfer(host, req->data, NULL);
+		if (ret != 0)
+			return ret;
 		omap_hsmmc_start_adma_transfer(host);
 	}
 	return 0;
@@ -2405,9 +2478,42 @@ static void omap_hsmmc_timeout_irq(unsigned long data)
 }
 #endif
 
+static void omap_hsmmc_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+				int err)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (data && data->host_cookie) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     omap_hsmmc_get_dma_dir(host, data));
+		data->host_cookie = 0;
+	}
+}
+
+static void omap_hsmmc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			       bool is_first_req)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie = 0;
+		return;
+	}
+
+	if (omap_hsmmc_pre_dma_transfer(host, data, &host->next_data))
+		data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops omap_hsmmc_ops = {
 	.enable = omap_hsmmc_enable_simple,
 	.disable = omap_hsmmc_disable_simple,
+	.post_req = omap_hsmmc_post_req,
+	.pre_req = omap_hsmmc_pre_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -2419,6 +2525,8 @@ static const struct mmc_host_ops omap_hsmmc_ops = {
 static const struct mmc_host_ops omap_hsmmc_ps_ops = {
 	.enable = omap_hsmmc_enable,
 	.disable = omap_hsmmc_disable,
+	.post_req = omap_hsmmc_post_req,
+	.pre_req = omap_hsmmc_pre_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -2652,7 +2760,8 @@ static int __init omap_hsmmc_probe(struct platform_device *pdev)
 			 * due to unset conherency mask
 			 */
 			host->adma_table = dma_alloc_coherent(NULL,
-				ADMA_TABLE_SZ, &host->phy_adma_table, 0);
+				ADMA_TABLES * ADMA_TABLE_SZ,
+				&host->phy_adma_table, 0);
 			if (host->adma_table != NULL)
 				host->dma_type = ADMA_XFER;
 			}
@@ -2841,7 +2950,7 @@ err_irq:
 	}
 err1:
 	if (host->adma_table != NULL)
-		dma_free_coherent(NULL, ADMA_TABLE_SZ,
+		dma_free_coherent(NULL, ADMA_TABLES * ADMA_TABLE_SZ,
 			host->adma_table, host->phy_adma_table);
 	iounmap(host->base);
 err_ioremap:
@@ -2872,7 +2981,7 @@ static int omap_hsmmc_remove(struct platform_device *pdev)
 		flush_work_sync(&host->mmc_carddetect_work);
 
 		if (host->adma_table != NULL)
-			dma_free_coherent(NULL, ADMA_TABLE_SZ,
+			dma_free_coherent(NULL, ADMA_TABLES * ADMA_TABLE_SZ,
 				host->adma_table, host->phy_adma_table);
 
 		mmc_release_host(host->mmc);
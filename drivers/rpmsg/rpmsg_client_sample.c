@@ -19,17 +19,156 @@
 #include <linux/virtio.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
 #include <linux/rpmsg.h>
 
 #define MSG		("hello world!")
 #define MSG_LIMIT	100
 
+/*
+ * Throughput benchmark: with bench_msgs set, the probe starts sending that
+ * many messages of bench_size bytes instead of playing ping-pong, either
+ * copied (bench_copy) or built in place and sent bench_batch at a time.
+ * The sending runs from a work item: probe is called from the rx loop,
+ * which must keep consuming the echoes for tx buffers to come back.
+ */
+static int bench_msgs;
+module_param(bench_msgs, int, 0444);
+MODULE_PARM_DESC(bench_msgs, "number of messages to send in benchmark mode");
+
+static int bench_size = 64;
+module_param(bench_size, int, 0444);
+MODULE_PARM_DESC(bench_size, "payload size of the benchmark messages");
+
+static int bench_batch = 8;
+module_param(bench_batch, int, 0444);
+MODULE_PARM_DESC(bench_batch, "messages sent per kick in benchmark mode");
+
+static bool bench_copy;
+module_param(bench_copy, bool, 0444);
+MODULE_PARM_DESC(bench_copy, "benchmark the copying rpmsg_send() instead");
+
+static atomic_t bench_rx = ATOMIC_INIT(0);
+
+struct rpmsg_sample_bench {
+	struct work_struct work;
+	struct rpmsg_channel *rpdev;
+};
+
+static int rpmsg_sample_bench_copy(struct rpmsg_channel *rpdev, s64 *bytes)
+{
+	void *data;
+	int i, err = 0;
+
+	data = kzalloc(bench_size, GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	for (i = 0; i < bench_msgs && !err; i++)
+		err = rpmsg_send(rpdev, data, bench_size);
+	*bytes = (s64) bench_msgs * bench_size;
+
+	kfree(data);
+	return err;
+}
+
+/* payloads are clamped to what fits in a buffer, *bytes is what was sent */
+static int rpmsg_sample_bench_nocopy(struct rpmsg_channel *rpdev, s64 *bytes)
+{
+	struct rpmsg_tx_msg *msgs;
+	int sent, num, max, i, err = 0;
+
+	msgs = kcalloc(bench_batch, sizeof(*msgs), GFP_KERNEL);
+	if (!msgs)
+		return -ENOMEM;
+
+	for (sent = 0; sent < bench_msgs && !err; sent += num) {
+		num = min(bench_batch, bench_msgs - sent);
+
+		for (i = 0; i < num; i++) {
+			msgs[i].data = rpmsg_alloc_tx_buf(rpdev, &max, true);
+			if (IS_ERR(msgs[i].data)) {
+				err = PTR_ERR(msgs[i].data);
+				break;
+			}
+			msgs[i].dst = rpdev->dst;
+			msgs[i].len = min(bench_size, max);
+			memset(msgs[i].data, 0, msgs[i].len);
+			*bytes += msgs[i].len;
+		}
+
+		if (err) {
+			while (i--)
+				rpmsg_free_tx_buf(rpdev, msgs[i].data);
+			break;
+		}
+
+		/* this consumes the buffers, sent or not */
+		err = rpmsg_send_batch(rpdev, msgs, num);
+	}
+
+	kfree(msgs);
+	return err;
+}
+
+static int rpmsg_sample_bench(struct rpmsg_channel *rpdev)
+{
+	ktime_t start;
+	s64 us, bytes = 0;
+	int err;
+
+	if (bench_size < 0 || bench_batch < 1)
+		return -EINVAL;
+
+	start = ktime_get();
+	if (bench_copy)
+		err = rpmsg_sample_bench_copy(rpdev, &bytes);
+	else
+		err = rpmsg_sample_bench_nocopy(rpdev, &bytes);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	if (err) {
+		dev_err(&rpdev->dev, "benchmark failed: %d\n", err);
+		return err;
+	}
+
+	if (!us)
+		us = 1;
+
+	dev_info(&rpdev->dev,
+		"%s: %d msgs, %lld bytes in %lld us: %lld msgs/s, %lld KB/s\n",
+		bench_copy ? "copy" : "nocopy", bench_msgs, bytes, us,
+		div64_s64((s64) bench_msgs * USEC_PER_SEC, us),
+		div64_s64(bytes * USEC_PER_SEC, us * 1024));
+
+	return 0;
+}
+
+static void rpmsg_sample_bench_work(struct work_struct *work)
+{
+	struct rpmsg_sample_bench *bench =
+		container_of(work, struct rpmsg_sample_bench, work);
+
+	rpmsg_sample_bench(bench->rpdev);
+}
+
 static void rpmsg_sample_cb(struct rpmsg_channel *rpdev, void *data, int len,
 						void *priv, u32 src)
 {
 	int err;
 	static int rx_count;
 
+	if (bench_msgs) {
+		if (atomic_inc_return(&bench_rx) == bench_msgs)
+			dev_info(&rpdev->dev, "benchmark: all %d msgs echoed\n",
+								bench_msgs);
+		return;
+	}
+
 	dev_info(&rpdev->dev, "incoming msg %d (src: 0x%x)\n", ++rx_count, src);
 
 	print_hex_dump(KERN_DEBUG, __func__, DUMP_PREFIX_NONE, 16, 1,
@@ -54,6 +193,20 @@ static int rpmsg_sample_probe(struct rpmsg_channel *rpdev)
 	dev_info(&rpdev->dev, "new channel: 0x%x <-> 0x%x!\n",
 			rpdev->src, rpdev->dst);
 
+	if (bench_msgs) {
+		struct rpmsg_sample_bench *bench;
+
+		bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+		if (!bench)
+			return -ENOMEM;
+
+		bench->rpdev = rpdev;
+		INIT_WORK(&bench->work, rpmsg_sample_bench_work);
+		dev_set_drvdata(&rpdev->dev, bench);
+		schedule_work(&bench->work);
+		return 0;
+	}
+
 	/* send a message to our remote processor */
 	err = rpmsg_send(rpdev, MSG, strlen(MSG));
 	if (err) {
@@ -66,6 +219,13 @@ static int rpmsg_sample_probe(struct rpmsg_channel *rpdev)
 
 static void __devexit rpmsg_sample_remove(struct rpmsg_channel *rpdev)
 {
+	struct rpmsg_sample_bench *bench = dev_get_drvdata(&rpdev->dev);
+
+	if (bench) {
+		cancel_work_sync(&bench->work);
+		kfree(bench);
+	}
+
 	dev_info(&rpdev->dev, "rpmsg sample client driver is removed\n");
 }
 
@@ -148,8 +148,8 @@ static void _rpmsg_buffer_update_page_list(struct rpmsg_omx_instance *omx,
 					   struct rpmsg_buffer *buffer)
 {
 	struct scatterlist *sglist, *sg;
-	int n_pages;
-	int i;
+	int n_pages, nents;
+	int i, j, k;
 
 	if (buffer->page_list)
 		return;
@@ -162,10 +162,12 @@ static void _rpmsg_buffer_update_page_list(struct rpmsg_omx_instance *omx,
 		return;
 	}
 
-	/* get number of pages */
-	for_each_sg(sglist, sg, INT_MAX, n_pages) {
+	/* get number of pages; an entry may span several of them */
+	n_pages = 0;
+	for_each_sg(sglist, sg, INT_MAX, nents) {
 		if (!sg)
 			break;
+		n_pages += PAGE_ALIGN(sg->length) >> PAGE_SHIFT;
 	}
 
 	buffer->n_pages = n_pages;
@@ -180,8 +182,10 @@ static void _rpmsg_buffer_update_page_list(struct rpmsg_omx_instance *omx,
 		return;
 	}
 
-	for_each_sg(sglist, sg, n_pages, i) {
-		buffer->page_list[i] = sg_phys(sg);
+	k = 0;
+	for_each_sg(sglist, sg, nents, i) {
+		for (j = 0; j < PAGE_ALIGN(sg->length) >> PAGE_SHIFT; j++)
+			buffer->page_list[k++] = sg_phys(sg) + j * PAGE_SIZE;
 	}
 	wmb();
 }
@@ -30,8 +30,51 @@
 #include <linux/jiffies.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/err.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/rpmsg.h>
 
+/* number of free tx buffers each cpu may keep at hand */
+#define RPMSG_TX_CACHE_SIZE	(8)
+
+/**
+ * struct rpmsg_tx_cache - per-cpu stash of free tx buffers
+ *
+ * @lock:	protects the stash. only the owning cpu takes it, except when
+ *		another cpu has run out of buffers and steals one
+ * @count:	number of buffers in @bufs
+ * @bufs:	the free tx buffers
+ */
+struct rpmsg_tx_cache {
+	spinlock_t lock;
+	int count;
+	void *bufs[RPMSG_TX_CACHE_SIZE];
+};
+
+/* messages received before the rx loop yields to a work item */
+#define RPMSG_RX_BUDGET		(64)
+
+/* rx_flags bits */
+#define RPMSG_RX_POLLING	(0)
+
+/**
+ * struct rpmsg_rx_stats - receive path counters
+ *
+ * @interrupts:	rx virtqueue callbacks
+ * @messages:	messages delivered
+ * @kicks:	remote processor kicks for given back rx buffers
+ * @exhausted:	times the rx loop used its whole budget and yielded
+ */
+struct rpmsg_rx_stats {
+	unsigned long interrupts;
+	unsigned long messages;
+	unsigned long kicks;
+	unsigned long exhausted;
+};
+
 /**
  * struct virtproc_info - virtual remote processor info
  *
@@ -42,16 +85,27 @@
  * @sbufs:	address of tx buffers
  * @last_rbuf:	index of last rx buffer used
  * @last_sbuf:	index of last tx buffer used
+ * @tx_spare:	chain of free tx buffers that did not fit in a tx cache
+ * @tx_cache:	per-cpu stashes of free tx buffers
  * @sim_base:	simulated base addr base to make virtio's virt_to_page happy
- * @svq_lock:	protects the tx virtqueue, to allow several concurrent senders
+ * @svq_lock:	protects the tx virtqueue, @tx_spare and @sleepers, to allow
+ *		several concurrent senders
+ * @sleepers:	number of senders waiting for a tx buffer, "tx-complete"
+ *		interrupts are enabled while it is non-zero
  * @num_bufs:	total number of buffers allocated for communicating with this
  *		virtual remote processor. half is used for rx and half for tx.
  * @buf_size:	size of buffers allocated for communications
  * @endpoints:	the set of local endpoints
  * @endpoints_lock: lock of the endpoints set
  * @sendq:	wait queue of sending contexts waiting for free rpmsg buffer
+ * @tx_events:	bumped whenever a tx buffer may have become free, so that
+ *		waiters on @sendq can tell without taking @svq_lock
  * @ns_ept:	the bus's name service endpoint
  * @rproc:	a reference to the remote processor object
+ * @rx_flags:	RPMSG_RX_POLLING is set while some context owns the rx loop
+ * @rx_work:	continues the rx loop once a call has used up its budget
+ * @rx_stats:	receive path counters
+ * @dbg_file:	debugfs file showing @rx_stats
  *
  * This structure stores the rpmsg state of a given virtio remote processor
  * device (there might be several virtio rproc devices for each physical
@@ -62,15 +116,23 @@ struct virtproc_info {
 	struct virtqueue *rvq, *svq;
 	void *rbufs, *sbufs;
 	int last_rbuf, last_sbuf;
+	void *tx_spare;
+	struct rpmsg_tx_cache __percpu *tx_cache;
 	void *sim_base;
 	struct mutex svq_lock;
+	int sleepers;
 	int num_bufs;
 	int buf_size;
 	struct idr endpoints;
 	spinlock_t endpoints_lock;
 	wait_queue_head_t sendq;
+	atomic_t tx_events;
 	struct rpmsg_endpoint *ns_ept;
 	struct rproc *rproc;
+	unsigned long rx_flags;
+	struct work_struct rx_work;
+	struct rpmsg_rx_stats rx_stats;
+	struct dentry *dbg_file;
 };
 
 #define to_rpmsg_channel(d) container_of(d, struct rpmsg_channel, dev)
@@ -416,12 +478,22 @@ static int rpmsg_destroy_channel_by_info(struct virtproc_info *vrp,
 	return 0;
 }
 
-/* minimal buf "allocator" that is just enough for now */
+/*
+ * Takes a free tx buffer off the virtqueue side of the pool: a buffer that
+ * was given back but did not fit in a tx cache, a never used one, or one the
+ * remote processor is done with. svq_lock must be held.
+ */
 static void *get_a_buf(struct virtproc_info *vrp)
 {
 	unsigned int len;
 	void *buf = NULL;
 
+	if (vrp->tx_spare) {
+		buf = vrp->tx_spare;
+		vrp->tx_spare = *(void **)buf;
+		return buf;
+	}
+
 	/* make sure the descriptors are updated before reading */
 	rmb();
 	/* either pick the next unused buffer */
@@ -434,78 +506,192 @@ static void *get_a_buf(struct virtproc_info *vrp)
 	return buf;
 }
 
+/* takes a free tx buffer from this cpu's stash, without touching svq_lock */
+static void *rpmsg_get_tx_buf(struct virtproc_info *vrp)
+{
+	struct rpmsg_tx_cache *cache;
+	void *buf = NULL;
+
+	cache = get_cpu_ptr(vrp->tx_cache);
+	spin_lock(&cache->lock);
+	if (cache->count)
+		buf = cache->bufs[--cache->count];
+	spin_unlock(&cache->lock);
+	put_cpu_ptr(vrp->tx_cache);
+
+	return buf;
+}
+
+/* gives a tx buffer that was never sent back to the pool */
+static void rpmsg_put_tx_buf(struct virtproc_info *vrp, void *buf)
+{
+	struct rpmsg_tx_cache *cache;
+
+	cache = get_cpu_ptr(vrp->tx_cache);
+	spin_lock(&cache->lock);
+	if (cache->count < RPMSG_TX_CACHE_SIZE) {
+		cache->bufs[cache->count++] = buf;
+		buf = NULL;
+	}
+	spin_unlock(&cache->lock);
+	put_cpu_ptr(vrp->tx_cache);
+
+	/* this cpu's stash is full, chain it with the spare buffers */
+	if (buf) {
+		mutex_lock(&vrp->svq_lock);
+		*(void **)buf = vrp->tx_spare;
+		vrp->tx_spare = buf;
+		mutex_unlock(&vrp->svq_lock);
+	}
+
+	/* a sender may be waiting for a buffer */
+	atomic_inc(&vrp->tx_events);
+	wake_up_interruptible(&vrp->sendq);
+}
+
+/*
+ * Tops this cpu's stash up to half its size with buffers the remote
+ * processor is done with, so that the next few senders on this cpu need
+ * not take svq_lock to get one. svq_lock must be held.
+ */
+static void rpmsg_fill_tx_cache(struct virtproc_info *vrp)
+{
+	struct rpmsg_tx_cache *cache;
+	void *buf;
+
+	cache = get_cpu_ptr(vrp->tx_cache);
+	spin_lock(&cache->lock);
+	while (cache->count < RPMSG_TX_CACHE_SIZE / 2) {
+		buf = get_a_buf(vrp);
+		if (!buf)
+			break;
+		cache->bufs[cache->count++] = buf;
+	}
+	spin_unlock(&cache->lock);
+	put_cpu_ptr(vrp->tx_cache);
+}
+
+/*
+ * Slow path of the tx buffer allocation, for when this cpu's stash is
+ * empty: refill it from the virtqueue, and if that has nothing left either
+ * take a buffer some other cpu is holding on to. svq_lock must be held.
+ */
+static void *rpmsg_refill_tx_buf(struct virtproc_info *vrp)
+{
+	struct rpmsg_tx_cache *cache;
+	void *buf;
+	int cpu;
+
+	buf = get_a_buf(vrp);
+	if (buf) {
+		rpmsg_fill_tx_cache(vrp);
+		return buf;
+	}
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(vrp->tx_cache, cpu);
+		spin_lock(&cache->lock);
+		if (cache->count)
+			buf = cache->bufs[--cache->count];
+		spin_unlock(&cache->lock);
+		if (buf)
+			break;
+	}
+
+	return buf;
+}
+
 /* XXX: the blocking 'wait' mechanism hasn't been tested yet */
-int rpmsg_send_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
-					void *data, int len, bool wait)
+static struct rpmsg_hdr *rpmsg_alloc_tx_hdr(struct rpmsg_channel *rpdev,
+								bool wait)
 {
 	struct virtproc_info *vrp = rpdev->vrp;
 	struct device *dev = &rpdev->dev;
-	struct scatterlist sg;
 	struct rpmsg_hdr *msg;
-	int err;
-	unsigned long offset;
-	void *sim_addr;
-
-	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
-		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
-		return -EINVAL;
-	}
+	long timeout = msecs_to_jiffies(15000);
+	int events;
 
-	/* the payload's size is currently limited */
-	if (len > vrp->buf_size - sizeof(struct rpmsg_hdr)) {
-		dev_err(dev, "message is too big (%d)\n", len);
-		return -EMSGSIZE;
-	}
+	msg = rpmsg_get_tx_buf(vrp);
+	if (msg)
+		return msg;
 
-	/*
-	 * protect svq from simultaneous concurrent manipulations,
-	 * and serialize the sending of messages
-	 */
 	if (mutex_lock_interruptible(&vrp->svq_lock))
-		return -ERESTARTSYS;
-	/* grab a buffer */
-	msg = get_a_buf(vrp);
-	if (!msg && !wait) {
-		err = -ENOMEM;
-		goto out;
+		return ERR_PTR(-ERESTARTSYS);
+
+	msg = rpmsg_refill_tx_buf(vrp);
+	if (msg || !wait) {
+		mutex_unlock(&vrp->svq_lock);
+		return msg ? msg : ERR_PTR(-ENOMEM);
 	}
 
-	/* no free buffer ? wait for one (but bail after 15 seconds) */
-	if (!msg) {
-		/* enable "tx-complete" interrupts before dozing off */
+	/* enable "tx-complete" interrupts before dozing off */
+	if (!vrp->sleepers++)
 		virtqueue_enable_cb(vrp->svq);
 
-		/*
-		 * sleep until a free buffer is available or 15 secs elapse.
-		 * the timeout period is not configurable because frankly
-		 * i don't see why drivers need to deal with that.
-		 * if later this happens to be required, it'd be easy to add.
-		 */
-		err = wait_event_interruptible_timeout(vrp->sendq,
-					(msg = get_a_buf(vrp)),
-					msecs_to_jiffies(15000));
-
-		/* on success, suppress "tx-complete" interrupts again */
+	mutex_unlock(&vrp->svq_lock);
+
+	/*
+	 * sleep until a free buffer is available or 15 secs elapse, without
+	 * svq_lock so that buffers can still be sent and given back.
+	 * the wait condition must not sleep, so it only peeks at this cpu's
+	 * stash and at tx_events; svq_lock is taken to refill once woken.
+	 * the timeout period is not configurable because frankly
+	 * i don't see why drivers need to deal with that.
+	 * if later this happens to be required, it'd be easy to add.
+	 */
+	do {
+		events = atomic_read(&vrp->tx_events);
+
+		mutex_lock(&vrp->svq_lock);
+		msg = rpmsg_refill_tx_buf(vrp);
+		mutex_unlock(&vrp->svq_lock);
+		if (msg)
+			break;
+
+		timeout = wait_event_interruptible_timeout(vrp->sendq,
+				(msg = rpmsg_get_tx_buf(vrp)) ||
+				atomic_read(&vrp->tx_events) != events,
+				timeout);
+	} while (!msg && timeout > 0);
+
+	/* suppress "tx-complete" interrupts again once nobody waits */
+	mutex_lock(&vrp->svq_lock);
+	if (!--vrp->sleepers)
 		virtqueue_disable_cb(vrp->svq);
+	mutex_unlock(&vrp->svq_lock);
 
-		if (err < 0) {
-			err = -ERESTARTSYS;
-			goto out;
-		}
+	if (msg)
+		return msg;
 
-		if (!msg) {
-			dev_err(dev, "timeout waiting for buffer\n");
-			err = -ETIMEDOUT;
-			goto out;
-		}
-	}
+	if (timeout < 0)
+		return ERR_PTR(-ERESTARTSYS);
+
+	dev_err(dev, "timeout waiting for buffer\n");
+	return ERR_PTR(-ETIMEDOUT);
+}
+
+/* maps a payload handed out by rpmsg_alloc_tx_buf() back to its header */
+static struct rpmsg_hdr *rpmsg_tx_hdr(struct virtproc_info *vrp, void *data)
+{
+	unsigned long offset;
+
+	offset = (unsigned long) data - sizeof(struct rpmsg_hdr) -
+					(unsigned long) vrp->sbufs;
+	if (offset >= vrp->buf_size * (vrp->num_bufs / 2) ||
+						offset % vrp->buf_size)
+		return NULL;
+
+	return vrp->sbufs + offset;
+}
 
+static void rpmsg_fill_hdr(struct device *dev, struct rpmsg_hdr *msg,
+						u32 src, u32 dst, int len)
+{
 	msg->len = len;
 	msg->flags = 0;
 	msg->src = src;
 	msg->dst = dst;
 	msg->unused = 0;
-	memcpy(msg->data, data, len);
 
 	dev_dbg(dev, "TX From 0x%x, To 0x%x, Len %d, Flags %d, Unused %d\n",
 					msg->src, msg->dst, msg->len,
@@ -514,26 +700,205 @@ int rpmsg_send_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
 	print_hex_dump(KERN_DEBUG, "rpmsg_virtio TX: ", DUMP_PREFIX_NONE, 16, 1,
 					msg, sizeof(*msg) + msg->len, true);
 #endif
+}
+
+/* adds a filled in tx buffer to svq. svq_lock must be held */
+static int rpmsg_post_tx_buf(struct virtproc_info *vrp, struct device *dev,
+							struct rpmsg_hdr *msg)
+{
+	struct scatterlist sg;
+	unsigned long offset;
+	void *sim_addr;
+	int err;
 
 	offset = ((unsigned long) msg) - ((unsigned long) vrp->rbufs);
 	sim_addr = vrp->sim_base + offset;
-	sg_init_one(&sg, sim_addr, sizeof(*msg) + len);
+	sg_init_one(&sg, sim_addr, sizeof(*msg) + msg->len);
 
 	/* add message to the remote processor's virtqueue */
 	err = virtqueue_add_buf_gfp(vrp->svq, &sg, 1, 0, msg, GFP_KERNEL);
-	if (err < 0) {
+	if (err < 0)
 		dev_err(dev, "virtqueue_add_buf_gfp failed: %d\n", err);
-		goto out;
-	}
+
+	return err;
+}
+
+/* lets the remote processor know about newly posted buffers */
+static void rpmsg_kick_svq(struct virtproc_info *vrp)
+{
 	/* descriptors must be written before kicking remote processor */
 	wmb();
 
-	/* tell the remote processor it has a pending message to read */
+	/* tell the remote processor it has pending messages to read */
 	virtqueue_kick(vrp->svq);
 
-	err = 0;
-out:
+	/* while at it, reclaim what the remote processor is done with */
+	rpmsg_fill_tx_cache(vrp);
+}
+
+/**
+ * rpmsg_alloc_tx_buf() - get a tx buffer to build a message in
+ * @rpdev: the rpmsg channel
+ * @len: if not NULL, set to the largest payload the buffer can hold
+ * @wait: whether to sleep (up to 15 secs) when no buffer is free
+ *
+ * Returns a pointer to the payload area of a tx buffer that is shared with
+ * the remote processor, or an ERR_PTR() on failure. The buffer must either
+ * be sent with rpmsg_send_offchannel_nocopy() or returned with
+ * rpmsg_free_tx_buf().
+ */
+void *rpmsg_alloc_tx_buf(struct rpmsg_channel *rpdev, int *len, bool wait)
+{
+	struct rpmsg_hdr *msg;
+
+	msg = rpmsg_alloc_tx_hdr(rpdev, wait);
+	if (IS_ERR(msg))
+		return msg;
+
+	if (len)
+		*len = rpdev->vrp->buf_size - sizeof(*msg);
+
+	return msg->data;
+}
+EXPORT_SYMBOL(rpmsg_alloc_tx_buf);
+
+/**
+ * rpmsg_free_tx_buf() - give back a tx buffer that is not going to be sent
+ * @rpdev: the rpmsg channel
+ * @data: the payload pointer returned by rpmsg_alloc_tx_buf()
+ */
+void rpmsg_free_tx_buf(struct rpmsg_channel *rpdev, void *data)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct rpmsg_hdr *msg;
+
+	msg = rpmsg_tx_hdr(vrp, data);
+	if (WARN_ON(!msg))
+		return;
+
+	rpmsg_put_tx_buf(vrp, msg);
+}
+EXPORT_SYMBOL(rpmsg_free_tx_buf);
+
+/**
+ * rpmsg_send_offchannel_nocopy() - send messages built in tx buffers
+ * @rpdev: the rpmsg channel
+ * @src: source address of all the messages
+ * @msgs: the messages, with payloads from rpmsg_alloc_tx_buf()
+ * @num: number of messages
+ *
+ * The buffers are posted to the remote processor as they are, in order,
+ * and the remote processor is kicked once for the whole batch.
+ *
+ * Returns 0 on success. Whatever the outcome the buffers are consumed: the
+ * ones that could not be sent are given back to the pool.
+ */
+int rpmsg_send_offchannel_nocopy(struct rpmsg_channel *rpdev, u32 src,
+					struct rpmsg_tx_msg *msgs, int num)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg;
+	int i, err = 0;
+
+	for (i = 0; i < num; i++) {
+		if (!rpmsg_tx_hdr(vrp, msgs[i].data)) {
+			dev_err(dev, "not an rpmsg tx buffer: %p\n",
+							msgs[i].data);
+			err = -EINVAL;
+		} else if (src == RPMSG_ADDR_ANY ||
+					msgs[i].dst == RPMSG_ADDR_ANY) {
+			dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n",
+							src, msgs[i].dst);
+			err = -EINVAL;
+		} else if (msgs[i].len < 0 || msgs[i].len >
+				vrp->buf_size - sizeof(struct rpmsg_hdr)) {
+			dev_err(dev, "message is too big (%d)\n", msgs[i].len);
+			err = -EMSGSIZE;
+		}
+	}
+
+	if (err) {
+		i = 0;
+		goto put_bufs;
+	}
+
+	for (i = 0; i < num; i++)
+		rpmsg_fill_hdr(dev, rpmsg_tx_hdr(vrp, msgs[i].data), src,
+						msgs[i].dst, msgs[i].len);
+
+	mutex_lock(&vrp->svq_lock);
+
+	for (i = 0; i < num; i++) {
+		err = rpmsg_post_tx_buf(vrp, dev,
+					rpmsg_tx_hdr(vrp, msgs[i].data));
+		if (err < 0)
+			break;
+	}
+
+	if (i)
+		rpmsg_kick_svq(vrp);
+
 	mutex_unlock(&vrp->svq_lock);
+
+	if (err >= 0)
+		return 0;
+
+put_bufs:
+	for (; i < num; i++) {
+		msg = rpmsg_tx_hdr(vrp, msgs[i].data);
+		if (msg)
+			rpmsg_put_tx_buf(vrp, msg);
+	}
+
+	return err;
+}
+EXPORT_SYMBOL(rpmsg_send_offchannel_nocopy);
+
+int rpmsg_send_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+					void *data, int len, bool wait)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg;
+	int err;
+
+	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
+		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
+		return -EINVAL;
+	}
+
+	/* the payload's size is currently limited */
+	if (len > vrp->buf_size - sizeof(struct rpmsg_hdr)) {
+		dev_err(dev, "message is too big (%d)\n", len);
+		return -EMSGSIZE;
+	}
+
+	/* grab a buffer */
+	msg = rpmsg_alloc_tx_hdr(rpdev, wait);
+	if (IS_ERR(msg))
+		return PTR_ERR(msg);
+
+	rpmsg_fill_hdr(dev, msg, src, dst, len);
+	memcpy(msg->data, data, len);
+
+	/* serialize the sending of messages */
+	if (mutex_lock_interruptible(&vrp->svq_lock)) {
+		rpmsg_put_tx_buf(vrp, msg);
+		return -ERESTARTSYS;
+	}
+
+	err = rpmsg_post_tx_buf(vrp, dev, msg);
+	if (err >= 0) {
+		rpmsg_kick_svq(vrp);
+		err = 0;
+	}
+
+	mutex_unlock(&vrp->svq_lock);
+
+	if (err)
+		rpmsg_put_tx_buf(vrp, msg);
+
 	return err;
 }
 EXPORT_SYMBOL(rpmsg_send_offchannel_raw);
@@ -546,7 +911,8 @@ struct rproc *rpmsg_get_rproc_handle(struct rpmsg_channel *rpdev)
 }
 EXPORT_SYMBOL(rpmsg_get_rproc_handle);
 
-static void rpmsg_recv_done(struct virtqueue *rvq)
+/* delivers one message, if there is any. the rx loop must be owned */
+static bool rpmsg_recv_single(struct virtproc_info *vrp)
 {
 	struct rpmsg_hdr *msg;
 	unsigned int len;
@@ -554,17 +920,14 @@ static void rpmsg_recv_done(struct virtqueue *rvq)
 	struct scatterlist sg;
 	unsigned long offset;
 	void *sim_addr;
-	struct virtproc_info *vrp = rvq->vdev->priv;
-	struct device *dev = &rvq->vdev->dev;
+	struct device *dev = &vrp->vdev->dev;
 	int err;
 
 	/* make sure the descriptors are updated before reading */
 	rmb();
-	msg = virtqueue_get_buf(rvq, &len);
-	if (!msg) {
-		dev_err(dev, "uhm, incoming signal, but no used buffer ?\n");
-		return;
-	}
+	msg = virtqueue_get_buf(vrp->rvq, &len);
+	if (!msg)
+		return false;
 
 	dev_dbg(dev, "From: 0x%x, To: 0x%x, Len: %d, Flags: %d, Unused: %d\n",
 					msg->src, msg->dst, msg->len,
@@ -584,21 +947,84 @@ static void rpmsg_recv_done(struct virtqueue *rvq)
 	else
 		dev_warn(dev, "msg received with no recepient\n");
 
+	vrp->rx_stats.messages++;
+
 	/* add the buffer back to the remote processor's virtqueue */
 	offset = ((unsigned long) msg) - ((unsigned long) vrp->rbufs);
 	sim_addr = vrp->sim_base + offset;
 	sg_init_one(&sg, sim_addr, sizeof(*msg) + len);
 
 	err = virtqueue_add_buf_gfp(vrp->rvq, &sg, 0, 1, msg, GFP_KERNEL);
-	if (err < 0) {
+	if (err < 0)
 		dev_err(dev, "failed to add a virtqueue buffer: %d\n", err);
-		return;
+
+	return true;
+}
+
+/*
+ * Runs the rx loop, which the caller owns: deliver up to a budget of
+ * messages at a time, and give their buffers back with a single kick per
+ * batch. Under load, rather than hogging the mailbox's context, the rest is
+ * left to rx_work; once the vring is drained we go back to interrupts.
+ */
+static void rpmsg_rx(struct virtproc_info *vrp)
+{
+	int received;
+
+	for (;;) {
+		for (received = 0; received < RPMSG_RX_BUDGET; received++)
+			if (!rpmsg_recv_single(vrp))
+				break;
+
+		if (received) {
+			/* descriptors must be written before kicking */
+			wmb();
+
+			/* tell the remote processor about the rx buffers */
+			virtqueue_kick(vrp->rvq);
+			vrp->rx_stats.kicks++;
+		}
+
+		if (received == RPMSG_RX_BUDGET) {
+			vrp->rx_stats.exhausted++;
+			schedule_work(&vrp->rx_work);
+			return;
+		}
+
+		clear_bit(RPMSG_RX_POLLING, &vrp->rx_flags);
+		smp_mb__after_clear_bit();
+
+		/* done, unless a message sneaked in before interrupts are on */
+		if (virtqueue_enable_cb(vrp->rvq) ||
+		    test_and_set_bit(RPMSG_RX_POLLING, &vrp->rx_flags))
+			return;
+
+		virtqueue_disable_cb(vrp->rvq);
 	}
-	/* descriptors must be written before kicking remote processor */
-	wmb();
+}
 
-	/* tell the remote processor we added another available rx buffer */
-	virtqueue_kick(vrp->rvq);
+static void rpmsg_rx_work(struct work_struct *work)
+{
+	struct virtproc_info *vrp = container_of(work, struct virtproc_info,
+								rx_work);
+
+	rpmsg_rx(vrp);
+}
+
+static void rpmsg_recv_done(struct virtqueue *rvq)
+{
+	struct virtproc_info *vrp = rvq->vdev->priv;
+
+	vrp->rx_stats.interrupts++;
+
+	/* whoever runs the rx loop will pick this message up too */
+	if (test_and_set_bit(RPMSG_RX_POLLING, &vrp->rx_flags))
+		return;
+
+	/* no more interrupts until the vring is drained */
+	virtqueue_disable_cb(rvq);
+
+	rpmsg_rx(vrp);
 }
 
 static void rpmsg_xmit_done(struct virtqueue *svq)
@@ -608,6 +1034,7 @@ static void rpmsg_xmit_done(struct virtqueue *svq)
 	dev_dbg(&svq->vdev->dev, "%s\n", __func__);
 
 	/* wake up potential processes that are waiting for a buffer */
+	atomic_inc(&vrp->tx_events);
 	wake_up_interruptible(&vrp->sendq);
 }
 
@@ -664,6 +1091,39 @@ static void rpmsg_ns_cb(struct rpmsg_channel *rpdev, void *data, int len,
 	}
 }
 
+static struct dentry *rpmsg_dbg;
+
+static int rpmsg_rx_stats_show(struct seq_file *s, void *unused)
+{
+	struct virtproc_info *vrp = s->private;
+	struct rpmsg_rx_stats *st = &vrp->rx_stats;
+	unsigned long per_irq = 0;
+
+	if (st->interrupts)
+		per_irq = st->messages * 100 / st->interrupts;
+
+	seq_printf(s, "interrupts: %lu\n", st->interrupts);
+	seq_printf(s, "messages: %lu\n", st->messages);
+	seq_printf(s, "messages per interrupt: %lu.%02lu\n",
+						per_irq / 100, per_irq % 100);
+	seq_printf(s, "kicks: %lu\n", st->kicks);
+	seq_printf(s, "budget exhausted: %lu\n", st->exhausted);
+
+	return 0;
+}
+
+static int rpmsg_rx_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_rx_stats_show, inode->i_private);
+}
+
+static const struct file_operations rpmsg_rx_stats_ops = {
+	.open		= rpmsg_rx_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int rpmsg_probe(struct virtio_device *vdev)
 {
 	vq_callback_t *vq_cbs[] = { rpmsg_recv_done, rpmsg_xmit_done };
@@ -684,11 +1144,20 @@ static int rpmsg_probe(struct virtio_device *vdev)
 	spin_lock_init(&vrp->endpoints_lock);
 	mutex_init(&vrp->svq_lock);
 	init_waitqueue_head(&vrp->sendq);
+	INIT_WORK(&vrp->rx_work, rpmsg_rx_work);
+
+	vrp->tx_cache = alloc_percpu(struct rpmsg_tx_cache);
+	if (!vrp->tx_cache) {
+		err = -ENOMEM;
+		goto free_vi;
+	}
+	for_each_possible_cpu(i)
+		spin_lock_init(&per_cpu_ptr(vrp->tx_cache, i)->lock);
 
 	/* We expect two virtqueues, rx and tx (in this order) */
 	err = vdev->config->find_vqs(vdev, 2, vqs, vq_cbs, names);
 	if (err)
-		goto free_vi;
+		goto free_cache;
 
 	vrp->rvq = vqs[0];
 	vrp->svq = vqs[1];
@@ -737,6 +1206,10 @@ static int rpmsg_probe(struct virtio_device *vdev)
 
 	vdev->priv = vrp;
 
+	if (rpmsg_dbg)
+		vrp->dbg_file = debugfs_create_file(dev_name(&vdev->dev), 0400,
+					rpmsg_dbg, vrp, &rpmsg_rx_stats_ops);
+
 	dev_info(&vdev->dev, "rpmsg backend virtproc probed successfully\n");
 
 	/* if supported by the remote processor, enable the name service */
@@ -759,7 +1232,11 @@ static int rpmsg_probe(struct virtio_device *vdev)
 	return 0;
 
 vqs_del:
+	debugfs_remove(vrp->dbg_file);
+	cancel_work_sync(&vrp->rx_work);
 	vdev->config->del_vqs(vrp->vdev);
+free_cache:
+	free_percpu(vrp->tx_cache);
 free_vi:
 	kfree(vrp);
 	return err;
@@ -783,11 +1260,23 @@ static void __devexit rpmsg_remove(struct virtio_device *vdev)
 	if (ret)
 		dev_warn(&vdev->dev, "can't remove rpmsg device: %d\n", ret);
 
+	/*
+	 * stop the rx loop before the endpoints it delivers to go away.
+	 * once we own it, neither the rx interrupt nor rx_work runs it again
+	 */
+	while (test_and_set_bit(RPMSG_RX_POLLING, &vrp->rx_flags))
+		flush_work(&vrp->rx_work);
+	cancel_work_sync(&vrp->rx_work);
+	virtqueue_disable_cb(vrp->rvq);
+
 	idr_remove_all(&vrp->endpoints);
 	idr_destroy(&vrp->endpoints);
 
+	debugfs_remove(vrp->dbg_file);
+
 	vdev->config->del_vqs(vrp->vdev);
 
+	free_percpu(vrp->tx_cache);
 	kfree(vrp);
 }
 
@@ -820,13 +1309,26 @@ static int __init init(void)
 		return ret;
 	}
 
-	return register_virtio_driver(&virtio_ipc_driver);
+	if (debugfs_initialized()) {
+		rpmsg_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!rpmsg_dbg)
+			pr_err("can't create debugfs dir\n");
+	}
+
+	ret = register_virtio_driver(&virtio_ipc_driver);
+	if (ret) {
+		debugfs_remove_recursive(rpmsg_dbg);
+		bus_unregister(&rpmsg_bus);
+	}
+
+	return ret;
 }
 module_init(init);
 
 static void __exit fini(void)
 {
 	unregister_virtio_driver(&virtio_ipc_driver);
+	debugfs_remove_recursive(rpmsg_dbg);
 	bus_unregister(&rpmsg_bus);
 }
 module_exit(fini);
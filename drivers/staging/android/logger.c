@@ -22,8 +22,10 @@
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
+#include <linux/percpu.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 #include "logger.h"
 
@@ -36,14 +38,18 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock', which is only ever held to copy whole entries between
+ * kernel buffers: user copies are done outside of it.
+ *
+ * sec_logger_add_log_ram_console() relies on 'buffer' and 'misc' being the
+ * first two members.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
@@ -53,16 +59,31 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. r_off is protected by log->lock; bounce is only
+ * used by read(), which holds read_mutex. r_off only moves past entries
+ * once read() has copied them to userspace.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
+	bool			r_batch; /* read() returns many entries */
 	int			r_ver;	/* reader ABI version */
+	struct mutex		read_mutex; /* serializes read() */
+	unsigned char		*bounce; /* entries on their way to user */
 };
 
+/* the largest entry, and the size of both the write and the read buffers */
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/*
+ * Writers assemble the entry in a per-cpu buffer with preemption disabled,
+ * so that the log lock is only held for a memcpy() into the ring.
+ */
+static unsigned char __percpu *logger_write_buf;
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -114,7 +135,7 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * get_entry_msg_len - Grabs the length of the message of the entry
  * starting from from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -133,11 +154,13 @@ static size_t get_user_hdr_len(int ver)
 		return sizeof(struct logger_entry);
 }
 
-static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
-					 char __user *buf)
+/*
+ * copy_header - stores the header of 'entry' at 'dst' in the layout of
+ * ABI version 'ver'. Returns the length of the header.
+ */
+static size_t copy_header(int ver, struct logger_entry *entry,
+			  unsigned char *dst)
 {
-	void *hdr;
-	size_t hdr_len;
 	struct user_logger_entry_compat v1;
 
 	if (ver < 2) {
@@ -147,43 +170,37 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 		v1.tid      = entry->tid;
 		v1.sec      = entry->sec;
 		v1.nsec     = entry->nsec;
-		hdr         = &v1;
-		hdr_len     = sizeof(struct user_logger_entry_compat);
-	} else {
-		hdr         = entry;
-		hdr_len     = sizeof(struct logger_entry);
+		memcpy(dst, &v1, sizeof(struct user_logger_entry_compat));
+		return sizeof(struct user_logger_entry_compat);
 	}
 
-	return copy_to_user(buf, hdr, hdr_len);
+	memcpy(dst, entry, sizeof(struct logger_entry));
+	return sizeof(struct logger_entry);
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - copies the entry at '*off', converted to the reader's ABI
+ * version, to 'dst', which must have room for it. Advances '*off' past the
+ * entry and returns the number of bytes stored.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static size_t do_read_log(struct logger_log *log,
+			  struct logger_reader *reader,
+			  size_t *off, unsigned char *dst)
 {
 	struct logger_entry scratch;
 	struct logger_entry *entry;
+	size_t hdr_len;
+	size_t count;
 	size_t len;
 	size_t msg_start;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
-
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
+	entry = get_entry_header(log, *off, &scratch);
+	count = entry->len;
+	hdr_len = copy_header(reader->r_ver, entry, dst);
+	dst += hdr_len;
+	msg_start = logger_offset(*off + sizeof(struct logger_entry));
 
 	/*
 	 * We read from the msg in two disjoint operations. First, we read from
@@ -191,21 +208,18 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+	memcpy(dst, log->buffer + msg_start, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(dst + len, log->buffer, count - len);
 
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
+	*off = logger_offset(*off + sizeof(struct logger_entry) + count);
 
-	return count + get_user_hdr_len(reader->r_ver);
+	return hdr_len + count;
 }
 
 /*
@@ -232,6 +246,58 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 	return off;
 }
 
+/*
+ * fill_bounce - copies as many of the reader's pending entries to its
+ * bounce buffer as fit in both it and 'count' bytes, and stores the offset
+ * past them in '*off' for commit_read(). Returns the number of bytes
+ * copied, 0 if the log has nothing for this reader, or -EINVAL if the next
+ * entry does not fit in 'count'.
+ *
+ * Caller must hold log->lock.
+ */
+static ssize_t fill_bounce(struct logger_log *log,
+			   struct logger_reader *reader,
+			   size_t count, uid_t euid, size_t *off)
+{
+	size_t room = min_t(size_t, count, LOGGER_ENTRY_MAX_LEN);
+	size_t used = 0;
+
+	*off = reader->r_off;
+	do {
+		size_t len;
+
+		if (!reader->r_all)
+			*off = get_next_entry_by_uid(log, *off, euid);
+		if (log->w_off == *off)
+			break;
+
+		len = get_user_hdr_len(reader->r_ver) +
+			get_entry_msg_len(log, *off);
+		if (len > room - used) {
+			if (!used && len > count)
+				return -EINVAL;
+			break;
+		}
+		used += do_read_log(log, reader, off, reader->bounce + used);
+	} while (reader->r_batch);
+
+	return used;
+}
+
+/*
+ * commit_read - moves the reader past entries that made it to userspace,
+ * 'off' being the offset fill_bounce() stored. A writer that lapped the
+ * reader in the meantime may already have pulled it further than that.
+ *
+ * Caller must hold log->lock.
+ */
+static void commit_read(struct logger_log *log, struct logger_reader *reader,
+			size_t prev, size_t off)
+{
+	if (logger_offset(off - prev) > logger_offset(reader->r_off - prev))
+		reader->r_off = off;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -239,7 +305,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or, after LOGGER_SET_BATCH,
+ * 	  as many whole entries as fit in the buffer
  *
  * Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -249,17 +316,21 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	uid_t euid = current_euid();
 	ssize_t ret;
+	ssize_t done = 0;
+	size_t prev, off;
 	DEFINE_WAIT(wait);
 
-start:
+	mutex_lock(&reader->read_mutex);
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
+		spin_lock(&log->lock);
+		prev = reader->r_off;
+		ret = fill_bounce(log, reader, count, euid, &off);
+		spin_unlock(&log->lock);
+		if (ret)
 			break;
 
 		if (file->f_flags & O_NONBLOCK) {
@@ -274,37 +345,36 @@ start:
 
 		schedule();
 	}
-
 	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+	/*
+	 * In batch mode keep draining the log through the bounce buffer
+	 * until it is empty or the user buffer is full. Entries are only
+	 * consumed once copied, so a fault leaves them to the next read().
+	 */
+	while (ret > 0) {
+		if (copy_to_user(buf + done, reader->bounce, ret)) {
+			ret = -EFAULT;
+			break;
+		}
+		done += ret;
+
+		spin_lock(&log->lock);
+		commit_read(log, reader, prev, off);
+		if (reader->r_batch) {
+			prev = reader->r_off;
+			ret = fill_bounce(log, reader, count - done, euid,
+					  &off);
+		}
+		spin_unlock(&log->lock);
 
-	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+		if (!reader->r_batch)
+			break;
 	}
+	mutex_unlock(&reader->read_mutex);
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
-
+	if (done && ret != -EFAULT)
+		return done;
 	return ret;
 }
 
@@ -312,7 +382,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -351,7 +421,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -370,7 +440,7 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -387,102 +457,131 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * copy_payload_from_user - gathers 'count' bytes of payload from 'iov'
+ * into 'dst'. With 'atomic' set, page faults are not taken and the copy
+ * fails instead, so that it can run with preemption disabled.
  *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * Returns zero on success, nonzero on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int copy_payload_from_user(unsigned char *dst, const struct iovec *iov,
+				  unsigned long nr_segs, size_t count,
+				  bool atomic)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	size_t done = 0;
+	unsigned long left;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+	while (nr_segs-- > 0 && done < count) {
+		/* figure out how much of this vector we can keep */
+		size_t len = min_t(size_t, iov->iov_len, count - done);
+
+		if (atomic) {
+			pagefault_disable();
+			left = __copy_from_user_inatomic(dst + done,
+							 iov->iov_base, len);
+			pagefault_enable();
+		} else
+			left = copy_from_user(dst + done, iov->iov_base, len);
+		if (left)
 			return -EFAULT;
 
-	sec_logger_update_buffer(log->buffer + log->w_off, count);
+		sec_logger_update_buffer((const char *)dst + done, len);
 
-	log->w_off = logger_offset(log->w_off + count);
+		iov++;
+		done += len;
+	}
+
+	return 0;
+}
+
+/*
+ * commit_entry - appends the assembled entry 'entry' to 'log'
+ */
+static void commit_entry(struct logger_log *log, struct logger_entry *entry)
+{
+	size_t len = sizeof(struct logger_entry) + entry->len;
+
+	spin_lock(&log->lock);
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, len);
+
+	do_write_log(log, entry, len);
 
-	return count;
+	sec_logger_add_log_ram_console(log, logger_offset(log->w_off - len));
+
+	spin_unlock(&log->lock);
+
+	/*
+	 * wake up any blocked readers. A reader queues itself before it
+	 * checks w_off under the lock, so it cannot be missed here.
+	 */
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The entry is built in a per-cpu buffer and copied into the log under a
+ * spinlock; if the user buffer is not resident, it is built in a
+ * temporary buffer instead so the page fault can be taken.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
+	struct logger_entry *entry;
 	struct timespec now;
-	ssize_t ret = 0;
-
-	now = current_kernel_time();
+	size_t len;
 
-	header.pid = current->tgid;
-	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
-	header.euid = current_euid();
-	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
-	header.hdr_size = sizeof(struct logger_entry);
+	len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	/* null writes succeed, return zero */
-	if (unlikely(!header.len))
+	if (unlikely(!len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	now = current_kernel_time();
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	entry = (struct logger_entry *)get_cpu_ptr(logger_write_buf);
+	entry->pid = current->tgid;
+	entry->tid = current->pid;
+	entry->sec = now.tv_sec;
+	entry->nsec = now.tv_nsec;
+	entry->euid = current_euid();
+	entry->len = len;
+	entry->hdr_size = sizeof(struct logger_entry);
+
+	if (likely(!copy_payload_from_user((unsigned char *)entry->msg, iov,
+					   nr_segs, len, true))) {
+		commit_entry(log, entry);
+		put_cpu_ptr(logger_write_buf);
+	} else {
+		struct logger_entry header = *entry;
+		struct logger_entry *slow;
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+		put_cpu_ptr(logger_write_buf);
+		slow = kmalloc(sizeof(struct logger_entry) + len, GFP_KERNEL);
+		if (!slow)
+			return -ENOMEM;
+		*slow = header;
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (copy_payload_from_user((unsigned char *)slow->msg, iov,
+					   nr_segs, len, false)) {
+			kfree(slow);
+			return -EFAULT;
 		}
-
-		iov++;
-		ret += nr;
+		commit_entry(log, slow);
+		kfree(slow);
 	}
 
-	sec_logger_add_log_ram_console(log, orig);
-
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
-
 	sec_logger_print_buffer();
 
-	return ret;
+	return len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -512,17 +611,25 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->bounce = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->bounce) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
+		reader->r_batch = false;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
+		mutex_init(&reader->read_mutex);
 
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -542,10 +649,11 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
+		kfree(reader->bounce);
 		kfree(reader);
 	}
 
@@ -575,24 +683,20 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
 
-static long logger_set_version(struct logger_reader *reader, void __user *arg)
+static long logger_set_version(struct logger_reader *reader, int version)
 {
-	int version;
-	if (copy_from_user(&version, arg, sizeof(int)))
-		return -EFAULT;
-
 	if ((version < 1) || (version > 2))
 		return -EINVAL;
 
@@ -606,8 +710,15 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	int val = 0;
 
-	mutex_lock(&log->mutex);
+	/* fetch the argument now, user copies may not be done under log->lock */
+	if (cmd == LOGGER_SET_VERSION || cmd == LOGGER_SET_BATCH) {
+		if (copy_from_user(&val, argp, sizeof(int)))
+			return -EFAULT;
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -665,11 +776,20 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		ret = logger_set_version(reader, argp);
+		ret = logger_set_version(reader, val);
+		break;
+	case LOGGER_SET_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->r_batch = !!val;
+		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -702,7 +822,7 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -747,6 +867,11 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	logger_write_buf = __alloc_percpu(LOGGER_ENTRY_MAX_LEN,
+					  __alignof__(struct logger_entry));
+	if (!logger_write_buf)
+		return -ENOMEM;
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
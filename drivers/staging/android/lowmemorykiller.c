@@ -36,11 +36,15 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
-#include <linux/notifier.h>
+#include <linux/spinlock.h>
 
 #ifdef CONFIG_ENHANCED_LMK_ROUTINE
 #define LOWMEM_DEATHPENDING_DEPTH 3
+#else
+#define LOWMEM_DEATHPENDING_DEPTH 1
 #endif
 
 static uint32_t lowmem_debug_level = 2;
@@ -59,14 +63,35 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-static struct task_struct *lowmem_deathpending[LOWMEM_DEATHPENDING_DEPTH] = {
-	NULL,
-};
-#else
-static struct task_struct *lowmem_deathpending;
-#endif
+/*
+ * Victims are pinned until their memory is gone; see lowmem_death_pending().
+ * Only touched by lowmem_shrink(), which lowmem_shrink_lock serializes.
+ */
+static struct task_struct *lowmem_deathpending[LOWMEM_DEATHPENDING_DEPTH];
 static unsigned long lowmem_deathpending_timeout;
+static DEFINE_MUTEX(lowmem_shrink_lock);
+
+/*
+ * The processes of one oom_adj level, taken from lowmem_index so their RSS
+ * can be read without holding lowmem_index_lock. A level with more
+ * processes than this is only partly considered. Also serialized by
+ * lowmem_shrink_lock.
+ */
+#define LOWMEM_SNAPSHOT_SIZE 256
+static struct task_struct *lowmem_snapshot[LOWMEM_SNAPSHOT_SIZE];
+
+/*
+ * Every process is kept in lowmem_index, sorted by oom_adj, so victims are
+ * found by walking down from the highest oom_adj instead of scanning the
+ * whole task list. RSS changes too often to be part of the key: it is only
+ * compared among the processes at the oom_adj levels being considered.
+ *
+ * The index is updated at fork, when the signal_struct is freed and when
+ * oom_adj is written. It may be taken from RCU callbacks, which free
+ * signal structs, so interrupts are disabled while it is held.
+ */
+static struct rb_root lowmem_index = RB_ROOT;
+static DEFINE_SPINLOCK(lowmem_index_lock);
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -74,53 +99,238 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+static void __lowmem_index_insert(struct signal_struct *sig)
+{
+	struct rb_node **p = &lowmem_index.rb_node;
+	struct rb_node *parent = NULL;
+	struct signal_struct *entry;
 
-static struct notifier_block task_nb = {
-	.notifier_call	= task_notify_func,
-};
+	sig->lmk_adj = sig->oom_adj;
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct signal_struct, lmk_node);
+
+		if (sig->lmk_adj < entry->lmk_adj)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&sig->lmk_node, parent, p);
+	rb_insert_color(&sig->lmk_node, &lowmem_index);
+}
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+static void __lowmem_index_remove(struct signal_struct *sig)
 {
-	struct task_struct *task = data;
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	int i = 0;
+	if (RB_EMPTY_NODE(&sig->lmk_node))
+		return;
+	rb_erase(&sig->lmk_node, &lowmem_index);
+	RB_CLEAR_NODE(&sig->lmk_node);
+}
+
+void lowmem_index_insert(struct signal_struct *sig)
+{
+	unsigned long flags;
 
-	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++)
-		if (task == lowmem_deathpending[i]) {
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	__lowmem_index_insert(sig);
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+}
+
+void lowmem_index_remove(struct signal_struct *sig)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	__lowmem_index_remove(sig);
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+}
+
+/* Re-sort sig after its oom_adj may have changed */
+void lowmem_index_update(struct signal_struct *sig)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	if (!RB_EMPTY_NODE(&sig->lmk_node) && sig->lmk_adj != sig->oom_adj) {
+		__lowmem_index_remove(sig);
+		__lowmem_index_insert(sig);
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+}
+
+/*
+ * lowmem_death_pending - returns true while a previous victim still holds
+ * its memory. A victim is done once exit_mm() has dropped its mm, which
+ * may be long before a zombie is reaped. The timeout covers a victim stuck
+ * in uninterruptible sleep.
+ */
+static bool lowmem_death_pending(void)
+{
+	bool pending = false;
+	int i;
+
+	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
+		struct task_struct *p = lowmem_deathpending[i];
+		bool alive;
+
+		if (!p)
+			continue;
+		task_lock(p);
+		alive = p->mm != NULL;
+		task_unlock(p);
+		if (alive && time_before_eq(jiffies,
+					    lowmem_deathpending_timeout)) {
+			pending = true;
+		} else {
 			lowmem_deathpending[i] = NULL;
+			put_task_struct(p);
+		}
+	}
+	return pending;
+}
+
+/* Returns the last entry of lowmem_index with oom_adj below adj, or NULL */
+static struct rb_node *lowmem_index_below(int adj)
+{
+	struct rb_node *n = lowmem_index.rb_node;
+	struct rb_node *last = NULL;
+
+	while (n) {
+		struct signal_struct *sig;
+
+		sig = rb_entry(n, struct signal_struct, lmk_node);
+		if (sig->lmk_adj < adj) {
+			last = n;
+			n = n->rb_right;
+		} else {
+			n = n->rb_left;
+		}
+	}
+	return last;
+}
+
+/*
+ * Copies the processes at the highest oom_adj level below 'below' into
+ * lowmem_snapshot and returns how many were taken, or 0 once no level at
+ * or above min_adj is left. The level is returned in *adj.
+ */
+static int lowmem_snapshot_level(int below, int min_adj, int *adj)
+{
+	struct rb_node *n;
+	unsigned long flags;
+	int count = 0;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	for (n = lowmem_index_below(below); n; n = rb_prev(n)) {
+		struct signal_struct *sig;
+		struct task_struct *p;
+
+		sig = rb_entry(n, struct signal_struct, lmk_node);
+		if (!count) {
+			*adj = sig->lmk_adj;
+			if (*adj < min_adj)
+				break;
+		} else if (sig->lmk_adj != *adj ||
+			   count == LOWMEM_SNAPSHOT_SIZE) {
 			break;
 		}
-#else
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
-#endif
 
-	return NOTIFY_OK;
+		p = pid_task(sig->leader_pid, PIDTYPE_PID);
+		if (p)
+			lowmem_snapshot[count++] = p;
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+
+	return count;
+}
+
+/*
+ * lowmem_select - picks up to LOWMEM_DEATHPENDING_DEPTH victims with
+ * oom_adj >= min_adj, preferring the highest oom_adj and then the largest
+ * RSS. Victims are returned with a reference held, best first. The walk
+ * stops at the first oom_adj level below the worst victim once all slots
+ * are filled.
+ *
+ * lowmem_index_lock is taken from RCU callbacks, so task_lock() must not
+ * nest inside it: each level is snapshotted first and its RSS read after
+ * the index lock is dropped.
+ */
+static int lowmem_select(int min_adj, struct task_struct **selected,
+			 int *selected_tasksize, int *selected_oom_adj)
+{
+	int below = OOM_ADJUST_MAX + 1;
+	int nr = 0;
+	int count, oom_adj;
+	int i, j;
+
+	rcu_read_lock();
+	while ((count = lowmem_snapshot_level(below, min_adj, &oom_adj))) {
+		if (nr == LOWMEM_DEATHPENDING_DEPTH &&
+		    oom_adj < selected_oom_adj[nr - 1])
+			break;
+
+		for (j = 0; j < count; j++) {
+			struct task_struct *p = lowmem_snapshot[j];
+			int tasksize;
+
+			task_lock(p);
+			if (!p->mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+
+			/* keep the selection sorted, best victim first */
+			for (i = nr; i > 0; i--) {
+				if (oom_adj < selected_oom_adj[i - 1])
+					break;
+				if (oom_adj == selected_oom_adj[i - 1] &&
+				    tasksize <= selected_tasksize[i - 1])
+					break;
+			}
+			if (i == LOWMEM_DEATHPENDING_DEPTH)
+				continue;
+			if (nr == LOWMEM_DEATHPENDING_DEPTH)
+				nr--;
+			memmove(&selected[i + 1], &selected[i],
+				(nr - i) * sizeof(*selected));
+			memmove(&selected_tasksize[i + 1], &selected_tasksize[i],
+				(nr - i) * sizeof(*selected_tasksize));
+			memmove(&selected_oom_adj[i + 1], &selected_oom_adj[i],
+				(nr - i) * sizeof(*selected_oom_adj));
+			selected[i] = p;
+			selected_tasksize[i] = tasksize;
+			selected_oom_adj[i] = oom_adj;
+			nr++;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
+		below = oom_adj;
+	}
+	/*
+	 * RCU keeps the tasks around until here. No reference is taken in
+	 * the walk, as dropping one for an evicted candidate could free its
+	 * signal_struct and recurse into lowmem_index_lock.
+	 */
+	for (i = 0; i < nr; i++)
+		get_task_struct(selected[i]);
+	rcu_read_unlock();
+
+	return nr;
 }
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *p;
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	struct task_struct *selected[LOWMEM_DEATHPENDING_DEPTH] = {NULL,};
-#else
-	struct task_struct *selected = NULL;
-#endif
+	struct task_struct *selected[LOWMEM_DEATHPENDING_DEPTH];
+	int selected_tasksize[LOWMEM_DEATHPENDING_DEPTH];
+	int selected_oom_adj[LOWMEM_DEATHPENDING_DEPTH];
+	int nr_selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	int selected_tasksize[LOWMEM_DEATHPENDING_DEPTH] = {0,};
-	int selected_oom_adj[LOWMEM_DEATHPENDING_DEPTH] = {OOM_ADJUST_MAX,};
-	int all_selected_oom = 0;
-#else
-	int selected_tasksize = 0;
-	int selected_oom_adj;
-#endif
 	int array_size = ARRAY_SIZE(lowmem_adj);
 #ifndef CONFIG_CMA
 	int other_free = global_page_state(NR_FREE_PAGES);
@@ -131,25 +341,6 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
-	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
-	 * this pass.
-	 *
-	 */
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-		if (lowmem_deathpending[i] &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-			return 0;
-	}
-#else
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-		return 0;
-#endif
-
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
@@ -175,102 +366,41 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		return rem;
 	}
 
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++)
-		selected_oom_adj[i] = min_adj;
-#else
-	selected_oom_adj = min_adj;
-#endif
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-		for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-			if (all_selected_oom >= LOWMEM_DEATHPENDING_DEPTH) {
-				if (oom_adj < selected_oom_adj[i])
-					continue;
-				if (oom_adj == selected_oom_adj[i] &&
-					tasksize <= selected_tasksize[i])
-					continue;
-			} else if (selected[i])
-				continue;
-
-			selected[i] = p;
-			selected_tasksize[i] = tasksize;
-			selected_oom_adj[i] = oom_adj;
-
-			if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH)
-				all_selected_oom++;
-			lowmem_print(2, "select %d (%s), adj %d, size %d,"
-			     "to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-
-			break;
-		}
-#else
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+	/*
+	 * Another reclaimer is already picking victims; its kills will
+	 * show up as free memory soon enough.
+	 */
+	if (!mutex_trylock(&lowmem_shrink_lock))
+		return 0;
 
-#endif
-	}
-#ifdef CONFIG_ENHANCED_LMK_ROUTINE
-	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-		if (selected[i]) {
-			lowmem_print(1, "send sigkill to %d (%s), adj %d,"
-				     "size %d\n",
-				     selected[i]->pid, selected[i]->comm,
-				     selected_oom_adj[i], selected_tasksize[i]);
-			lowmem_deathpending[i] = selected[i];
-			lowmem_deathpending_timeout = jiffies + HZ;
-			force_sig(SIGKILL, selected[i]);
-			rem -= selected_tasksize[i];
-		}
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; indicating to vmscan
+	 * that we have nothing further to offer on
+	 * this pass.
+	 *
+	 */
+	if (lowmem_death_pending()) {
+		mutex_unlock(&lowmem_shrink_lock);
+		return 0;
 	}
-#else
-	if (selected) {
+
+	nr_selected = lowmem_select(min_adj, selected, selected_tasksize,
+				    selected_oom_adj);
+	for (i = 0; i < nr_selected; i++) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
+			     selected[i]->pid, selected[i]->comm,
+			     selected_oom_adj[i], selected_tasksize[i]);
+		/* the reference from lowmem_select() pins the victim */
+		lowmem_deathpending[i] = selected[i];
 		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		force_sig(SIGKILL, selected[i]);
+		rem -= selected_tasksize[i];
 	}
-#endif
+	mutex_unlock(&lowmem_shrink_lock);
+
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -281,7 +411,6 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
-	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -289,7 +418,6 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
-	task_free_unregister(&task_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
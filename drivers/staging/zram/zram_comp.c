@@ -0,0 +1,239 @@
+/*
+ * Compression backends for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/ctype.h>
+#include <linux/errno.h>
+#include <linux/lzo.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#ifdef CONFIG_ZRAM_DEFLATE
+#include <linux/zlib.h>
+#endif
+
+#include "zram_comp.h"
+
+/*-- LZO: fast, moderate density */
+
+static void *zram_lzo_create(void)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void zram_lzo_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zram_lzo_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+static int zram_lzo_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private)
+{
+	int ret;
+	size_t dst_len = PAGE_SIZE;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+	if (ret != LZO_E_OK || dst_len != PAGE_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+static const struct zram_backend zram_lzo_backend = {
+	.name = "lzo",
+	.create = zram_lzo_create,
+	.destroy = zram_lzo_destroy,
+	.compress = zram_lzo_compress,
+	.decompress = zram_lzo_decompress,
+	.decompress_needs_private = 0,
+};
+
+#ifdef CONFIG_ZRAM_DEFLATE
+/*-- deflate: slower, denser. A 4K window covers a whole page. */
+
+#define ZRAM_DEFLATE_LEVEL	Z_DEFAULT_COMPRESSION
+#define ZRAM_DEFLATE_WINBITS	12
+#define ZRAM_DEFLATE_MEMLEVEL	DEF_MEM_LEVEL
+
+struct zram_deflate {
+	struct z_stream_s comp;
+	struct z_stream_s decomp;
+};
+
+static void zram_deflate_destroy(void *private)
+{
+	struct zram_deflate *zd = private;
+
+	if (zd->comp.workspace) {
+		zlib_deflateEnd(&zd->comp);
+		vfree(zd->comp.workspace);
+	}
+	if (zd->decomp.workspace) {
+		zlib_inflateEnd(&zd->decomp);
+		vfree(zd->decomp.workspace);
+	}
+	kfree(zd);
+}
+
+static void *zram_deflate_create(void)
+{
+	struct zram_deflate *zd;
+
+	zd = kzalloc(sizeof(*zd), GFP_KERNEL);
+	if (!zd)
+		return NULL;
+
+	zd->comp.workspace = vzalloc(zlib_deflate_workspacesize(
+			ZRAM_DEFLATE_WINBITS, ZRAM_DEFLATE_MEMLEVEL));
+	if (!zd->comp.workspace)
+		goto fail;
+
+	if (zlib_deflateInit2(&zd->comp, ZRAM_DEFLATE_LEVEL, Z_DEFLATED,
+			ZRAM_DEFLATE_WINBITS, ZRAM_DEFLATE_MEMLEVEL,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		vfree(zd->comp.workspace);
+		zd->comp.workspace = NULL;
+		goto fail;
+	}
+
+	zd->decomp.workspace = vzalloc(zlib_inflate_workspacesize());
+	if (!zd->decomp.workspace)
+		goto fail;
+
+	if (zlib_inflateInit2(&zd->decomp, ZRAM_DEFLATE_WINBITS) != Z_OK) {
+		vfree(zd->decomp.workspace);
+		zd->decomp.workspace = NULL;
+		goto fail;
+	}
+
+	return zd;
+
+fail:
+	zram_deflate_destroy(zd);
+	return NULL;
+}
+
+static int zram_deflate_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private)
+{
+	int ret;
+	struct z_stream_s *stream = &((struct zram_deflate *)private)->comp;
+
+	if (zlib_deflateReset(stream) != Z_OK)
+		return -EINVAL;
+
+	stream->next_in = (u8 *)src;
+	stream->avail_in = PAGE_SIZE;
+	stream->next_out = dst;
+	stream->avail_out = 2 * PAGE_SIZE;
+
+	ret = zlib_deflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return -EINVAL;
+
+	*dst_len = stream->total_out;
+	return 0;
+}
+
+static int zram_deflate_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private)
+{
+	int ret;
+	struct z_stream_s *stream = &((struct zram_deflate *)private)->decomp;
+
+	if (zlib_inflateReset(stream) != Z_OK)
+		return -EINVAL;
+
+	stream->next_in = (u8 *)src;
+	stream->avail_in = src_len;
+	stream->next_out = dst;
+	stream->avail_out = PAGE_SIZE;
+
+	ret = zlib_inflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END || stream->total_out != PAGE_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+static const struct zram_backend zram_deflate_backend = {
+	.name = "deflate",
+	.create = zram_deflate_create,
+	.destroy = zram_deflate_destroy,
+	.compress = zram_deflate_compress,
+	.decompress = zram_deflate_decompress,
+	.decompress_needs_private = 1,
+};
+#endif
+
+static const struct zram_backend *zram_backends[] = {
+	&zram_lzo_backend,
+#ifdef CONFIG_ZRAM_DEFLATE
+	&zram_deflate_backend,
+#endif
+};
+
+const struct zram_backend *zram_default_backend = &zram_lzo_backend;
+
+/*
+ * Look up a backend by name. Trailing whitespace (the newline from
+ * "echo foo > comp_algorithm") is ignored.
+ */
+const struct zram_backend *zram_backend_find(const char *name)
+{
+	int i;
+	size_t len = strlen(name);
+
+	while (len && isspace(name[len - 1]))
+		len--;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++) {
+		if (strlen(zram_backends[i]->name) == len &&
+				!strncmp(zram_backends[i]->name, name, len))
+			return zram_backends[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * List available backends with the one in use in brackets,
+ * e.g. "[lzo] deflate".
+ */
+ssize_t zram_backend_show(const struct zram_backend *cur, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++) {
+		if (zram_backends[i] == cur)
+			sz += sprintf(buf + sz, "[%s] ",
+					zram_backends[i]->name);
+		else
+			sz += sprintf(buf + sz, "%s ",
+					zram_backends[i]->name);
+	}
+
+	/* Replace the trailing space with a newline */
+	buf[sz - 1] = '\n';
+	return sz;
+}
@@ -0,0 +1,50 @@
+/*
+ * Compression backends for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/types.h>
+
+/*
+ * A compression backend. Every compression stream of a device gets its
+ * own private state from create(), so compress() and decompress() may
+ * be called concurrently on different streams.
+ *
+ * compress() reads PAGE_SIZE bytes from src and may write up to
+ * 2 * PAGE_SIZE bytes to dst. decompress() must produce exactly
+ * PAGE_SIZE bytes. Both return 0 on success or a negative errno.
+ */
+struct zram_backend {
+	const char *name;
+
+	void *(*create)(void);
+	void (*destroy)(void *private);
+
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private);
+
+	/*
+	 * Set if decompress() uses the stream private state. Otherwise
+	 * reads are done without taking a compression stream.
+	 */
+	int decompress_needs_private;
+};
+
+extern const struct zram_backend *zram_default_backend;
+
+const struct zram_backend *zram_backend_find(const char *name);
+ssize_t zram_backend_show(const struct zram_backend *cur, char *buf);
+
+#endif
@@ -23,13 +23,15 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -42,16 +44,6 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
-
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
 	spin_lock(&zram->stat64_lock);
@@ -89,6 +81,114 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+/*
+ * Table entries are protected by a bit spinlock in their flags word, so
+ * that reads, writes and slot free notifications touching different
+ * pages never contend with each other.
+ */
+static void zram_table_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_table_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_stream_free(struct zram *zram, struct zram_stream *zstrm)
+{
+	if (zstrm->private)
+		zram->backend->destroy(zstrm->private);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_stream *zram_stream_alloc(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->private = zram->backend->create();
+	/* Compressed output can exceed PAGE_SIZE, so use two pages */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zstrm->private || !zstrm->buffer) {
+		zram_stream_free(zram, zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream *zstrm, *tmp;
+
+	list_for_each_entry_safe(zstrm, tmp, &zram->idle_streams, list) {
+		list_del(&zstrm->list);
+		zram_stream_free(zram, zstrm);
+	}
+}
+
+static int zram_create_streams(struct zram *zram)
+{
+	unsigned int i;
+	struct zram_stream *zstrm;
+
+	if (!zram->max_comp_streams)
+		zram->max_comp_streams = num_online_cpus();
+
+	for (i = 0; i < zram->max_comp_streams; i++) {
+		zstrm = zram_stream_alloc(zram);
+		if (!zstrm) {
+			zram_destroy_streams(zram);
+			return -ENOMEM;
+		}
+		list_add(&zstrm->list, &zram->idle_streams);
+	}
+
+	return 0;
+}
+
+/*
+ * Get an idle compression stream, sleeping until one is released if all
+ * of them are in use.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	spin_lock(&zram->stream_lock);
+	while (list_empty(&zram->idle_streams)) {
+		spin_unlock(&zram->stream_lock);
+		wait_event(zram->stream_wait,
+			!list_empty(&zram->idle_streams));
+		spin_lock(&zram->stream_lock);
+	}
+
+	zstrm = list_first_entry(&zram->idle_streams,
+				struct zram_stream, list);
+	list_del(&zstrm->list);
+	spin_unlock(&zram->stream_lock);
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *zstrm)
+{
+	spin_lock(&zram->stream_lock);
+	list_add(&zstrm->list, &zram->idle_streams);
+	spin_unlock(&zram->stream_lock);
+
+	/* order the list update against a waiter's check in wait_event() */
+	smp_mb();
+	if (waitqueue_active(&zram->stream_wait))
+		wake_up(&zram->stream_wait);
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,48 +233,308 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kfree(entry);
+		return NULL;
+	}
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->refcount = 1;
+	entry->size = len;
+
+	return entry;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->size);
+	kfree(entry);
+}
+
+/*
+ * Drop a table entry's reference to a compressed object and free it
+ * once no table entry uses it any more.
+ */
+static void zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	unsigned int refcount;
+
+	/* Objects outside the dedup tree are never shared */
+	if (RB_EMPTY_NODE(&entry->rb_node)) {
+		zram_entry_free(zram, entry);
+		return;
+	}
+
+	spin_lock(&zram->dedup_lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &zram->dedup_tree);
+	spin_unlock(&zram->dedup_lock);
+
+	if (!refcount)
+		zram_entry_free(zram, entry);
+	else
+		zram_stat64_sub(zram, &zram->stats.dedup_size, entry->size);
+}
+
+static int zram_entry_match(struct zram *zram, struct zram_entry *entry,
+			const void *buf, size_t len)
+{
+	int match;
+	void *cmem;
+
+	if (entry->size != len)
+		return 0;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(cmem, buf, len);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for a stored object with the same compressed data and take a
+ * reference to it. Different objects may share a checksum, so all
+ * entries with a matching checksum are compared.
+ */
+static struct zram_entry *zram_dedup_get(struct zram *zram,
+			const void *buf, size_t len, u32 checksum)
+{
+	struct rb_node *node;
+	struct zram_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	node = zram->dedup_tree.rb_node;
+	while (node) {
+		entry = rb_entry(node, struct zram_entry, rb_node);
+		if (checksum < entry->checksum) {
+			node = node->rb_left;
+		} else if (checksum > entry->checksum) {
+			node = node->rb_right;
+		} else {
+			/* Rewind to the first entry with this checksum */
+			while (rb_prev(node) && rb_entry(rb_prev(node),
+				struct zram_entry, rb_node)->checksum == checksum)
+				node = rb_prev(node);
+			break;
+		}
+	}
+
+	for (; node; node = rb_next(node)) {
+		entry = rb_entry(node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		if (zram_entry_match(zram, entry, buf, len)) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	struct rb_node **p, *parent = NULL;
+	struct zram_entry *e;
+
+	spin_lock(&zram->dedup_lock);
+	p = &zram->dedup_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct zram_entry, rb_node);
+		if (entry->checksum < e->checksum)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, p);
+	rb_insert_color(&entry->rb_node, &zram->dedup_tree);
+	spin_unlock(&zram->dedup_lock);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Writeback: incompressible pages and pages not accessed for wb_idle_age
+ * seconds are moved to the backing device by a background pass, in
+ * batches of up to ZRAM_WB_BATCH pages per bio.
+ */
+#define ZRAM_WB_BATCH	32
+
+/* Delay before a pass is started for newly stored incompressible pages */
+#define ZRAM_WB_DELAY	HZ
+
+static struct workqueue_struct *zram_wq;
+
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = jiffies;
+}
+
+/* Allocate nr contiguous backing device pages; ULONG_MAX if none */
+static unsigned long zram_alloc_blocks(struct zram *zram, int nr)
+{
+	unsigned long block;
+
+	spin_lock(&zram->bitmap_lock);
+	block = bitmap_find_next_zero_area(zram->bitmap, zram->nr_pages,
+					0, nr, 0);
+	if (block + nr > zram->nr_pages)
+		block = ULONG_MAX;
+	else
+		bitmap_set(zram->bitmap, block, nr);
+	spin_unlock(&zram->bitmap_lock);
+
+	return block;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->bitmap_lock);
+	clear_bit(block, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+struct zram_bd_read {
+	struct work_struct work;
+	struct block_device *bdev;
+	struct page *page;
+	unsigned long block;
+	int error;
+	struct completion done;
+};
+
+static void zram_bd_read_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_read *rd = bio->bi_private;
+
+	rd->error = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+	complete(&rd->done);
+}
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct bio *bio;
+	struct zram_bd_read *rd = container_of(work, struct zram_bd_read,
+						work);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	bio->bi_bdev = rd->bdev;
+	bio->bi_sector = rd->block << SECTORS_PER_PAGE_SHIFT;
+	bio_add_page(bio, rd->page, PAGE_SIZE, 0);
+	bio->bi_end_io = zram_bd_read_end_io;
+	bio->bi_private = rd;
+
+	submit_bio(READ, bio);
+}
+
+/*
+ * Bios submitted from a make_request function are only issued after it
+ * returns, so waiting for one in place would deadlock. Submit the read
+ * from a worker and wait for it to complete.
+ */
+static int zram_bd_read(struct zram *zram, struct page *page,
+			unsigned long block)
+{
+	struct zram_bd_read rd;
+
+	INIT_WORK_ONSTACK(&rd.work, zram_bd_read_work);
+	rd.bdev = zram->backing_dev;
+	rd.page = page;
+	rd.block = block;
+	init_completion(&rd.done);
+
+	queue_work(zram_wq, &rd.work);
+	wait_for_completion(&rd.done);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	if (unlikely(rd.error)) {
+		pr_err("Error reading page %lu from backing device\n",
+			block);
+		return rd.error;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	flush_dcache_page(page);
+	return 0;
+}
+#else
+static void zram_touch(struct zram *zram, u32 index)
+{
+}
+#endif
+
+/*
+ * Free the memory backing a table entry. Caller must hold the entry lock.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry = zram->table[index].entry;
+	u16 size = zram->table[index].size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * A rewrite or free cancels a writeback in progress. The slot stays
+	 * marked until that bio completes, so a later pass can't pick it
+	 * up and have the old block installed over its new data.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		zram_set_flag(zram, index, ZRAM_WB_DIRTY);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_block(zram, zram->table[index].block);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram->table[index].block = 0;
+		atomic_dec(&zram->stats.bd_count);
+		return;
+	}
+#endif
 
-	if (unlikely(!page)) {
+	/* entry aliases page for ZRAM_UNCOMPRESSED pages */
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
 		 */
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+			atomic_dec(&zram->stats.pages_zero);
 		}
 		return;
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size, size);
+		atomic_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	zram_entry_put(zram, entry);
+	if (size <= PAGE_SIZE / 2)
+		atomic_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	atomic_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,19 +554,105 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
+	int ret;
+	ktime_t start;
+	struct zram_stream *zstrm = NULL;
+	unsigned char *user_mem, *cmem;
+
+	/*
+	 * Backends with decompression state need a stream. Take it before
+	 * the entry lock since we may have to sleep for one.
+	 */
+	if (zram->backend->decompress_needs_private)
+		zstrm = zram_stream_get(zram);
 
+	zram_table_lock(zram, index);
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_table_unlock(zram, index);
+		handle_zero_page(page);
+		ret = 0;
+		goto out;
+	}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Page was written back; no stream or entry lock needed for I/O */
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long block = zram->table[index].block;
+
+		zram_table_unlock(zram, index);
+		if (zstrm)
+			zram_stream_put(zram, zstrm);
+		return zram_bd_read(zram, page, block);
+	}
+#endif
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].entry)) {
+		zram_table_unlock(zram, index);
+		pr_debug("Read before write: index=%u\n", index);
+		handle_zero_page(page);
+		ret = 0;
+		goto out;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		zram_table_unlock(zram, index);
+		ret = 0;
+		goto out;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool,
+				zram->table[index].entry->handle, ZS_MM_RO);
+
+	start = ktime_get();
+	ret = zram->backend->decompress(cmem, zram->table[index].size,
+		user_mem, zstrm ? zstrm->private : NULL);
+
+	zs_unmap_object(zram->mem_pool, zram->table[index].entry->handle);
+	kunmap_atomic(user_mem, KM_USER0);
+	zram_table_unlock(zram, index);
+
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
+
+	zram_stat64_add(zram, &zram->stats.decompr_time,
+		ktime_to_ns(ktime_sub(ktime_get(), start)));
+	zram_stat64_inc(zram, &zram->stats.num_decompr);
+
+	flush_dcache_page(page);
+	return 0;
+
+out:
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+	return ret;
+}
+
+static void zram_read(struct zram *zram, struct bio *bio)
+{
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
@@ -215,68 +661,161 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		if (zram_read_page(zram, bvec->bv_page, index))
+			goto out;
+		zram_touch(zram, index);
+		index++;
+	}
 
-		page = bvec->bv_page;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+out:
+	bio_io_error(bio);
+}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+/*
+ * Compression and allocation of the destination object happen without
+ * any table lock held; the entry is only locked to swap in the new
+ * object, so writes to different pages run fully in parallel.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	u32 checksum = 0;
+	size_t clen;
+	ktime_t start;
+	struct zram_stream *zstrm;
+	struct zram_entry *entry = NULL;
+	struct page *page_store = NULL;
+	unsigned char *user_mem, *cmem;
+	int uncompressed = 0;
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	zstrm = zram_stream_get(zram);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_stream_put(zram, zstrm);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		zram_table_lock(zram, index);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_table_unlock(zram, index);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		atomic_inc(&zram->stats.pages_zero);
+		return 0;
+	}
+
+	start = ktime_get();
+	ret = zram->backend->compress(user_mem, zstrm->buffer, &clen,
+				zstrm->private);
 
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		zram_stream_put(zram, zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -EIO;
+	}
+
+	zram_stat64_add(zram, &zram->stats.compr_time,
+		ktime_to_ns(ktime_sub(ktime_get(), start)));
+	zram_stat64_inc(zram, &zram->stats.num_compr);
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_stream_put(zram, zstrm);
+		zstrm = NULL;
+
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			return -ENOMEM;
+		}
+
+		uncompressed = 1;
+
+		cmem = kmap_atomic(page_store, KM_USER1);
+		user_mem = kmap_atomic(page, KM_USER0);
+		memcpy(cmem, user_mem, PAGE_SIZE);
 		kunmap_atomic(user_mem, KM_USER0);
 		kunmap_atomic(cmem, KM_USER1);
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		goto found;
+	}
+
+	if (zram->use_dedup) {
+		checksum = jhash(zstrm->buffer, clen, 0);
+		entry = zram_dedup_get(zram, zstrm->buffer, clen, checksum);
+		if (entry) {
+			zram_stream_put(zram, zstrm);
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_size, clen);
+			goto found;
 		}
+	}
 
-		flush_dcache_page(page);
-		index++;
+	entry = zram_entry_alloc(zram, clen);
+	if (unlikely(!entry)) {
+		zram_stream_put(zram, zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	zram_stream_put(zram, zstrm);
 
-out:
-	bio_io_error(bio);
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (zram->use_dedup) {
+		entry->checksum = checksum;
+		zram_dedup_insert(zram, entry);
+	}
+
+found:
+	zram_table_lock(zram, index);
+	zram_free_page(zram, index);
+	if (unlikely(uncompressed)) {
+		zram->table[index].page = page_store;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+	} else {
+		zram->table[index].entry = entry;
+	}
+	zram->table[index].size = clen;
+	zram_touch(zram, index);
+	zram_table_unlock(zram, index);
+
+	/* Update stats */
+	atomic_inc(&zram->stats.pages_stored);
+	if (unlikely(uncompressed)) {
+		atomic_inc(&zram->stats.pages_expand);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		if (zram->backing_dev)
+			queue_delayed_work(zram_wq, &zram->wb_work,
+					ZRAM_WB_DELAY);
+#endif
+	} else if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
+
+	return 0;
 }
 
 static void zram_write(struct zram *zram, struct bio *bio)
@@ -289,121 +828,362 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		if (zram_write_page(zram, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+out:
+	bio_io_error(bio);
+}
 
-		mutex_lock(&zram->lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+struct zram_wb_req {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long block;	/* first backing device page */
+	int nr;
+	int error;
+	int limited;		/* pages are charged to wb_limit */
+	u32 index[ZRAM_WB_BATCH];
+	struct page *pages[ZRAM_WB_BATCH];
+};
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
+static void zram_wb_req_free(struct zram_wb_req *req)
+{
+	int i;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		if (req->pages[i])
+			__free_page(req->pages[i]);
+	}
+	kfree(req);
+}
+
+/* End the writeback of a slot. Caller must hold the entry lock. */
+static void zram_wb_unmark(struct zram *zram, u32 index)
+{
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_WB_DIRTY);
+}
+
+/* Take one page from the writeback budget */
+static int zram_wb_limit_get(struct zram *zram)
+{
+	int ret = 1;
+
+	spin_lock(&zram->stat64_lock);
+	if (zram->wb_limit)
+		zram->wb_limit--;
+	else
+		ret = 0;
+	spin_unlock(&zram->stat64_lock);
+
+	return ret;
+}
+
+/* Give back pages that were charged but not written */
+static void zram_wb_limit_put(struct zram *zram, int nr)
+{
+	spin_lock(&zram->stat64_lock);
+	zram->wb_limit += nr;
+	spin_unlock(&zram->stat64_lock);
+}
+
+/* Give up on writing back req->index[from..nr) */
+static void zram_wb_cancel(struct zram *zram, struct zram_wb_req *req,
+			int from)
+{
+	int i;
+	u32 index;
+
+	for (i = from; i < req->nr; i++) {
+		index = req->index[i];
+		zram_table_lock(zram, index);
+		zram_wb_unmark(zram, index);
+		zram_table_unlock(zram, index);
+	}
+	if (req->limited && req->nr > from)
+		zram_wb_limit_put(zram, req->nr - from);
+	req->nr = from;
+}
+
+/*
+ * Runs once the writeback bio completed. Entries not marked ZRAM_WB_DIRTY
+ * were not rewritten meanwhile: drop their in-memory copy and point them
+ * to the backing device.
+ */
+static void zram_wb_finish(struct work_struct *work)
+{
+	int i, dirty;
+	u32 index;
+	struct zram_wb_req *req = container_of(work, struct zram_wb_req,
+						work);
+	struct zram *zram = req->zram;
+
+	for (i = 0; i < req->nr; i++) {
+		index = req->index[i];
+
+		zram_table_lock(zram, index);
+		dirty = zram_test_flag(zram, index, ZRAM_WB_DIRTY);
+		zram_wb_unmark(zram, index);
+		if (!req->error && !dirty) {
+			zram_free_page(zram, index);
+			zram->table[index].block = req->block + i;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_table_unlock(zram, index);
+			atomic_inc(&zram->stats.bd_count);
 			continue;
 		}
+		zram_table_unlock(zram, index);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		zram_free_block(zram, req->block + i);
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (req->error) {
+		pr_err("Writeback of %d pages failed\n", req->nr);
+		if (req->limited)
+			zram_wb_limit_put(zram, req->nr);
+	} else {
+		zram_stat64_add(zram, &zram->stats.bd_writes, req->nr);
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	zram_wb_req_free(req);
+	if (atomic_dec_and_test(&zram->wb_inflight))
+		wake_up(&zram->wb_wait);
+}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	struct zram_wb_req *req = bio->bi_private;
+
+	req->error = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	/* Table entries can't be locked from interrupt context */
+	INIT_WORK(&req->work, zram_wb_finish);
+	queue_work(zram_wq, &req->work);
+}
+
+/*
+ * Write the batch to one contiguous run of backing device pages. If the
+ * device is too fragmented for the whole batch, smaller runs are tried
+ * and pages that don't fit are left for a later pass. Returns -ENOSPC
+ * if not even one page could be placed.
+ */
+static int zram_wb_submit(struct zram *zram, struct zram_wb_req *req)
+{
+	int i, nr = req->nr;
+	struct bio *bio;
+
+	while (nr) {
+		req->block = zram_alloc_blocks(zram, nr);
+		if (req->block != ULONG_MAX)
+			break;
+		nr /= 2;
+	}
+
+	if (!nr) {
+		zram_wb_cancel(zram, req, 0);
+		zram_wb_req_free(req);
+		return -ENOSPC;
+	}
+	zram_wb_cancel(zram, req, nr);
+
+	bio = bio_alloc(GFP_NOIO, nr);
+	bio->bi_bdev = zram->backing_dev;
+	bio->bi_sector = req->block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_end_io;
+	bio->bi_private = req;
+
+	for (i = 0; i < nr; i++) {
+		if (bio_add_page(bio, req->pages[i], PAGE_SIZE, 0) != PAGE_SIZE)
+			break;
+	}
+
+	/* The queue took fewer pages than asked: release the rest */
+	if (i < nr) {
+		zram_wb_cancel(zram, req, i);
+		spin_lock(&zram->bitmap_lock);
+		bitmap_clear(zram->bitmap, req->block + i, nr - i);
+		spin_unlock(&zram->bitmap_lock);
+	}
+
+	if (!i) {
+		bio_put(bio);
+		zram_wb_req_free(req);
+		return -EIO;
+	}
+
+	atomic_inc(&zram->wb_inflight);
+	submit_bio(WRITE, bio);
+
+	return 0;
+}
+
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			unsigned long idle_jiffies)
+{
+	if (zram_test_flag(zram, index, ZRAM_WB) ||
+		zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		zram_test_flag(zram, index, ZRAM_ZERO) ||
+		!zram->table[index].entry)
+		return 0;
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 1;
+
+	return idle_jiffies &&
+		time_after(jiffies, zram->table[index].ac_time + idle_jiffies);
+}
+
+/*
+ * Writeback pass. Candidates are marked ZRAM_UNDER_WB and decompressed
+ * into a private page; a write or free of the slot before the bio
+ * completes marks it ZRAM_WB_DIRTY and the written copy is discarded.
+ */
+static void zram_writeback_work(struct work_struct *work)
+{
+	int ret, limited;
+	u32 index, nr_index;
+	unsigned long idle_jiffies;
+	struct zram_wb_req *req = NULL;
+	struct zram *zram = container_of(to_delayed_work(work), struct zram,
+					wb_work);
+
+	nr_index = zram->disksize >> PAGE_SHIFT;
+	idle_jiffies = zram->wb_idle_age * HZ;
+	limited = zram->wb_limit_enable;
+
+	for (index = 0; index < nr_index; index++) {
+		if (!req) {
+			req = kzalloc(sizeof(*req), GFP_NOIO);
+			if (!req)
+				break;
+			req->zram = zram;
+			req->limited = limited;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+		if (!req->pages[req->nr]) {
+			req->pages[req->nr] = alloc_page(GFP_NOIO);
+			if (!req->pages[req->nr])
+				break;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		zram_table_lock(zram, index);
+		if (!zram_wb_candidate(zram, index, idle_jiffies)) {
+			zram_table_unlock(zram, index);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_table_unlock(zram, index);
+
+		if (limited && !zram_wb_limit_get(zram)) {
+			zram_table_lock(zram, index);
+			zram_wb_unmark(zram, index);
+			zram_table_unlock(zram, index);
+			break;
+		}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		if (zram_read_page(zram, req->pages[req->nr], index)) {
+			if (limited)
+				zram_wb_limit_put(zram, 1);
+			zram_table_lock(zram, index);
+			zram_wb_unmark(zram, index);
+			zram_table_unlock(zram, index);
+			continue;
+		}
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+		req->index[req->nr++] = index;
+		if (req->nr == ZRAM_WB_BATCH) {
+			ret = zram_wb_submit(zram, req);
+			req = NULL;
+			if (ret)
+				goto out;
 		}
-#endif
+		cond_resched();
+	}
 
-		memcpy(cmem, src, clen);
+	if (req && req->nr)
+		zram_wb_submit(zram, req);
+	else if (req)
+		zram_wb_req_free(req);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+out:
+	if (zram->wb_idle_age)
+		queue_delayed_work(zram_wq, &zram->wb_work,
+				max_t(unsigned long, idle_jiffies / 2, HZ));
+}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+void zram_writeback_kick(struct zram *zram)
+{
+	if (zram->init_done && zram->backing_dev)
+		queue_delayed_work(zram_wq, &zram->wb_work, 0);
+}
 
-		mutex_unlock(&zram->lock);
-		index++;
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->backing_dev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->backing_dev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	kfree(zram->backing_dev_path);
+	zram->backing_dev_path = NULL;
+	zram->nr_pages = 0;
+}
+
+/* Caller must hold init_lock, and the device must not be initialized */
+int zram_set_backing_dev(struct zram *zram, const char *buf)
+{
+	int ret;
+	char *path;
+	unsigned long nr_pages, *bitmap;
+	struct block_device *bdev;
+
+	path = kstrdup(buf, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+	strim(path);
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE |
+				FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		pr_info("Cannot open backing device %s\n", path);
+		ret = PTR_ERR(bdev);
+		goto out_free_path;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!nr_pages || !bitmap) {
+		ret = nr_pages ? -ENOMEM : -EINVAL;
+		goto out_put;
+	}
 
-out:
-	bio_io_error(bio);
+	zram_reset_bdev(zram);
+	zram->backing_dev = bdev;
+	zram->backing_dev_path = path;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+
+	pr_info("Using %s (%lu pages) as backing device\n", path, nr_pages);
+	return 0;
+
+out_put:
+	vfree(bitmap);
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_free_path:
+	kfree(path);
+	return ret;
 }
+#endif
 
 /*
  * Check if request is within bounds and page aligned.
@@ -460,34 +1240,37 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	cancel_delayed_work_sync(&zram->wb_work);
+	wait_event(zram->wb_wait, !atomic_read(&zram->wb_inflight));
+#endif
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+	for (index = 0; zram->table &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		/* Blocks on the backing device are released below */
+		if (zram_test_flag(zram, index, ZRAM_WB) ||
+				!zram->table[index].entry)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(zram->table[index].page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_entry_put(zram, zram->table[index].entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_bdev(zram);
+#endif
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,17 +1294,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams\n");
 		goto fail;
 	}
 
@@ -540,7 +1315,8 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -548,6 +1324,12 @@ int zram_init_device(struct zram *zram)
 	}
 
 	zram->init_done = 1;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram->backing_dev && zram->wb_idle_age)
+		queue_delayed_work(zram_wq, &zram->wb_work,
+				zram->wb_idle_age * HZ);
+#endif
 	mutex_unlock(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -566,7 +1348,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_table_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_table_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1363,20 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	zram->backend = zram_default_backend;
+	zram->dedup_tree = RB_ROOT;
+	spin_lock_init(&zram->dedup_lock);
+	INIT_LIST_HEAD(&zram->idle_streams);
+	spin_lock_init(&zram->stream_lock);
+	init_waitqueue_head(&zram->stream_wait);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+	INIT_DELAYED_WORK(&zram->wb_work, zram_writeback_work);
+	atomic_set(&zram->wb_inflight, 0);
+	init_waitqueue_head(&zram->wb_wait);
+#endif
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1459,19 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_wq = alloc_workqueue("zram", WQ_NON_REENTRANT | WQ_MEM_RECLAIM, 0);
+	if (!zram_wq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+#endif
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_wq;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1501,10 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_wq:
+#ifdef CONFIG_ZRAM_WRITEBACK
+	destroy_workqueue(zram_wq);
+#endif
 out:
 	return ret;
 }
@@ -713,9 +1520,16 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		/* Backing device may be set on a never initialized device */
+		zram_reset_bdev(zram);
+#endif
 	}
 
 	unregister_blkdev(zram_major, "zram");
+#ifdef CONFIG_ZRAM_WRITEBACK
+	destroy_workqueue(zram_wq);
+#endif
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -17,8 +17,13 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zram_comp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +31,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,9 +43,9 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than PAGE_SIZE minus one word
+ * (zsmalloc's per-object header), otherwise zs_malloc() would always
+ * return failure.
  */
 
 /*-- End of configurable params */
@@ -71,19 +64,67 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is stored on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page was rewritten or freed while ZRAM_UNDER_WB */
+	ZRAM_WB_DIRTY,
+
+	/* Table entry lock (bit spinlock) */
+	ZRAM_ACCESS,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * A compressed object in the pool. With deduplication, table entries
+ * holding identical data share one zram_entry: refcount counts them.
+ * Entries that can be shared are kept in zram->dedup_tree, keyed by a
+ * checksum of the compressed data. rb_node and refcount are protected
+ * by zram->dedup_lock.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	unsigned int refcount;
+	unsigned long handle;	/* zsmalloc handle */
+	u16 size;		/* compressed size */
+};
+
+/*
+ * Allocated for each disk page. The ZRAM_ACCESS bit of flags is used
+ * as a per-entry lock, so flags must be an unsigned long.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		struct zram_entry *entry;
+		struct page *page;	/* if ZRAM_UNCOMPRESSED */
+		unsigned long block;	/* if ZRAM_WB: backing device page */
+	};
+	u16 size;	/* object size */
 	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	unsigned long flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of last read or write */
+#endif
 } __attribute__((aligned(4)));
 
+/*
+ * Compression stream: working memory and output buffer needed by one
+ * in-flight compression. Each device keeps a pool of these so that
+ * writes on different CPUs can compress in parallel.
+ */
+struct zram_stream {
+	void *private;		/* backend state, from backend->create() */
+	void *buffer;
+	struct list_head list;
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +133,59 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 compr_time;		/* total ns spent compressing */
+	u64 num_compr;		/* no. of pages compressed */
+	u64 decompr_time;	/* total ns spent decompressing */
+	u64 num_decompr;	/* no. of pages decompressed */
+	u64 dedup_hits;		/* writes that reused a stored object */
+	u64 dedup_size;		/* compressed bytes not stored thanks to dedup */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic_t bd_count;	/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+#endif
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	const struct zram_backend *backend;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+
+	/* Idle compression streams; writers sleep on stream_wait */
+	struct list_head idle_streams;
+	spinlock_t stream_lock;
+	wait_queue_head_t stream_wait;
+	unsigned int max_comp_streams;
+
+	/* Shareable compressed objects, if use_dedup is set */
+	struct rb_root dedup_tree;
+	spinlock_t dedup_lock;
+	int use_dedup;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Incompressible and idle pages are moved to this device. Each bit
+	 * of bitmap tracks one PAGE_SIZE block of it.
+	 */
+	struct block_device *backing_dev;
+	char *backing_dev_path;
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+	spinlock_t bitmap_lock;
+
+	struct delayed_work wb_work;
+	atomic_t wb_inflight;	/* writeback bios not yet completed */
+	wait_queue_head_t wb_wait;
+	unsigned int wb_idle_age;	/* seconds; 0: incompressible only */
+	int wb_limit_enable;
+	u64 wb_limit;		/* pages, protected by stat64_lock */
+#endif
+
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +208,9 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_writeback_kick(struct zram *zram);
+#endif
 
 #endif
@@ -0,0 +1,949 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc is a slab-like allocator for compressed pages. Each size
+ * class packs its objects into zspages made of one to four 0-order
+ * pages, with objects allowed to span page boundaries, so very little
+ * memory is lost to slack. Users only see handles; since all accesses
+ * go through zs_map_object(), zs_compact() can migrate objects out of
+ * sparsely used zspages and give the pages back to the system.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *handle_cachep;
+static struct kmem_cache *zspage_cachep;
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zs_stat_root;
+static atomic_t zs_pool_id = ATOMIC_INIT(0);
+static const struct file_operations zs_stat_fops;
+#endif
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage which wastes the least space at
+ * the end of the zspage for objects of the given size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	/* zspage order which gives maximum used size per KB */
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static struct zspage *get_zspage(struct page *page)
+{
+	return (struct zspage *)page_private(page);
+}
+
+static unsigned long location_to_obj(struct zspage *zspage,
+				unsigned int obj_idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS;
+	obj |= obj_idx & OBJ_INDEX_MASK;
+
+	return obj << OBJ_TAG_BITS;
+}
+
+static unsigned int obj_to_idx(unsigned long obj)
+{
+	return (obj >> OBJ_TAG_BITS) & OBJ_INDEX_MASK;
+}
+
+static void obj_to_location(unsigned long obj, struct zspage **zspage,
+				unsigned int *obj_idx)
+{
+	*zspage = get_zspage(pfn_to_page(obj >> OBJ_TAG_BITS >>
+					OBJ_INDEX_BITS));
+	*obj_idx = obj_to_idx(obj);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~BIT(HANDLE_PIN_BIT);
+}
+
+/* Store a new location, keeping the pin bit if the handle is pinned */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *slot = (unsigned long *)handle;
+
+	*slot = obj | (*slot & BIT(HANDLE_PIN_BIT));
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+/*
+ * Map the header word of an object. The header never spans two pages
+ * since object offsets are multiples of ZS_ALIGN.
+ */
+static unsigned long *obj_header_map(struct size_class *class,
+			struct zspage *zspage, unsigned int obj_idx)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	return addr + (off & ~PAGE_MASK);
+}
+
+static void obj_header_unmap(unsigned long *header)
+{
+	kunmap_atomic(header, KM_USER0);
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	int inuse = zspage->inuse;
+	int max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= max_objects * (fullness_threshold_frac - 1) /
+				fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+				enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness == ZS_EMPTY)
+		return;
+
+	list_add(&zspage->list, &class->fullness_list[fullness]);
+	class->nr_zspages[fullness]++;
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness == ZS_EMPTY)
+		return;
+
+	list_del_init(&zspage->list);
+	class->nr_zspages[zspage->fullness]--;
+}
+
+/*
+ * Move a zspage to the list matching its current usage. Returns the new
+ * fullness group; ZS_EMPTY zspages are left off all lists for the
+ * caller to free. Caller must hold class->lock.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	remove_zspage(class, zspage);
+	insert_zspage(class, zspage, newfg);
+
+	return newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kmem_cache_free(zspage_cachep, zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/*
+ * Allocate a zspage for the given class and thread all its objects onto
+ * the free list.
+ */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	int i;
+	unsigned long *header;
+	struct zspage *zspage;
+
+	zspage = kmem_cache_zalloc(zspage_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+		set_page_private(zspage->pages[i], (unsigned long)zspage);
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class_idx = class->index;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		header = obj_header_map(class, zspage, i);
+		*header = (unsigned long)(i + 1) << OBJ_TAG_BITS;
+		obj_header_unmap(header);
+	}
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kmem_cache_free(zspage_cachep, zspage);
+	return NULL;
+}
+
+/* Caller must hold class->lock and zspage must have a free object */
+static unsigned long obj_malloc(struct size_class *class,
+			struct zspage *zspage, unsigned long handle)
+{
+	unsigned int obj_idx;
+	unsigned long *header;
+
+	obj_idx = zspage->freeobj;
+	header = obj_header_map(class, zspage, obj_idx);
+	zspage->freeobj = *header >> OBJ_TAG_BITS;
+	*header = handle | OBJ_ALLOCATED_TAG;
+	obj_header_unmap(header);
+
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return location_to_obj(zspage, obj_idx);
+}
+
+/* Caller must hold class->lock */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx)
+{
+	unsigned long *header;
+
+	header = obj_header_map(class, zspage, obj_idx);
+	*header = (unsigned long)zspage->freeobj << OBJ_TAG_BITS;
+	obj_header_unmap(header);
+
+	zspage->freeobj = obj_idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/*
+ * Copy len bytes between buf and the zspage, starting at byte offset off
+ * of the zspage. The range may cross page boundaries.
+ */
+static void zs_copy(struct zspage *zspage, unsigned long off, char *buf,
+			int len, int to_buf)
+{
+	int sz;
+	char *addr;
+
+	while (len) {
+		sz = min_t(int, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+		if (to_buf)
+			memcpy(buf, addr + (off & ~PAGE_MASK), sz);
+		else
+			memcpy(addr + (off & ~PAGE_MASK), buf, sz);
+		kunmap_atomic(addr, KM_USER0);
+
+		off += sz;
+		buf += sz;
+		len -= sz;
+	}
+}
+
+/* Copy the payload of an object to another slot of the same class */
+static void zs_object_copy(struct size_class *class,
+			struct zspage *d_zspage, unsigned int d_idx,
+			struct zspage *s_zspage, unsigned int s_idx)
+{
+	int sz, remain;
+	char *s_addr, *d_addr;
+	unsigned long s_off, d_off;
+
+	s_off = (unsigned long)s_idx * class->size + ZS_HANDLE_SIZE;
+	d_off = (unsigned long)d_idx * class->size + ZS_HANDLE_SIZE;
+	remain = class->size - ZS_HANDLE_SIZE;
+
+	while (remain) {
+		sz = min3(remain, (int)(PAGE_SIZE - (s_off & ~PAGE_MASK)),
+				(int)(PAGE_SIZE - (d_off & ~PAGE_MASK)));
+
+		s_addr = kmap_atomic(s_zspage->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(d_zspage->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + (d_off & ~PAGE_MASK),
+			s_addr + (s_off & ~PAGE_MASK), sz);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += sz;
+		d_off += sz;
+		remain -= sz;
+	}
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool; its debugfs statistics are in <name>-<id>
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+	struct size_class *prev_class = NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->name = kstrdup(name, GFP_KERNEL);
+	if (!pool->name)
+		goto fail;
+
+	/*
+	 * Walk the classes from the largest down so that a class with the
+	 * same zspage geometry as the next larger one can share it.
+	 */
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		int j, size, pages_per_zspage, objs_per_zspage;
+		struct size_class *class;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_ALLOC_SIZE)
+			size = ZS_MAX_ALLOC_SIZE;
+		pages_per_zspage = get_pages_per_zspage(size);
+		objs_per_zspage = pages_per_zspage * PAGE_SIZE / size;
+
+		if (prev_class &&
+			prev_class->pages_per_zspage == pages_per_zspage &&
+			prev_class->objs_per_zspage == objs_per_zspage) {
+			pool->size_class[i] = prev_class;
+			continue;
+		}
+
+		class = kzalloc(sizeof(*class), GFP_KERNEL);
+		if (!class)
+			goto fail;
+
+		class->size = size;
+		class->index = i;
+		class->pages_per_zspage = pages_per_zspage;
+		class->objs_per_zspage = objs_per_zspage;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+
+		pool->size_class[i] = class;
+		prev_class = class;
+	}
+
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+#ifdef CONFIG_DEBUG_FS
+	if (zs_stat_root) {
+		char stat_name[32];
+
+		/* Several pools may share a name, e.g. a re-created zram */
+		snprintf(stat_name, sizeof(stat_name), "%s-%d", pool->name,
+			atomic_inc_return(&zs_pool_id));
+		pool->stat_dentry = debugfs_create_file(stat_name, S_IRUGO,
+					zs_stat_root, pool, &zs_stat_fops);
+		if (IS_ERR_OR_NULL(pool->stat_dentry)) {
+			pr_warn("zsmalloc: no debugfs stats for pool %s\n",
+				stat_name);
+			pool->stat_dentry = NULL;
+		}
+	}
+#endif
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+	struct zspage *zspage, *tmp;
+
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove(pool->stat_dentry);
+#endif
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (!class || class->index != i)
+			continue;
+
+		for (fg = ZS_ALMOST_EMPTY; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+		kfree(class);
+	}
+
+	kfree(pool->name);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(handle_cachep,
+					pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	*(unsigned long *)handle = 0;
+
+	class = pool->size_class[get_size_class_index(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+		zspage = list_first_entry(&class->fullness_list[ZS_ALMOST_FULL],
+					struct zspage, list);
+	else if (!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+		zspage = list_first_entry(
+				&class->fullness_list[ZS_ALMOST_EMPTY],
+				struct zspage, list);
+	else
+		zspage = NULL;
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(handle_cachep, (void *)handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		insert_zspage(class, zspage, ZS_EMPTY);
+		class->zspages++;
+	}
+
+	/*
+	 * The handle must point to the object before class->lock is
+	 * dropped, since compaction finds handles through object headers.
+	 */
+	record_obj(handle, obj_malloc(class, zspage, handle));
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int obj_idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Pinning keeps compaction from moving the object under us */
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &zspage, &obj_idx);
+	class = pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, obj_idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+
+	kmem_cache_free(handle_cachep, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object will be accessed
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object. The object cannot be moved while it is mapped,
+ * and the caller must not sleep until it is unmapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned int obj_idx;
+	unsigned long off;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &zspage, &obj_idx);
+	class = pool->size_class[zspage->class_idx];
+	off = (unsigned long)obj_idx * class->size;
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+
+	if ((off & ~PAGE_MASK) + class->size <= PAGE_SIZE) {
+		/* This object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vm_addr + (off & ~PAGE_MASK) + ZS_HANDLE_SIZE;
+	}
+
+	/* The object spans two pages: work on a copy */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy(zspage, off + ZS_HANDLE_SIZE, area->vm_buf,
+			class->size - ZS_HANDLE_SIZE, 1);
+
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int obj_idx;
+	unsigned long off;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		obj_to_location(handle_to_obj(handle), &zspage, &obj_idx);
+		class = pool->size_class[zspage->class_idx];
+		off = (unsigned long)obj_idx * class->size;
+
+		zs_copy(zspage, off + ZS_HANDLE_SIZE, area->vm_buf,
+			class->size - ZS_HANDLE_SIZE, 0);
+	}
+	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/* Number of zspages that could be freed by packing this class tightly */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_allocated;
+
+	obj_allocated = class->zspages * class->objs_per_zspage;
+	return (obj_allocated - class->objs_inuse) / class->objs_per_zspage;
+}
+
+static struct zspage *isolate_target_zspage(struct size_class *class)
+{
+	struct zspage *zspage = NULL;
+
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+		zspage = list_first_entry(&class->fullness_list[ZS_ALMOST_FULL],
+					struct zspage, list);
+	else if (!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+		zspage = list_first_entry(
+				&class->fullness_list[ZS_ALMOST_EMPTY],
+				struct zspage, list);
+
+	if (zspage)
+		remove_zspage(class, zspage);
+
+	return zspage;
+}
+
+static void putback_zspage(struct size_class *class, struct zspage *zspage)
+{
+	insert_zspage(class, zspage, get_fullness_group(class, zspage));
+}
+
+/*
+ * Move all objects of src into other zspages of the class. Returns 0
+ * if src was emptied, or -EAGAIN if an object was pinned or there was
+ * no room left for it. Caller must hold class->lock.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src,
+			struct zspage **dst)
+{
+	unsigned int obj_idx;
+	unsigned long *header, handle, obj;
+
+	for (obj_idx = 0; src->inuse &&
+			obj_idx < class->objs_per_zspage; obj_idx++) {
+		header = obj_header_map(class, src, obj_idx);
+		handle = *header;
+		obj_header_unmap(header);
+
+		if (!(handle & OBJ_ALLOCATED_TAG))
+			continue;
+		handle &= ~OBJ_ALLOCATED_TAG;
+
+		/* Object is mapped by someone or being freed */
+		if (!trypin_tag(handle))
+			return -EAGAIN;
+
+		if (!*dst) {
+			*dst = isolate_target_zspage(class);
+			if (!*dst) {
+				unpin_tag(handle);
+				return -EAGAIN;
+			}
+		}
+
+		obj = obj_malloc(class, *dst, handle);
+		zs_object_copy(class, *dst, obj_to_idx(obj), src, obj_idx);
+		record_obj(handle, obj);
+		unpin_tag(handle);
+		obj_free(class, src, obj_idx);
+
+		if ((*dst)->inuse == class->objs_per_zspage) {
+			putback_zspage(class, *dst);
+			*dst = NULL;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	int ret;
+	unsigned long freed = 0;
+	struct zspage *src, *dst = NULL;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		if (list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+			break;
+
+		/* Drain the emptiest-looking zspage: the last one added */
+		src = list_entry(class->fullness_list[ZS_ALMOST_EMPTY].prev,
+				struct zspage, list);
+		remove_zspage(class, src);
+
+		ret = migrate_zspage(class, src, &dst);
+
+		if (!src->inuse) {
+			src->fullness = ZS_EMPTY;
+			class->zspages--;
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+		} else {
+			putback_zspage(class, src);
+		}
+
+		if (ret)
+			break;
+	}
+
+	if (dst)
+		putback_zspage(class, dst);
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Migrate objects to release partially used zspages.
+ * @pool: pool to compact
+ *
+ * Objects which are mapped while compaction runs are left in place.
+ * Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class->index != i)
+			continue;
+
+		freed += __zs_compact(pool, class);
+		cond_resched();
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Per-class fragmentation report in <debugfs>/zsmalloc/<pool name>-<id>.
+ * "wasted" is the space in allocated zspages not used by any object.
+ */
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long almost_empty, almost_full, full;
+	unsigned long obj_allocated, obj_used, pages_used, freeable;
+	unsigned long total_allocated = 0, total_used = 0;
+	unsigned long total_pages = 0, total_freeable = 0;
+
+	seq_printf(s, " %5s %5s %12s %11s %4s %13s %10s %10s %9s %8s\n",
+		"class", "size", "almost_empty", "almost_full", "full",
+		"obj_allocated", "obj_used", "pages_used", "wasted_kb",
+		"freeable");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class->index != i)
+			continue;
+
+		spin_lock(&class->lock);
+		almost_empty = class->nr_zspages[ZS_ALMOST_EMPTY];
+		almost_full = class->nr_zspages[ZS_ALMOST_FULL];
+		full = class->nr_zspages[ZS_FULL];
+		obj_allocated = class->zspages * class->objs_per_zspage;
+		obj_used = class->objs_inuse;
+		freeable = zs_can_compact(class) * class->pages_per_zspage;
+		spin_unlock(&class->lock);
+
+		pages_used = obj_allocated / class->objs_per_zspage *
+				class->pages_per_zspage;
+
+		seq_printf(s, " %5d %5d %12lu %11lu %4lu %13lu %10lu %10lu "
+			"%9lu %8lu\n", i, class->size, almost_empty,
+			almost_full, full, obj_allocated, obj_used,
+			pages_used, ((pages_used << PAGE_SHIFT) -
+				obj_used * class->size) >> 10, freeable);
+
+		total_allocated += obj_allocated;
+		total_used += obj_used;
+		total_pages += pages_used;
+		total_freeable += freeable;
+	}
+
+	seq_printf(s, "\n %5s %5s %12s %11s %4s %13lu %10lu %10lu %9s %8lu\n",
+		"Total", "", "", "", "", total_allocated, total_used,
+		total_pages, "", total_freeable);
+	seq_printf(s, "pages_compacted: %ld\n",
+		atomic_long_read(&pool->pages_compacted));
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stat_fops = {
+	.open		= zs_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+		per_cpu(zs_map_area, cpu).vm_buf = NULL;
+	}
+}
+
+static void zs_exit(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove(zs_stat_root);
+#endif
+	zs_free_map_areas();
+	if (zspage_cachep)
+		kmem_cache_destroy(zspage_cachep);
+	if (handle_cachep)
+		kmem_cache_destroy(handle_cachep);
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	zspage_cachep = kmem_cache_create("zspage", sizeof(struct zspage),
+					0, 0, NULL);
+	if (!handle_cachep || !zspage_cachep)
+		goto fail;
+
+	/* Objects spanning two pages are copied through these buffers */
+	for_each_possible_cpu(cpu) {
+		per_cpu(zs_map_area, cpu).vm_buf = kmalloc(PAGE_SIZE,
+							GFP_KERNEL);
+		if (!per_cpu(zs_map_area, cpu).vm_buf)
+			goto fail;
+	}
+
+#ifdef CONFIG_DEBUG_FS
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_stat_root))
+		zs_stat_root = NULL;
+#endif
+
+	return 0;
+
+fail:
+	zs_exit();
+	return -ENOMEM;
+}
+
+static void __exit zs_module_exit(void)
+{
+	zs_exit();
+}
+
+module_init(zs_init);
+module_exit(zs_module_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Nitin Gupta <ngupta@vflare.org>");
+MODULE_DESCRIPTION("zsmalloc memory allocator");
@@ -0,0 +1,137 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * Objects are packed into "zspages": groups of up to
+ * ZS_MAX_PAGES_PER_ZSPAGE 0-order pages which need not be physically
+ * contiguous. An object may span the boundary between two pages of its
+ * zspage; such objects are copied through a per-cpu buffer when mapped.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Every object starts with a header word. For allocated objects it holds
+ * the handle (with OBJ_ALLOCATED_TAG set) so that compaction can find and
+ * update the handle of an object it moves. For free objects it holds the
+ * index of the next free object in the zspage.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS		1
+
+/*
+ * An object location ("obj") is the pfn of the first page of its zspage
+ * and the object's index within that zspage, shifted left by
+ * OBJ_TAG_BITS so that bit 0 of a handle slot is free for HANDLE_PIN_BIT.
+ */
+#define OBJ_INDEX_BITS		10
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+/* Set in a handle slot while its object is mapped or being migrated */
+#define HANDLE_PIN_BIT		0
+
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+
+/* ZS_MIN_ALLOC_SIZE must be a multiple of ZS_ALIGN */
+#define ZS_ALIGN		16
+#define ZS_MIN_ALLOC_SIZE \
+	MAX(32, (ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT >> OBJ_INDEX_BITS))
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart: 16 bytes for 4K
+ * pages. Classes which end up with the same zspage geometry are merged,
+ * so the number of distinct classes is much lower than ZS_SIZE_CLASSES.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is ZS_ALMOST_EMPTY while at most 3/4 of its objects are in
+ * use; these are the source pages for compaction. Allocation prefers
+ * ZS_ALMOST_FULL zspages to keep the others draining.
+ */
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+static const int fullness_threshold_frac = 4;
+
+struct zspage {
+	struct list_head list;		/* entry in class fullness list */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int freeobj;		/* index of first free object */
+	unsigned int class_idx;
+	enum fullness_group fullness;
+};
+
+struct size_class {
+	/*
+	 * Size of objects stored in this class. Must be multiple
+	 * of ZS_ALIGN.
+	 */
+	int size;
+	unsigned int index;
+
+	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* Stats, protected by lock */
+	unsigned long nr_zspages[_ZS_NR_FULLNESS_GROUPS];
+	unsigned long zspages;		/* total zspages in this class */
+	unsigned long objs_inuse;	/* total allocated objects */
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;	/* allocation flags used for zspage pages */
+
+	struct size_class *size_class[ZS_SIZE_CLASSES];
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;	/* pages freed by zs_compact() */
+
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *stat_dentry;
+#endif
+};
+
+/*
+ * Per-cpu state of the current mapping. Objects that lie within one
+ * page are kmap'ed directly (vm_addr); objects spanning two pages are
+ * copied into vm_buf.
+ */
+struct mapping_area {
+	char *vm_buf;
+	char *vm_addr;
+	enum zs_mapmode vm_mm;
+};
+
+#endif
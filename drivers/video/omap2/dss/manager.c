@@ -565,6 +565,10 @@ struct manager_cache_data {
 	 * registers. Set when writing to shadow registers, cleared at
 	 * VSYNC/EVSYNC */
 	bool shadow_dirty;
+	/* If true, the manager registers already hold the cached settings,
+	 * so applying only needs to pass on the callbacks. Set when
+	 * registers written, cleared in apply() if the settings change. */
+	bool regs_current;
 
 	u32 default_color;
 
@@ -1292,12 +1296,20 @@ static int configure_dispc(void)
 				used_ovls++;
 		}
 
-		configure_manager(i);
+		/*
+		 * Unchanged settings need no register writes and no GO: the
+		 * callbacks are still completed at the next VSYNC, as nothing
+		 * is busy.
+		 */
+		if (!mc->regs_current || mc->manual_update) {
+			configure_manager(i);
+			mc->regs_current = true;
+			mgr_go[i] = true;
+		}
 		dss_ovl_configure_cb(&mc->cb, i, used_ovls);
 
 		mc->dirty = false;
 		mc->shadow_dirty = true;
-		mgr_go[i] = true;
 	}
 
 	if (dss_has_feature(FEAT_OVL_WB)) {
@@ -1893,6 +1905,54 @@ int omap_dss_manager_unregister_callback(struct omap_overlay_manager *mgr,
 	return r;
 }
 
+/* returns true if the manager registers would not change */
+static bool mgr_info_matches_cache(struct omap_overlay_manager_info *info,
+				   struct manager_cache_data *mc)
+{
+	return mc->default_color == info->default_color &&
+		mc->trans_key_type == info->trans_key_type &&
+		mc->trans_key == info->trans_key &&
+		mc->trans_enabled == info->trans_enabled &&
+		mc->alpha_enabled == info->alpha_enabled &&
+		mc->cpr_enable == info->cpr_enable &&
+		!memcmp(&mc->cpr_coefs, &info->cpr_coefs,
+			sizeof(mc->cpr_coefs));
+}
+
+/*
+ * returns true if two overlay infos differ only in their callback. The
+ * fields are compared one by one: the struct has padding, which callers
+ * building it on the stack leave uninitialized.
+ */
+static bool ovl_info_same(struct omap_overlay_info *a,
+			  struct omap_overlay_info *b)
+{
+	return a->enabled == b->enabled &&
+		a->paddr == b->paddr &&
+		a->vaddr == b->vaddr &&
+		a->p_uv_addr == b->p_uv_addr &&
+		a->screen_width == b->screen_width &&
+		a->width == b->width &&
+		a->height == b->height &&
+		a->color_mode == b->color_mode &&
+		a->rotation == b->rotation &&
+		a->rotation_type == b->rotation_type &&
+		a->mirror == b->mirror &&
+		a->pos_x == b->pos_x &&
+		a->pos_y == b->pos_y &&
+		a->out_width == b->out_width &&
+		a->out_height == b->out_height &&
+		a->global_alpha == b->global_alpha &&
+		a->pre_mult_alpha == b->pre_mult_alpha &&
+		a->wb_source == b->wb_source &&
+		a->zorder == b->zorder &&
+		a->min_x_decim == b->min_x_decim &&
+		a->max_x_decim == b->max_x_decim &&
+		a->min_y_decim == b->min_y_decim &&
+		a->max_y_decim == b->max_y_decim &&
+		!memcmp(&a->cconv, &b->cconv, sizeof(a->cconv));
+}
+
 static int omap_dss_mgr_apply(struct omap_overlay_manager *mgr)
 {
 	struct overlay_cache_data *oc;
@@ -2033,6 +2093,7 @@ static int omap_dss_mgr_apply(struct omap_overlay_manager *mgr)
 	if (mgr->device_changed) {
 		mgr->device_changed = false;
 		mgr->info_dirty  = true;
+		mc->regs_current = false;
 	}
 
 	if (!mgr->info_dirty)
@@ -2057,6 +2118,9 @@ static int omap_dss_mgr_apply(struct omap_overlay_manager *mgr)
 	mgr->info_dirty = false;
 	mc->dirty = true;
 
+	if (!mgr_info_matches_cache(&mgr->info, mc))
+		mc->regs_current = false;
+
 	mc->default_color = mgr->info.default_color;
 	mc->trans_key_type = mgr->info.trans_key_type;
 	mc->trans_key = mgr->info.trans_key;
@@ -2314,6 +2378,17 @@ int omap_dss_ovl_set_info(struct omap_overlay *ovl,
 	unsigned long flags;
 
 	spin_lock_irqsave(&dss_cache.lock, flags);
+
+	/*
+	 * Keep the overlay clean if its applied settings do not change, so
+	 * that the next apply does not reprogram it.
+	 */
+	if (!ovl->info_dirty && !info->cb.fn && ovl->manager &&
+	    !ovl->manager->device_changed && ovl_info_same(&ovl->info, info)) {
+		spin_unlock_irqrestore(&dss_cache.lock, flags);
+		return 0;
+	}
+
 	old_info = ovl->info;
 	ovl->info = *info;
 
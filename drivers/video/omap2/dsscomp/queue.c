@@ -24,6 +24,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/ratelimit.h>
+#include <linux/completion.h>
 
 #include <video/omapdss.h>
 #include <video/dsscomp.h>
@@ -34,7 +35,14 @@
 #include "dsscomp.h"
 /* queue state */
 
-static DEFINE_MUTEX(mtx);
+/*
+ * Locking: each manager has its own mutexes, so displays do not wait for
+ * each other.  mgrq[].mtx protects the compositions on the manager and is
+ * only held briefly.  mgrq[].apply_mtx serializes programming the manager
+ * with blanking it.  Overlays can move between managers, so the overlay
+ * queue masks of all managers are protected by qlock.
+ */
+static DEFINE_SPINLOCK(qlock);
 
 /* free overlay structs */
 struct maskref {
@@ -42,12 +50,45 @@ struct maskref {
 	u32 refs[MAX_OVERLAYS];
 };
 
+/* stages of applying a composition */
+enum dsscomp_stage {
+	DSSCOMP_STAGE_BUILD,	/* setting up overlays and manager */
+	DSSCOMP_STAGE_WAIT,	/* waiting for the prior frame to program */
+	DSSCOMP_STAGE_PROGRAM,	/* applying the manager */
+	DSSCOMP_STAGE_UPDATE,	/* updating a manual update panel */
+	DSSCOMP_NUM_STAGES,
+};
+
+#ifdef CONFIG_DSSCOMP_DEBUG_LOG
+static const char * const stage_names[DSSCOMP_NUM_STAGES] = {
+	"build", "wait", "program", "update",
+};
+
+struct stage_time {
+	u32 last, max;		/* in usecs */
+};
+#endif
+
 static struct {
 	struct workqueue_struct *apply_workq;
+	struct mutex mtx;		/* compositions on this manager */
+	struct mutex apply_mtx;		/* programming this manager */
 
 	u32 ovl_mask;		/* overlays used on this display */
 	struct maskref ovl_qmask;		/* overlays queued to this display */
 	bool blanking;
+
+	/*
+	 * Last composition applied, until the DSS programs it.  The next
+	 * composition is built while this one waits for VSYNC, and only
+	 * waits for it before applying the manager.
+	 */
+	dsscomp_t programming;
+	struct completion programmed;
+
+#ifdef CONFIG_DSSCOMP_DEBUG_LOG
+	struct stage_time time[DSSCOMP_NUM_STAGES];
+#endif
 } mgrq[MAX_MANAGERS];
 
 static struct workqueue_struct *cb_wkq;		/* callback work queue */
@@ -77,6 +118,23 @@ static inline void __log_state(dsscomp_t c, void *fn, u32 ev)
 }
 #define log_state(c, fn, ev) DO_IF_DEBUG_FS(__log_state(c, fn, ev))
 
+/* record how long a stage of applying a composition took */
+static inline void __log_stage(dsscomp_t c, enum dsscomp_stage stage,
+			       ktime_t start)
+{
+#ifdef CONFIG_DSSCOMP_DEBUG_LOG
+	struct stage_time *st = mgrq[c->ix].time + stage;
+	u32 us = (u32) ktime_to_us(ktime_sub(ktime_get(), start));
+
+	st->last = us;
+	if (us > st->max)
+		st->max = us;
+	__log_event(20 * c->ix + 20, 0, c, "%s took %u us",
+				(u32) stage_names[stage], us);
+#endif
+}
+#define log_stage(c, stage, start) DO_IF_DEBUG_FS(__log_stage(c, stage, start))
+
 static inline void maskref_incbit(struct maskref *om, u32 ix)
 {
 	om->refs[ix]++;
@@ -129,6 +187,9 @@ int dsscomp_queue_init(struct dsscomp_dev *cdev_)
 		mgrq[i].apply_workq = create_singlethread_workqueue("dsscomp_apply");
 		if (!mgrq[i].apply_workq)
 			goto error;
+		mutex_init(&mgrq[i].mtx);
+		mutex_init(&mgrq[i].apply_mtx);
+		init_completion(&mgrq[i].programmed);
 
 		/* record overlays on this display */
 		mgr = cdev->mgrs[i];
@@ -239,10 +300,10 @@ u32 dsscomp_get_ovls(dsscomp_t comp)
 {
 	u32 mask;
 
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	mask = comp->ovl_mask;
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	return mask;
 }
@@ -255,13 +316,12 @@ int dsscomp_set_ovl(dsscomp_t comp, struct dss2_ovl_info *ovl)
 	u32 i, mask, oix, ix;
 	struct omap_overlay *o;
 
-	mutex_lock(&mtx);
+	ix = comp->ix;
+	mutex_lock(&mgrq[ix].mtx);
 
 	BUG_ON(!ovl);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
-	ix = comp->ix;
-
 	if (ovl->cfg.ix >= cdev->num_ovls && ovl->cfg.ix != OMAP_DSS_WB) {
 		r = -EINVAL;
 		goto done;
@@ -281,34 +341,38 @@ int dsscomp_set_ovl(dsscomp_t comp, struct dss2_ovl_info *ovl)
 		if (comp->frm.num_ovls >= ARRAY_SIZE(comp->ovls))
 			goto done;
 
-		/* not in any other displays queue */
+		/* disabled (unless forced) if on another manager */
+		o = cdev->ovls[ovl->cfg.ix];
+		if (ovl->cfg.ix != OMAP_DSS_WB) {
+			if (o->info.enabled &&
+			   (!o->manager || o->manager->id != ix))
+				goto done;
+		}
+
+		/* and not in any other displays queue */
+		spin_lock(&qlock);
 		if (mask & ~mgrq[ix].ovl_qmask.mask) {
 			for (i = 0; i < cdev->num_mgrs; i++) {
 				if (i == ix)
 					continue;
-				if (mgrq[i].ovl_qmask.mask & mask)
+				if (mgrq[i].ovl_qmask.mask & mask) {
+					spin_unlock(&qlock);
 					goto done;
+				}
 			}
 		}
 
-		/* and disabled (unless forced) if on another manager */
-		o = cdev->ovls[ovl->cfg.ix];
-		if (ovl->cfg.ix != OMAP_DSS_WB) {
-			if (o->info.enabled &&
-			   (!o->manager || o->manager->id != ix))
-				goto done;
-		}
-
 		/* add overlay to composition & display */
+		maskref_incbit(&mgrq[ix].ovl_qmask, ovl->cfg.ix);
+		spin_unlock(&qlock);
 		comp->ovl_mask |= mask;
 		oix = comp->frm.num_ovls++;
-		maskref_incbit(&mgrq[ix].ovl_qmask, ovl->cfg.ix);
 	}
 
 	comp->ovls[oix] = *ovl;
 	r = 0;
 done:
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[ix].mtx);
 
 	return r;
 }
@@ -320,7 +384,7 @@ int dsscomp_get_ovl(dsscomp_t comp, u32 ix, struct dss2_ovl_info *ovl)
 	int r;
 	u32 oix;
 
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 
 	BUG_ON(!ovl);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
@@ -339,7 +403,7 @@ int dsscomp_get_ovl(dsscomp_t comp, u32 ix, struct dss2_ovl_info *ovl)
 		r = -ENOENT;
 	}
 
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	return r;
 }
@@ -348,14 +412,14 @@ EXPORT_SYMBOL(dsscomp_get_ovl);
 /* set manager info */
 int dsscomp_set_mgr(dsscomp_t comp, struct dss2_mgr_info *mgr)
 {
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	BUG_ON(mgr->ix != comp->frm.mgr.ix);
 
 	comp->frm.mgr = *mgr;
 
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	return 0;
 }
@@ -364,14 +428,14 @@ EXPORT_SYMBOL(dsscomp_set_mgr);
 /* get manager info */
 int dsscomp_get_mgr(dsscomp_t comp, struct dss2_mgr_info *mgr)
 {
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 
 	BUG_ON(!mgr);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
 	*mgr = comp->frm.mgr;
 
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	return 0;
 }
@@ -381,14 +445,14 @@ EXPORT_SYMBOL(dsscomp_get_mgr);
 int dsscomp_setup(dsscomp_t comp, enum dsscomp_setup_mode mode,
 			struct dss2_rect_t win)
 {
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
 	comp->frm.mode = mode;
 	comp->frm.win = win;
 
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	return 0;
 }
@@ -402,8 +466,11 @@ EXPORT_SYMBOL(dsscomp_setup);
 void dsscomp_drop(dsscomp_t comp)
 {
 	/* decrement unprogrammed references */
-	if (comp->state < DSSCOMP_STATE_PROGRAMMED)
+	if (comp->state < DSSCOMP_STATE_PROGRAMMED) {
+		spin_lock(&qlock);
 		maskref_decmask(&mgrq[comp->ix].ovl_qmask, comp->ovl_mask);
+		spin_unlock(&qlock);
+	}
 	comp->state = 0;
 
 	if (debug & DEBUG_COMPOSITIONS)
@@ -424,10 +491,10 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 
 	kmem_cache_free(dsscomp_cb_wk_cachep, wk);
 
-	mutex_lock(&mtx);
+	ix = comp->ix;
+	mutex_lock(&mgrq[ix].mtx);
 
 	BUG_ON(comp->state == DSSCOMP_STATE_ACTIVE);
-	ix = comp->ix;
 
 	/* call extra callbacks if requested */
 	if (comp->extra_cb)
@@ -440,7 +507,9 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 
 		/* update used overlay mask */
 		mgrq[ix].ovl_mask = comp->ovl_mask & ~comp->ovl_dmask;
+		spin_lock(&qlock);
 		maskref_decmask(&mgrq[ix].ovl_qmask, comp->ovl_mask);
+		spin_unlock(&qlock);
 
 		if (debug & DEBUG_PHASES)
 			dev_info(DEV(cdev), "[%p] programmed\n", comp);
@@ -458,13 +527,19 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 				(u32) log_status_str(status));
 		dsscomp_drop(comp);
 	}
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[ix].mtx);
 }
 
 u32 dsscomp_mgr_callback(void *data, int id, int status)
 {
 	struct dsscomp_data *comp = data;
 
+	/* the next composition on this manager can now be applied */
+	if ((status == DSS_COMPLETION_PROGRAMMED ||
+	     (status & DSS_COMPLETION_RELEASED)) &&
+	    cmpxchg(&mgrq[comp->ix].programming, comp, NULL) == comp)
+		complete(&mgrq[comp->ix].programmed);
+
 	if (status == DSS_COMPLETION_PROGRAMMED ||
 	    (status == DSS_COMPLETION_DISPLAYED &&
 	     comp->state != DSSCOMP_STATE_DISPLAYED) ||
@@ -497,6 +572,21 @@ static inline bool dssdev_manually_updated(struct omap_dss_device *dev)
 		dev->driver->get_update_mode(dev) != OMAP_DSS_UPDATE_AUTO;
 }
 
+/* (must have apply_mtx) wait until the prior composition is programmed */
+static void dsscomp_wait_programmed(u32 ix)
+{
+	if (!mgrq[ix].programming)
+		return;
+
+	if (!wait_for_completion_timeout(&mgrq[ix].programmed,
+					 msecs_to_jiffies(100))) {
+		pr_info_ratelimited("dsscomp: [%p] not programmed in time\n",
+							mgrq[ix].programming);
+		/* do not hold up the display */
+		xchg(&mgrq[ix].programming, NULL);
+	}
+}
+
 /* apply composition */
 /* at this point the composition is not on any queue */
 int dsscomp_apply(dsscomp_t comp)
@@ -514,6 +604,8 @@ int dsscomp_apply(dsscomp_t comp)
 	bool cb_programmed = false;
 	bool wb_apply = false;
 	bool m2m_mgr_mode = false;
+	bool pipelined;
+	ktime_t t_start = ktime_get();
 
 	struct omapdss_ovl_cb cb = {
 		.fn = dsscomp_mgr_callback,
@@ -619,7 +711,7 @@ int dsscomp_apply(dsscomp_t comp)
 			}
 
 			if (ovl->manager != mgr) {
-				mutex_lock(&mtx);
+				mutex_lock(&mgrq[comp->ix].apply_mtx);
 				if (!mgrq[comp->ix].blanking || m2m_mgr_mode) {
 					/*
 					 * Ideally, we should call
@@ -641,7 +733,7 @@ int dsscomp_apply(dsscomp_t comp)
 						, mgr->name, oi->cfg.ix);
 					r = -ENODEV;
 				}
-				mutex_unlock(&mtx);
+				mutex_unlock(&mgrq[comp->ix].apply_mtx);
 
 				if (r)
 					goto skip_ovl_set;
@@ -691,10 +783,10 @@ skip_ovl_set:
 			if ((~comp->ovl_mask & mask) &&
 			    cdev->ovls[i]->info.enabled &&
 			    cdev->ovls[i]->manager == mgr) {
-				mutex_lock(&mtx);
+				spin_lock(&qlock);
 				comp->ovl_mask |= mask;
 				maskref_incbit(&mgrq[comp->ix].ovl_qmask, i);
-				mutex_unlock(&mtx);
+				spin_unlock(&qlock);
 			}
 		}
 		/*
@@ -706,10 +798,10 @@ skip_ovl_set:
 			if ((~comp->ovl_mask & mask) &&
 			    cdev->wb_ovl->info.enabled &&
 			    cdev->wb_ovl->info.source == mgr->id) {
-				mutex_lock(&mtx);
+				spin_lock(&qlock);
 				comp->ovl_mask |= mask;
 				maskref_incbit(&mgrq[comp->ix].ovl_qmask, i);
-				mutex_unlock(&mtx);
+				spin_unlock(&qlock);
 			}
 		}
 	}
@@ -736,12 +828,30 @@ skip_ovl_set:
 			wb->register_framedone(wb);
 	}
 
-	mutex_lock(&mtx);
+	log_stage(comp, DSSCOMP_STAGE_BUILD, t_start);
+
+	/*
+	 * Frames shown on an auto-updated display are paced by VSYNC: wait
+	 * for the prior frame to be programmed before applying this one.
+	 */
+	pipelined = cb_programmed && (d->mode & DSSCOMP_SETUP_MODE_DISPLAY) &&
+		    !m2m_mgr_mode && !dssdev_manually_updated(dssdev);
+
+	mutex_lock(&mgrq[comp->ix].apply_mtx);
+	t_start = ktime_get();
+	dsscomp_wait_programmed(comp->ix);
+	log_stage(comp, DSSCOMP_STAGE_WAIT, t_start);
+
+	t_start = ktime_get();
 	if (mgrq[comp->ix].blanking && !m2m_mgr_mode) {
 		pr_info_ratelimited("ignoring apply mgr(%s) while blanking\n",
 								mgr->name);
 		r = -ENODEV;
 	} else {
+		if (pipelined) {
+			INIT_COMPLETION(mgrq[comp->ix].programmed);
+			mgrq[comp->ix].programming = comp;
+		}
 		if (wb_apply) {
 			r = omap_dss_wb_apply(mgr, cdev->wb_ovl);
 			if (r)
@@ -757,7 +867,6 @@ skip_ovl_set:
 		if (!r && !cb_programmed)
 			r = -EINVAL;
 	}
-	mutex_unlock(&mtx);
 
 	/*
 	 * TRICKY: try to unregister callback to see if callbacks have
@@ -773,6 +882,12 @@ skip_ovl_set:
 			r = 0;
 	}
 
+	/* no callback will come to let the next frame go */
+	if (r)
+		cmpxchg(&mgrq[comp->ix].programming, comp, NULL);
+	mutex_unlock(&mgrq[comp->ix].apply_mtx);
+	log_stage(comp, DSSCOMP_STAGE_PROGRAM, t_start);
+
 	/* This blanking is needed, when we received composition without WB for
 	 * disabling pipes, which are sources for manager, which is source for
 	 * WB. In this case manager apply operation is skipped and we need to
@@ -790,10 +905,16 @@ skip_ovl_set:
 	if (comp->must_apply && r)
 		mgr->blank(mgr, true);
 
+	/*
+	 * Auto-updated displays do not wait for VSYNC here: the next
+	 * composition waits for this one to be programmed instead.
+	 */
 	if (!r && (d->mode & DSSCOMP_SETUP_MODE_DISPLAY) && !m2m_mgr_mode) {
 		if (dssdev_manually_updated(dssdev) && drv->update) {
+			t_start = ktime_get();
 			r = drv->update(dssdev, d->win.x,
 					d->win.y, d->win.w, d->win.h);
+			log_stage(comp, DSSCOMP_STAGE_UPDATE, t_start);
 			if (r) {
 				/* if failed to update, kick out
 				 * prior composition
@@ -804,9 +925,10 @@ skip_ovl_set:
 				 */
 				r = 0;
 			}
-		} else
+		} else if (!pipelined) {
 			/* wait for sync to do smooth animations */
 			mgr->wait_for_vsync(mgr);
+		}
 	}
 
 done:
@@ -821,14 +943,14 @@ int dsscomp_state_notifier(struct notifier_block *nb,
 	enum omap_dss_display_state state = arg;
 	struct omap_overlay_manager *mgr = dssdev->manager;
 	if (mgr) {
-		mutex_lock(&mtx);
+		mutex_lock(&mgrq[mgr->id].apply_mtx);
 		if (state == OMAP_DSS_DISPLAY_DISABLED) {
 			mgr->blank(mgr, true);
 			mgrq[mgr->id].blanking = true;
 		} else if (state == OMAP_DSS_DISPLAY_ACTIVE) {
 			mgrq[mgr->id].blanking = false;
 		}
-		mutex_unlock(&mtx);
+		mutex_unlock(&mgrq[mgr->id].apply_mtx);
 	}
 	return 0;
 }
@@ -855,7 +977,7 @@ int dsscomp_delayed_apply(dsscomp_t comp)
 		return -ENOMEM;
 	}
 
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	comp->state = DSSCOMP_STATE_APPLYING;
@@ -863,7 +985,7 @@ int dsscomp_delayed_apply(dsscomp_t comp)
 
 	if (debug & DEBUG_PHASES)
 		dev_info(DEV(cdev), "[%p] applying\n", comp);
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	wk->comp = comp;
 	INIT_WORK(&wk->work, dsscomp_do_apply);
@@ -953,10 +1075,18 @@ void dsscomp_dbg_comps(struct seq_file *s)
 void dsscomp_dbg_events(struct seq_file *s)
 {
 #ifdef CONFIG_DSSCOMP_DEBUG_LOG
-	u32 i;
+	u32 i, j;
 	struct dbg_event_t *d;
 
 	mutex_lock(&dbg_mtx);
+	/* last and longest time of each stage of applying */
+	for (i = 0; i < cdev->num_mgrs; i++) {
+		seq_printf(s, "%s:", cdev->mgrs[i]->name);
+		for (j = 0; j < DSSCOMP_NUM_STAGES; j++)
+			seq_printf(s, " %s=%u/%uus", stage_names[j],
+				   mgrq[i].time[j].last, mgrq[i].time[j].max);
+		seq_printf(s, "\n");
+	}
 	for (i = dbg_event_ix; i < dbg_event_ix + ARRAY_SIZE(dbg_events); i++) {
 		d = dbg_events + (i % ARRAY_SIZE(dbg_events));
 		if (!d->ms)
@@ -1067,6 +1067,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lowmem_index_update(task->signal);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1202,6 +1203,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lowmem_index_update(task->signal);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
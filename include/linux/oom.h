@@ -70,6 +70,25 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/* The lowmemorykiller keeps processes indexed by oom_adj */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_index_insert(struct signal_struct *sig);
+extern void lowmem_index_remove(struct signal_struct *sig);
+extern void lowmem_index_update(struct signal_struct *sig);
+#else
+static inline void lowmem_index_insert(struct signal_struct *sig)
+{
+}
+
+static inline void lowmem_index_remove(struct signal_struct *sig)
+{
+}
+
+static inline void lowmem_index_update(struct signal_struct *sig)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
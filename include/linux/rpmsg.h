@@ -108,6 +108,19 @@ struct rpmsg_channel_info {
 	u32 dst;
 };
 
+/**
+ * struct rpmsg_tx_msg - a message built in place in a tx buffer
+ *
+ * @dst: destination address
+ * @data: payload, as returned by rpmsg_alloc_tx_buf()
+ * @len: payload length
+ */
+struct rpmsg_tx_msg {
+	u32 dst;
+	void *data;
+	int len;
+};
+
 /**
  * struct rpmsg_endpoint
  *
@@ -153,6 +166,11 @@ rpmsg_send_offchannel_raw(struct rpmsg_channel *, u32, u32, void *, int, bool);
 
 struct rproc *rpmsg_get_rproc_handle(struct rpmsg_channel *);
 
+void *rpmsg_alloc_tx_buf(struct rpmsg_channel *, int *, bool);
+void rpmsg_free_tx_buf(struct rpmsg_channel *, void *);
+int rpmsg_send_offchannel_nocopy(struct rpmsg_channel *, u32,
+					struct rpmsg_tx_msg *, int);
+
 static inline
 int rpmsg_send_offchannel(struct rpmsg_channel *rpdev, u32 src, u32 dst,
 							void *data, int len)
@@ -191,4 +209,25 @@ int rpmsg_trysendto(struct rpmsg_channel *rpdev, void *data, int len, u32 dst)
 	return rpmsg_trysend_offchannel(rpdev, rpdev->src, dst, data, len);
 }
 
+/*
+ * Zero-copy sending: the payload is written straight into a tx buffer that
+ * is shared with the remote processor, and the buffer itself is posted.
+ * Several buffers can be posted at once and the remote processor is then
+ * kicked only once.  Sending consumes the buffers, whether it succeeds or not.
+ */
+static inline
+int rpmsg_send_nocopy(struct rpmsg_channel *rpdev, void *data, int len)
+{
+	struct rpmsg_tx_msg msg = { .dst = rpdev->dst, .data = data, .len = len };
+
+	return rpmsg_send_offchannel_nocopy(rpdev, rpdev->src, &msg, 1);
+}
+
+static inline
+int rpmsg_send_batch(struct rpmsg_channel *rpdev, struct rpmsg_tx_msg *msgs,
+								int num)
+{
+	return rpmsg_send_offchannel_nocopy(rpdev, rpdev->src, msgs, num);
+}
+
 #endif /* _LINUX_RPMSG_H */
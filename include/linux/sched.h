@@ -648,6 +648,10 @@ struct signal_struct {
 	int oom_score_adj;	/* OOM kill score adjustment */
 	int oom_score_adj_min;	/* OOM kill score adjustment minimum value.
 				 * Only settable by CAP_SYS_RESOURCE. */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct rb_node lmk_node;	/* lowmemorykiller index, by lmk_adj */
+	int lmk_adj;			/* oom_adj when lmk_node was sorted */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
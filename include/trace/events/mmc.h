@@ -0,0 +1,154 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mmc
+
+#if !defined(_TRACE_MMC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MMC_H
+
+#include <linux/blkdev.h>
+#include <linux/mmc/core.h>
+#include <linux/mmc/host.h>
+#include <linux/tracepoint.h>
+
+/**
+ * mmc_blk_queue - block request taken off the queue by the mmc thread
+ * @rq: block IO operation request
+ *
+ * Called when the mmc queue thread fetches @rq from the block layer,
+ * before it is prepared and handed to the host.
+ */
+TRACE_EVENT(mmc_blk_queue,
+
+	TP_PROTO(struct request *rq),
+
+	TP_ARGS(rq),
+
+	TP_STRUCT__entry(
+		__field(  dev_t,	dev			)
+		__field(  sector_t,	sector			)
+		__field(  unsigned int,	nr_sector		)
+		__field(  int,		write			)
+	),
+
+	TP_fast_assign(
+		__entry->dev	   = rq->rq_disk ? disk_devt(rq->rq_disk) : 0;
+		__entry->sector    = blk_rq_pos(rq);
+		__entry->nr_sector = blk_rq_sectors(rq);
+		__entry->write	   = rq_data_dir(rq) == WRITE;
+	),
+
+	TP_printk("%d,%d %s %llu + %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->write ? "W" : "R",
+		  (unsigned long long)__entry->sector, __entry->nr_sector)
+);
+
+/**
+ * mmc_request_issue - request handed to the host driver
+ * @host: host the request is issued on
+ * @mrq: the request
+ *
+ * Called right before the host's request op.  @prepared tells whether
+ * pre_req already mapped the data while the previous request was running.
+ */
+TRACE_EVENT(mmc_request_issue,
+
+	TP_PROTO(struct mmc_host *host, struct mmc_request *mrq),
+
+	TP_ARGS(host, mrq),
+
+	TP_STRUCT__entry(
+		__string( name,		mmc_hostname(host)	)
+		__field(  u32,		opcode			)
+		__field(  u32,		arg			)
+		__field(  unsigned int,	blocks			)
+		__field(  unsigned int,	blksz			)
+		__field(  int,		prepared		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, mmc_hostname(host));
+		__entry->opcode	  = mrq->cmd->opcode;
+		__entry->arg	  = mrq->cmd->arg;
+		__entry->blocks	  = mrq->data ? mrq->data->blocks : 0;
+		__entry->blksz	  = mrq->data ? mrq->data->blksz : 0;
+		__entry->prepared = mrq->data && mrq->data->host_cookie;
+	),
+
+	TP_printk("%s CMD%u arg %08x %u x %u prepared=%d",
+		  __get_str(name), __entry->opcode, __entry->arg,
+		  __entry->blocks, __entry->blksz, __entry->prepared)
+);
+
+/**
+ * mmc_request_complete - host driver finished a request
+ * @host: host the request ran on
+ * @mrq: the request
+ *
+ * Called from mmc_request_done() once the request will not be retried.
+ */
+TRACE_EVENT(mmc_request_complete,
+
+	TP_PROTO(struct mmc_host *host, struct mmc_request *mrq),
+
+	TP_ARGS(host, mrq),
+
+	TP_STRUCT__entry(
+		__string( name,		mmc_hostname(host)	)
+		__field(  u32,		opcode			)
+		__field(  int,		cmd_err			)
+		__field(  int,		data_err		)
+		__field(  unsigned int,	bytes_xfered		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, mmc_hostname(host));
+		__entry->opcode	      = mrq->cmd->opcode;
+		__entry->cmd_err      = mrq->cmd->error;
+		__entry->data_err     = mrq->data ? mrq->data->error : 0;
+		__entry->bytes_xfered = mrq->data ? mrq->data->bytes_xfered : 0;
+	),
+
+	TP_printk("%s CMD%u err %d/%d bytes %u",
+		  __get_str(name), __entry->opcode, __entry->cmd_err,
+		  __entry->data_err, __entry->bytes_xfered)
+);
+
+/**
+ * mmc_blk_status_poll - wait for the card to leave programming state
+ * @rq: the write request that was just transferred
+ * @polls: number of status commands sent
+ * @us: time spent polling
+ *
+ * Called after a write once the card is ready for data again, or the
+ * poll gave up.
+ */
+TRACE_EVENT(mmc_blk_status_poll,
+
+	TP_PROTO(struct request *rq, unsigned int polls, s64 us),
+
+	TP_ARGS(rq, polls, us),
+
+	TP_STRUCT__entry(
+		__field(  dev_t,	dev			)
+		__field(  sector_t,	sector			)
+		__field(  unsigned int,	polls			)
+		__field(  s64,		us			)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= rq->rq_disk ? disk_devt(rq->rq_disk) : 0;
+		__entry->sector = blk_rq_pos(rq);
+		__entry->polls	= polls;
+		__entry->us	= us;
+	),
+
+	TP_printk("%d,%d %llu polls %u us %lld",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long long)__entry->sector, __entry->polls,
+		  __entry->us)
+);
+
+#endif /* _TRACE_MMC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
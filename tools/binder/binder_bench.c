@@ -0,0 +1,460 @@
+/*
+ * binder_bench - binder transaction throughput with N client/server pairs
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Each pair is a server process and a client process doing synchronous
+ * transactions to it as fast as it can for a fixed time; the pairs only
+ * share the driver, so the total rate shows how binder scales across
+ * CPUs.  The parent becomes the context manager to hand the servers'
+ * handles to the clients, so servicemanager must not be running
+ * ("stop servicemanager" on Android, or run before it starts).
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BB_MAP_SIZE	(128 * 1024)
+#define BB_MAX_PAIRS	64
+#define BB_BATCH	100
+
+/* transaction codes */
+enum {
+	BB_REGISTER = 1,	/* server -> context manager: my object */
+	BB_LOOKUP,		/* client -> context manager: server's handle */
+	BB_PING,		/* client -> server: one benchmark call */
+	BB_QUIT,		/* client -> server: done */
+};
+
+struct bb {
+	int fd;
+	void *map;
+	size_t out_len;
+	uint8_t out[512];	/* commands for the next BINDER_WRITE_READ */
+};
+
+struct bb_register {
+	struct flat_binder_object obj;
+	uint32_t index;
+};
+
+struct bb_result {
+	int index;
+	unsigned long count;
+	double secs;
+};
+
+static void bb_open(struct bb *b)
+{
+	struct binder_version vers;
+
+	b->fd = open("/dev/binder", O_RDWR);
+	if (b->fd < 0)
+		err(1, "open /dev/binder");
+	if (ioctl(b->fd, BINDER_VERSION, &vers) < 0)
+		err(1, "BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION)
+		errx(1, "binder protocol %ld, expected %d",
+		     vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+
+	b->map = mmap(NULL, BB_MAP_SIZE, PROT_READ, MAP_PRIVATE, b->fd, 0);
+	if (b->map == MAP_FAILED)
+		err(1, "mmap /dev/binder");
+	b->out_len = 0;
+}
+
+/* queues a command for the next write */
+static void bb_put(struct bb *b, uint32_t cmd, const void *arg, size_t size)
+{
+	if (b->out_len + sizeof(cmd) + size > sizeof(b->out))
+		errx(1, "command buffer overflow");
+	memcpy(b->out + b->out_len, &cmd, sizeof(cmd));
+	memcpy(b->out + b->out_len + sizeof(cmd), arg, size);
+	b->out_len += sizeof(cmd) + size;
+}
+
+static void bb_free(struct bb *b, const struct binder_transaction_data *tr)
+{
+	bb_put(b, BC_FREE_BUFFER, &tr->data.ptr.buffer, sizeof(void *));
+}
+
+static void bb_send(struct bb *b, uint32_t cmd, size_t handle, uint32_t code,
+		    const void *data, size_t size,
+		    const void *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	bb_put(b, cmd, &tr, sizeof(tr));
+}
+
+/* runs one BINDER_WRITE_READ; returns the bytes read into rbuf */
+static size_t bb_write_read(struct bb *b, void *rbuf, size_t rsize)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = b->out_len;
+	bwr.write_buffer = (unsigned long)b->out;
+	bwr.read_size = rsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+
+	if (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0 && errno != EINTR)
+		err(1, "BINDER_WRITE_READ");
+
+	b->out_len -= bwr.write_consumed;
+	memmove(b->out, b->out + bwr.write_consumed, b->out_len);
+	return bwr.read_consumed;
+}
+
+static void bb_flush(struct bb *b)
+{
+	while (b->out_len)
+		bb_write_read(b, NULL, 0);
+}
+
+/*
+ * Sends the queued commands and waits for the next BR_TRANSACTION or
+ * BR_REPLY, which is returned in *tr with its buffer still to be freed.
+ * Reference count requests for our own object are acknowledged.
+ */
+static uint32_t bb_wait(struct bb *b, struct binder_transaction_data *tr)
+{
+	uint32_t rbuf[64];
+
+	for (;;) {
+		size_t len = bb_write_read(b, rbuf, sizeof(rbuf));
+		uint8_t *ptr = (uint8_t *)rbuf;
+		uint8_t *end = ptr + len;
+
+		while (ptr < end) {
+			struct binder_ptr_cookie pc;
+			uint32_t cmd;
+
+			memcpy(&cmd, ptr, sizeof(cmd));
+			ptr += sizeof(cmd);
+
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				memcpy(&pc, ptr, sizeof(pc));
+				ptr += sizeof(pc);
+				bb_put(b, cmd == BR_INCREFS ? BC_INCREFS_DONE :
+				       BC_ACQUIRE_DONE, &pc, sizeof(pc));
+				break;
+			case BR_RELEASE:
+			case BR_DECREFS:
+				ptr += sizeof(pc);
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(tr, ptr, sizeof(*tr));
+				return cmd;
+			case BR_DEAD_REPLY:
+				errx(1, "target died");
+			case BR_FAILED_REPLY:
+				errx(1, "transaction failed");
+			default:
+				errx(1, "unexpected binder return 0x%x", cmd);
+			}
+		}
+	}
+}
+
+/* synchronous call; the reply buffer is freed with the next write */
+static void bb_call(struct bb *b, size_t handle, uint32_t code,
+		    const void *data, size_t size,
+		    const void *offsets, size_t offsets_size,
+		    struct binder_transaction_data *reply)
+{
+	bb_send(b, BC_TRANSACTION, handle, code, data, size,
+		offsets, offsets_size);
+	if (bb_wait(b, reply) != BR_REPLY)
+		errx(1, "unexpected incoming transaction");
+	if (reply->flags & TF_STATUS_CODE)
+		errx(1, "call %u failed", code);
+}
+
+static void server(int index)
+{
+	struct binder_transaction_data tr;
+	struct bb_register reg;
+	size_t offset = 0;
+	struct bb b;
+
+	bb_open(&b);
+	bb_put(&b, BC_ENTER_LOOPER, NULL, 0);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.obj.type = BINDER_TYPE_BINDER;
+	reg.obj.flags = 0x7f;
+	reg.obj.binder = &reg;
+	reg.index = index;
+	bb_call(&b, 0, BB_REGISTER, &reg, sizeof(reg),
+		&offset, sizeof(offset), &tr);
+	bb_free(&b, &tr);
+
+	for (;;) {
+		if (bb_wait(&b, &tr) != BR_TRANSACTION)
+			errx(1, "unexpected reply");
+		bb_send(&b, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		bb_free(&b, &tr);
+		if (tr.code == BB_QUIT)
+			break;
+	}
+	bb_flush(&b);
+	exit(0);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void client(int index, size_t size, int secs, int result_fd)
+{
+	struct binder_transaction_data tr;
+	struct flat_binder_object obj;
+	struct bb_result res;
+	uint32_t idx = index;
+	uint32_t handle = 0;
+	double start;
+	void *payload;
+	struct bb b;
+	int i;
+
+	bb_open(&b);
+
+	/* the server may not have registered yet */
+	while (!handle) {
+		bb_call(&b, 0, BB_LOOKUP, &idx, sizeof(idx), NULL, 0, &tr);
+		if (tr.data_size >= sizeof(obj) && tr.offsets_size) {
+			memcpy(&obj, tr.data.ptr.buffer, sizeof(obj));
+			handle = obj.handle;
+			bb_put(&b, BC_ACQUIRE, &handle, sizeof(handle));
+		}
+		bb_free(&b, &tr);
+		if (!handle)
+			usleep(1000);
+	}
+
+	payload = calloc(1, size ? size : 1);
+	if (!payload)
+		err(1, "payload");
+
+	res.index = index;
+	res.count = 0;
+	start = now();
+	do {
+		for (i = 0; i < BB_BATCH; i++) {
+			bb_call(&b, handle, BB_PING, payload, size,
+				NULL, 0, &tr);
+			bb_free(&b, &tr);
+		}
+		res.count += BB_BATCH;
+		res.secs = now() - start;
+	} while (res.secs < secs);
+
+	if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+		err(1, "write result");
+
+	bb_call(&b, handle, BB_QUIT, NULL, 0, NULL, 0, &tr);
+	bb_free(&b, &tr);
+	bb_flush(&b);
+	exit(0);
+}
+
+/* hands each server's object to its client */
+static void context_manager(struct bb *b, int pairs)
+{
+	uint32_t handles[BB_MAX_PAIRS] = { 0 };
+	struct binder_transaction_data tr;
+	struct flat_binder_object obj;
+	struct bb_register reg;
+	size_t offset = 0;
+	int looked_up = 0;
+	uint32_t idx;
+
+	bb_put(b, BC_ENTER_LOOPER, NULL, 0);
+	while (looked_up < pairs) {
+		if (bb_wait(b, &tr) != BR_TRANSACTION)
+			errx(1, "unexpected reply");
+
+		switch (tr.code) {
+		case BB_REGISTER:
+			memcpy(&reg, tr.data.ptr.buffer, sizeof(reg));
+			if (reg.index >= BB_MAX_PAIRS)
+				errx(1, "bad server index %u", reg.index);
+			/* keep the reference once the buffer is freed */
+			handles[reg.index] = reg.obj.handle;
+			bb_put(b, BC_ACQUIRE, &handles[reg.index],
+			       sizeof(handles[reg.index]));
+			bb_send(b, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+			break;
+		case BB_LOOKUP:
+			memcpy(&idx, tr.data.ptr.buffer, sizeof(idx));
+			if (idx >= BB_MAX_PAIRS || !handles[idx]) {
+				bb_send(b, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+				break;
+			}
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.handle = handles[idx];
+			/* obj is sent by the next write, before it is reused */
+			bb_send(b, BC_REPLY, 0, 0, &obj, sizeof(obj),
+				&offset, sizeof(offset));
+			looked_up++;
+			break;
+		default:
+			errx(1, "unexpected code %u", tr.code);
+		}
+		bb_free(b, &tr);
+	}
+	bb_flush(b);
+}
+
+/* the child gets its own binder proc, not the context manager's */
+static pid_t bb_fork(struct bb *b)
+{
+	pid_t pid = fork();
+
+	if (pid < 0)
+		err(1, "fork");
+	if (!pid)
+		close(b->fd);
+	return pid;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n pairs] [-s bytes] [-t seconds] [-S]\n"
+		"  -S  run with 1, 2, 4, ... pairs up to -n\n", prog);
+	exit(1);
+}
+
+/* one run with the given number of pairs; returns the total rate */
+static double bb_run(struct bb *b, int pairs, size_t size, int secs,
+		     int verbose)
+{
+	struct bb_result res;
+	double total = 0;
+	int pipefd[2];
+	int i;
+
+	if (pipe(pipefd) < 0)
+		err(1, "pipe");
+
+	for (i = 0; i < pairs; i++) {
+		if (!bb_fork(b))
+			server(i);
+		if (!bb_fork(b))
+			client(i, size, secs, pipefd[1]);
+	}
+
+	context_manager(b, pairs);
+
+	for (i = 0; i < pairs; i++) {
+		if (read(pipefd[0], &res, sizeof(res)) != sizeof(res))
+			err(1, "read result");
+		if (verbose)
+			printf("pair %2d: %10.0f transactions/s\n", res.index,
+			       res.count / res.secs);
+		total += res.count / res.secs;
+	}
+	while (wait(NULL) > 0)
+		;
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	int pairs = 1, secs = 5, sweep = 0;
+	size_t size = 0;
+	double total;
+	struct bb b;
+	int c, n;
+
+	while ((c = getopt(argc, argv, "n:s:t:Sh")) != EOF) {
+		switch (c) {
+		case 'n':
+			pairs = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'S':
+			sweep = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (pairs < 1 || pairs > BB_MAX_PAIRS || secs < 1 ||
+	    size > BB_MAP_SIZE / 4)
+		usage(argv[0]);
+
+	bb_open(&b);
+	if (ioctl(b.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		err(1, "BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+	if (!sweep) {
+		total = bb_run(&b, pairs, size, secs, 1);
+		printf("%d pairs, %zu bytes: %.0f transactions/s\n",
+		       pairs, size, total);
+		return 0;
+	}
+
+	/* a scaling table that can be compared across kernels */
+	for (n = 1; ; n *= 2) {
+		if (n > pairs)
+			n = pairs;
+		total = bb_run(&b, n, size, secs, 0);
+		printf("%2d pairs, %zu bytes: %10.0f transactions/s\n",
+		       n, size, total);
+		fflush(stdout);
+		if (n == pairs)
+			break;
+	}
+	return 0;
+}